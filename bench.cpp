@@ -0,0 +1,785 @@
+// bench.cpp: Benchmarks for the core graph merger, on synthetic graph pairs
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <iterator>
+#include <list>
+#include <new>
+#include <random>
+#include <sstream>
+#include <getopt.h>
+#include <ftw.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "ekg/vg/vg.hpp"
+#include "ekg/vg/index.hpp"
+
+#include "embeddedGraph.hpp"
+#include "coreGraph.hpp"
+#include "syntheticGraph.hpp"
+#include "pinchGraph.hpp"
+#include "kmerWalker.hpp"
+
+#ifdef COUNT_ALLOCATIONS
+// How many times operator new has been called, so we can see how many heap
+// allocations each phase makes. Counting puts an atomic increment on every
+// allocation, so it is only compiled into the corg-bench-alloc build, and
+// timings from that build shouldn't be trusted.
+std::atomic<size_t> allocationCount(0);
+
+/**
+ * Count heap allocations as they are made.
+ */
+void* operator new(size_t size) {
+    allocationCount++;
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if(memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+#endif
+
+/**
+ * Run the given function and return how many seconds it took.
+ */
+double timeIt(const std::function<void(void)>& function) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+/**
+ * Print one line of benchmark results, as TSV, to standard output.
+ */
+void report(size_t nodeCount, const std::string& phase, double seconds, size_t items, const std::string& unit) {
+    std::cout << nodeCount << "\t" << phase << "\t" << seconds << "\t" << items << "\t" << unit << "\t"
+        << (seconds > 0 ? items / seconds : 0) << std::endl;
+}
+
+/**
+ * Get how much memory the process is using right now, in kilobytes.
+ */
+size_t currentMemory() {
+    std::ifstream statm("/proc/self/statm");
+    size_t totalPages = 0;
+    size_t residentPages = 0;
+    statm >> totalPages >> residentPages;
+    return residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * Get the most memory the process has used since the peak was last reset, or
+ * since it started, in kilobytes.
+ */
+size_t peakMemory() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while(std::getline(status, line)) {
+        if(line.compare(0, 6, "VmHWM:") == 0) {
+            return std::stoull(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+/**
+ * Give freed heap memory back to the OS, so it stops counting as resident.
+ * The allocator otherwise hangs on to a lot of it.
+ */
+void trimMemory() {
+    malloc_trim(0);
+}
+
+/**
+ * Trim the heap and start tracking the peak resident size afresh from the
+ * current one, so peakMemory() gives the peak of only what runs next. Returns
+ * false if the kernel wouldn't reset it.
+ */
+bool resetPeakMemory() {
+    trimMemory();
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5" << std::endl;
+    return clearRefs.good();
+}
+
+/**
+ * Count the bases covered by all the paths in a graph.
+ */
+size_t pathBases(vg::VG& graph) {
+    size_t total = 0;
+    graph.paths.for_each([&](vg::Path& path) {
+        for(size_t i = 0; i < path.mapping_size(); i++) {
+            total += graph.get_node(path.mapping(i).position().node_id())->sequence().size();
+        }
+    });
+    return total;
+}
+
+/**
+ * Count the bases in all the nodes of a graph.
+ */
+size_t graphBases(vg::VG& graph) {
+    size_t total = 0;
+    graph.for_each_node([&](vg::Node* node) {
+        total += node->sequence().size();
+    });
+    return total;
+}
+
+/**
+ * Remove one file or empty directory, for nftw().
+ */
+int removeEntry(const char* path, const struct stat* info, int type, struct FTW* walk) {
+    return remove(path);
+}
+
+/**
+ * Remove a directory and everything in it, without going through a shell.
+ * Symlinks are removed, not followed.
+ */
+void removeDirectory(const std::string& directory) {
+    if(nftw(directory.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS) != 0) {
+        std::cerr << "WARNING: Could not remove " << directory << std::endl;
+    }
+}
+
+/**
+ * Build a kmer index for the given graph in a new temporary directory, and
+ * return the directory name.
+ */
+std::string buildTemporaryIndex(vg::VG& graph, size_t kmerSize, size_t edgeMax) {
+    char directoryTemplate[] = "/tmp/corg-bench-XXXXXX";
+    if(mkdtemp(directoryTemplate) == nullptr) {
+        throw std::runtime_error("Could not make temporary index directory");
+    }
+    std::string directory = std::string(directoryTemplate) + "/index";
+
+    // We need to use pointers because destructing an index that was never
+    // opened segfaults. TODO: fix vg
+    vg::Index* index = new vg::Index();
+    index->open_for_bulk_load(directory);
+    index->index_kmers(graph, kmerSize, false, edgeMax);
+    index->flush();
+    index->close();
+    delete index;
+
+    return directory;
+}
+
+/**
+ * Merge a pair of graphs on their shared paths, and on path kmers of the given
+ * size if it is from 1 to 32, with the given pinch engine, and return the core
+ * graph as GFA.
+ */
+std::string mergeToGFA(vg::VG& vg1, vg::VG& vg2, bool nativePinch, size_t kmerSize) {
+    int64_t nextId = 1;
+    std::function<int64_t(void)> getId = [&]() {
+        return nextId++;
+    };
+    std::unique_ptr<coregraph::PinchGraph> pinchGraph = coregraph::makePinchGraph(nativePinch);
+    coregraph::SequenceStore threadSequences;
+
+    std::ostringstream out;
+    {
+        // The embeddings refer to the pinch graph, so they have to go first.
+        coregraph::EmbeddedGraph embedding1(vg1, *pinchGraph, threadSequences, getId, "synthetic1");
+        coregraph::EmbeddedGraph embedding2(vg2, *pinchGraph, threadSequences, getId, "synthetic2");
+        embedding1.pinchWith(embedding2);
+        if(kmerSize > 0 && kmerSize <= 32) {
+            embedding1.pinchOnPathKmers(embedding2, kmerSize, threadSequences);
+        }
+
+        pinchGraph->joinTrivialBoundaries();
+        coregraph::pinchToGFA(*pinchGraph, threadSequences, out, coregraph::CoreGraphOptions(),
+            {&embedding1, &embedding2});
+    }
+    return out.str();
+}
+
+/**
+ * Make a small random graph with all the things that make walking kmers
+ * tricky: self loops, edges that reverse direction, tips, and bases that
+ * aren't ACGT, in upper and lower case.
+ */
+void makeTangledGraph(uint64_t seed, size_t nodeCount, vg::VG& graph) {
+    std::mt19937_64 rng(seed);
+    const std::string bases = "ACGTACGTACGTACGTNacgt";
+
+    std::vector<vg::Node*> nodes;
+    for(size_t i = 0; i < nodeCount; i++) {
+        std::string sequence(1 + rng() % 12, 'A');
+        for(auto& base : sequence) {
+            base = bases[rng() % bases.size()];
+        }
+        nodes.push_back(graph.create_node(sequence));
+    }
+
+    for(size_t i = 0; i < nodeCount * 2; i++) {
+        vg::Node* from = nodes[rng() % nodes.size()];
+        // Some edges are self loops
+        vg::Node* to = rng() % 8 == 0 ? from : nodes[rng() % nodes.size()];
+        graph.create_edge(from, to, rng() % 4 == 0, rng() % 4 == 0);
+    }
+}
+
+/**
+ * Make a key for a kmer and the steps it takes, so kmers found in different
+ * ways can be compared, and hash it.
+ */
+uint64_t hashKmer(const std::string& kmer, const std::vector<coregraph::PathStep>& steps, std::string& key) {
+    key.assign(kmer);
+    for(auto& step : steps) {
+        key.append((const char*) &step.nodeId, sizeof(step.nodeId));
+        key.append((const char*) &step.offset, sizeof(step.offset));
+        key.push_back(step.isReverse);
+        key.append((const char*) &step.length, sizeof(step.length));
+    }
+    return std::hash<std::string>()(key);
+}
+
+/**
+ * Sort hashed kmers and throw out repeats. Kmers found more than once along
+ * the same steps don't change which kmers are unique, so only the distinct
+ * ones are compared.
+ */
+std::vector<uint64_t> collectHashes(std::vector<std::vector<uint64_t>>& threadHashes) {
+    std::vector<uint64_t> hashes;
+    for(auto& found : threadHashes) {
+        hashes.insert(hashes.end(), found.begin(), found.end());
+    }
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    return hashes;
+}
+
+/**
+ * Find the kmers of the given size in a graph with a KmerWalker limited by
+ * the given edgeMax, keeping only those through fewer than choiceLimit
+ * choice points if it isn't 0, and return their hashes, sorted and distinct.
+ */
+std::vector<uint64_t> walkerKmers(vg::VG& graph, size_t kmerSize, size_t edgeMax, size_t choiceLimit) {
+    std::vector<std::vector<uint64_t>> threadHashes(omp_get_max_threads());
+    std::vector<std::string> threadKmers(omp_get_max_threads());
+    std::vector<std::string> threadKeys(omp_get_max_threads());
+    std::vector<std::vector<coregraph::PathStep>> threadSteps(omp_get_max_threads());
+
+    coregraph::KmerWalker walker(graph, kmerSize, edgeMax);
+    walker.forEachKmerParallel([&](const coregraph::KmerAnchor& anchor, const coregraph::KmerWalker::Walk& walk) {
+        if(choiceLimit != 0 && anchor.choicePoints >= choiceLimit) {
+            return;
+        }
+        size_t thread = omp_get_thread_num();
+        walker.spellKmer(anchor, walk, threadKmers[thread]);
+        walker.getSteps(anchor, walk, threadSteps[thread]);
+        threadHashes[thread].push_back(hashKmer(threadKmers[thread], threadSteps[thread], threadKeys[thread]));
+    });
+
+    return collectHashes(threadHashes);
+}
+
+/**
+ * Find the kmers of the given size in a graph with vg's
+ * for_each_kmer_parallel(), the way corg used to before it had KmerWalker,
+ * and return their hashes, sorted and distinct. Kmers are upper cased, and
+ * ones with anything but ACGT in them are dropped, since KmerWalker skips
+ * those.
+ */
+std::vector<uint64_t> vgKmers(vg::VG& graph, size_t kmerSize) {
+    std::vector<std::vector<uint64_t>> threadHashes(omp_get_max_threads());
+    std::vector<std::string> threadKmers(omp_get_max_threads());
+    std::vector<std::string> threadKeys(omp_get_max_threads());
+    std::vector<std::vector<coregraph::PathStep>> threadSteps(omp_get_max_threads());
+
+    graph.for_each_kmer_parallel(kmerSize, 0, [&](std::string& kmer, std::list<vg::NodeTraversal>::iterator occurrence,
+        int offset, std::list<vg::NodeTraversal>& path, vg::VG& kmerGraph) {
+
+        size_t thread = omp_get_thread_num();
+        std::string& upper = threadKmers[thread];
+        upper.resize(kmer.size());
+        for(size_t i = 0; i < kmer.size(); i++) {
+            int code = coregraph::KmerWalker::encodeBase(kmer[i]);
+            if(code < 0) {
+                return;
+            }
+            upper[i] = "ACGT"[code];
+        }
+
+        // Trace the kmer's steps along the kpath, from the offset in the
+        // first node it visits.
+        std::vector<coregraph::PathStep>& steps = threadSteps[thread];
+        steps.clear();
+        int64_t remaining = kmerSize;
+        int64_t nextOffset = offset;
+        for(auto i = occurrence; i != path.end() && remaining > 0; ++i) {
+            int64_t nodeLength = (*i).node->sequence().size();
+            coregraph::PathStep step;
+            step.nodeId = (*i).node->id();
+            step.isReverse = (*i).backward;
+            step.offset = step.isReverse ? nodeLength - nextOffset - 1 : nextOffset;
+            step.length = std::min(remaining, nodeLength - nextOffset);
+            remaining -= step.length;
+            nextOffset = 0;
+            steps.push_back(step);
+        }
+
+        threadHashes[thread].push_back(hashKmer(upper, steps, threadKeys[thread]));
+    }, true, false); // Accept duplicate kmers, but not kmers with negative offsets.
+
+    return collectHashes(threadHashes);
+}
+
+/**
+ * Count the kmers found one way but not the other, given the sorted,
+ * distinct hashes of each.
+ */
+size_t countDifferences(const std::vector<uint64_t>& hashes1, const std::vector<uint64_t>& hashes2) {
+    std::vector<uint64_t> different;
+    std::set_symmetric_difference(hashes1.begin(), hashes1.end(), hashes2.begin(), hashes2.end(),
+        std::back_inserter(different));
+    return different.size();
+}
+
+/**
+ * Check KmerWalker on a graph, against vg with no edgeMax, and, if edgeMax is
+ * set, against its own unlimited walk filtered down to kmers through fewer
+ * than edgeMax choice points, so masking and cutting walks short lose
+ * nothing. Reports a row for each check, and returns the number of kmers
+ * that differ.
+ */
+size_t checkKmerWalker(vg::VG& graph, size_t nodeCount, const std::string& label, size_t kmerSize, size_t edgeMax) {
+    size_t differences = 0;
+    std::vector<uint64_t> unlimited;
+    double seconds = timeIt([&]() {
+        unlimited = walkerKmers(graph, kmerSize, 0, 0);
+        differences = countDifferences(unlimited, vgKmers(graph, kmerSize));
+    });
+    report(nodeCount, label + "KmerWalkerVsVG", seconds, differences, "kmers differing");
+    size_t total = differences;
+
+    if(edgeMax > 0) {
+        seconds = timeIt([&]() {
+            differences = countDifferences(walkerKmers(graph, kmerSize, edgeMax, 0),
+                walkerKmers(graph, kmerSize, 0, edgeMax));
+        });
+        report(nodeCount, label + "KmerWalkerMaskingVsUnmasked", seconds, differences, "kmers differing");
+        total += differences;
+    }
+
+    if(total > 0) {
+        std::cerr << "ERROR: KmerWalker found different kmers of size " << kmerSize << " with edge max " <<
+            edgeMax << " in " << label << " graph of " << nodeCount << " nodes" << std::endl;
+    }
+    return total;
+}
+
+void help_bench(char** argv) {
+    std::cerr << "usage: " << argv[0] << " [options]" << std::endl
+        << "Benchmark core graph construction on synthetic graph pairs, at node "
+        << "counts going up by powers of 10. Prints a TSV of node count, phase, "
+        << "seconds, items processed, item unit, and throughput." << std::endl
+        << std::endl
+        << "options:" << std::endl
+        << "    -h, --help                print this help message" << std::endl
+        << "    -n, --min-nodes N         smallest graph size to try [1000]" << std::endl
+        << "    -N, --max-nodes N         largest graph size to try [10000000]" << std::endl
+        << "    -l, --node-length N       mean backbone node length [32]" << std::endl
+        << "    -v, --variant-density F   fraction of backbone nodes with a bubble [0.1]" << std::endl
+        << "    -p, --paths N             number of shared paths [1]" << std::endl
+        << "    -r, --reverse-share F     fraction of nodes stored on the reverse strand [0.1]" << std::endl
+        << "    -s, --seed N              random seed [1]" << std::endl
+        << "    -k, --kmer-size N         benchmark kmer pinching with this kmer size (0 to skip) [16]" << std::endl
+        << "    -e, --edge-max N          exclude k-paths which have N or more choice points [3]" << std::endl
+        << "    -P, --native-pinch        use the built-in pinch engine instead of sonLib's, and check" << std::endl
+        << "                              that it makes the same core graph as sonLib" << std::endl
+        << "    -g, --generate PREFIX     just write a pair of graphs of the min size to PREFIX.1.vg and PREFIX.2.vg" << std::endl
+        << "    -K, --check-kmers         instead of benchmarking, check that the kmer walker finds the" << std::endl
+        << "                              same kmers as vg, on small random graphs and on the synthetic" << std::endl
+        << "                              graphs (keep -N small)" << std::endl
+        << "    -t, --threads N           number of threads to use" << std::endl;
+}
+
+int main(int argc, char** argv) {
+
+    coregraph::SyntheticGraphParameters parameters;
+
+    size_t minNodes = 1000;
+    size_t maxNodes = 10000000;
+    size_t kmerSize = 16;
+    size_t edgeMax = 3;
+
+    // Should we use our own pinch engine instead of sonLib's?
+    bool nativePinch = false;
+
+    // If set, we just generate graphs here instead of benchmarking.
+    std::string generatePrefix;
+
+    // Should we check kmer finding instead of benchmarking?
+    bool checkKmers = false;
+
+    optind = 1; // Start at first real argument
+    bool optionsRemaining = true;
+    while(optionsRemaining) {
+        static struct option longOptions[] = {
+            {"min-nodes", required_argument, 0, 'n'},
+            {"max-nodes", required_argument, 0, 'N'},
+            {"node-length", required_argument, 0, 'l'},
+            {"variant-density", required_argument, 0, 'v'},
+            {"paths", required_argument, 0, 'p'},
+            {"reverse-share", required_argument, 0, 'r'},
+            {"seed", required_argument, 0, 's'},
+            {"kmer-size", required_argument, 0, 'k'},
+            {"edge-max", required_argument, 0, 'e'},
+            {"native-pinch", no_argument, 0, 'P'},
+            {"generate", required_argument, 0, 'g'},
+            {"check-kmers", no_argument, 0, 'K'},
+            {"threads", required_argument, 0, 't'},
+            {"help", no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+
+        int optionIndex = 0;
+
+        switch(getopt_long(argc, argv, "n:N:l:v:p:r:s:k:e:Pg:Kt:h", longOptions, &optionIndex)) {
+        // Option value is in global optarg
+        case -1:
+            optionsRemaining = false;
+            break;
+        case 'n':
+            minNodes = atol(optarg);
+            break;
+        case 'N':
+            maxNodes = atol(optarg);
+            break;
+        case 'l':
+            parameters.meanNodeLength = atol(optarg);
+            break;
+        case 'v':
+            parameters.variantDensity = atof(optarg);
+            break;
+        case 'p':
+            parameters.pathCount = atol(optarg);
+            break;
+        case 'r':
+            parameters.reverseShare = atof(optarg);
+            break;
+        case 's':
+            parameters.seed = atol(optarg);
+            break;
+        case 'k':
+            kmerSize = atol(optarg);
+            break;
+        case 'e':
+            edgeMax = atol(optarg);
+            break;
+        case 'P':
+            nativePinch = true;
+            break;
+        case 'g':
+            generatePrefix = optarg;
+            break;
+        case 'K':
+            checkKmers = true;
+            break;
+        case 't': // Set the openmp threads
+            omp_set_num_threads(atoi(optarg));
+            break;
+        case 'h': // When the user asks for help
+        case '?': // When we get options we can't parse
+            help_bench(argv);
+            exit(1);
+            break;
+        default:
+            std::cerr << "Illegal option" << std::endl;
+            exit(1);
+        }
+    }
+
+    if(minNodes == 0 || maxNodes < minNodes) {
+        std::cerr << "Invalid size range " << minNodes << " to " << maxNodes << std::endl;
+        exit(1);
+    }
+
+    if(!generatePrefix.empty()) {
+        // Just make some graphs for someone else to use.
+        parameters.nodeCount = minNodes;
+        vg::VG vg1;
+        vg::VG vg2;
+        coregraph::makeSyntheticPair(parameters, vg1, vg2);
+
+        std::ofstream out1(generatePrefix + ".1.vg");
+        vg1.serialize_to_ostream(out1);
+        std::ofstream out2(generatePrefix + ".2.vg");
+        vg2.serialize_to_ostream(out2);
+
+        std::cerr << "Wrote " << vg1.node_count() << " and " << vg2.node_count() << " node graphs to "
+            << generatePrefix << ".1.vg and " << generatePrefix << ".2.vg" << std::endl;
+        return 0;
+    }
+
+    std::cout << "#nodes\tphase\tseconds\titems\tunit\tthroughput" << std::endl;
+
+    // How many sizes failed a check
+    size_t failures = 0;
+
+    if(checkKmers) {
+        if(kmerSize == 0) {
+            std::cerr << "Can't check kmers with no kmer size" << std::endl;
+            exit(1);
+        }
+
+        // Try small tangled graphs first, with kmers shorter and longer than
+        // their nodes and than the 32 bases a code holds.
+        size_t tangledNodes = 30;
+        for(uint64_t seed = 1; seed <= 20; seed++) {
+            vg::VG tangled;
+            makeTangledGraph(seed, tangledNodes, tangled);
+            for(size_t tangledKmerSize : {1, 2, 3, 5, 8, 13, 21, 32, 33, 41}) {
+                for(size_t tangledEdgeMax : {0, 1, 2, 3}) {
+                    if(checkKmerWalker(tangled, tangledNodes, "tangled", tangledKmerSize, tangledEdgeMax) > 0) {
+                        failures++;
+                    }
+                }
+            }
+        }
+
+        // Then the synthetic pairs, with the kmer size and edge max we were
+        // given.
+        for(size_t nodeCount = minNodes; nodeCount <= maxNodes; nodeCount *= 10) {
+            parameters.nodeCount = nodeCount;
+            vg::VG vg1;
+            vg::VG vg2;
+            coregraph::makeSyntheticPair(parameters, vg1, vg2);
+            for(vg::VG* graph : {&vg1, &vg2}) {
+                if(checkKmerWalker(*graph, nodeCount, "synthetic", kmerSize, edgeMax) > 0) {
+                    failures++;
+                }
+            }
+        }
+
+        return failures > 0 ? 1 : 0;
+    }
+
+    for(size_t nodeCount = minNodes; nodeCount <= maxNodes; nodeCount *= 10) {
+        // Make the graphs for this size
+        parameters.nodeCount = nodeCount;
+        // We hold them by pointer so they can be freed before the output is
+        // built, as main does.
+        std::unique_ptr<vg::VG> vg1(new vg::VG());
+        std::unique_ptr<vg::VG> vg2(new vg::VG());
+        coregraph::makeSyntheticPair(parameters, *vg1, *vg2);
+
+        std::cerr << "Benchmarking on " << vg1->node_count() << " and " << vg2->node_count() << " node graphs" << std::endl;
+
+        if(nativePinch) {
+            // Make sure the native engine makes exactly what sonLib makes
+            bool identical = false;
+            double seconds = timeIt([&]() {
+                identical = (mergeToGFA(*vg1, *vg2, true, kmerSize) == mergeToGFA(*vg1, *vg2, false, kmerSize));
+            });
+            report(nodeCount, "nativeMatchesSonLib", seconds, identical, "identical");
+            if(!identical) {
+                std::cerr << "ERROR: Native and sonLib pinch engines made different core graphs for " <<
+                    nodeCount << " nodes" << std::endl;
+                failures++;
+            }
+        }
+
+        // Set up ID tracking and a pinch graph like main does
+        int64_t nextId = 1;
+        std::function<int64_t(void)> getId = [&]() {
+            return nextId++;
+        };
+        std::unique_ptr<coregraph::PinchGraph> pinchGraph = coregraph::makePinchGraph(nativePinch);
+        coregraph::SequenceStore threadSequences;
+
+        // Embedding both graphs
+        coregraph::EmbeddedGraph* embedding1 = nullptr;
+        coregraph::EmbeddedGraph* embedding2 = nullptr;
+        double seconds = timeIt([&]() {
+            embedding1 = new coregraph::EmbeddedGraph(*vg1, *pinchGraph, threadSequences, getId, "synthetic1");
+            embedding2 = new coregraph::EmbeddedGraph(*vg2, *pinchGraph, threadSequences, getId, "synthetic2");
+        });
+        report(nodeCount, "EmbeddedGraph", seconds, vg1->node_count() + vg2->node_count(), "nodes");
+
+        {
+            // Setting up the reference for each graph in a batch, as main
+            // does, with the first graph as the reference. Its thread
+            // sequences are already stored, as they are in a batch.
+            coregraph::EmbeddingPlan plan;
+            coregraph::EmbeddedGraph::planEmbedding(*vg1, plan);
+            int64_t referenceNextId = 1;
+            std::function<int64_t(void)> referenceGetId = [&]() {
+                return referenceNextId++;
+            };
+            std::unique_ptr<coregraph::PinchGraph> referencePinchGraph = coregraph::makePinchGraph(nativePinch);
+            std::unique_ptr<coregraph::EmbeddedGraph> reference;
+            seconds = timeIt([&]() {
+                reference.reset(new coregraph::EmbeddedGraph(*vg1, *referencePinchGraph, threadSequences,
+                    referenceGetId, "synthetic1", &plan));
+                reference->validatePaths();
+            });
+            report(nodeCount, "embedReference", seconds, vg1->node_count(), "nodes");
+
+            if(nativePinch) {
+                // With the native engine, main copies a reference embedded
+                // once instead.
+                auto& snapshot = static_cast<coregraph::NativePinchGraph&>(*referencePinchGraph);
+                std::unique_ptr<coregraph::PinchGraph> copiedPinchGraph;
+                std::unique_ptr<coregraph::EmbeddedGraph> copied;
+                seconds = timeIt([&]() {
+                    copiedPinchGraph.reset(new coregraph::NativePinchGraph(snapshot));
+                    copied.reset(new coregraph::EmbeddedGraph(*reference, *copiedPinchGraph));
+                });
+                report(nodeCount, "copyReference", seconds, vg1->node_count(), "nodes");
+            }
+        }
+
+        // Pinching on the shared paths
+        seconds = timeIt([&]() {
+            embedding1->pinchWith(*embedding2);
+        });
+        report(nodeCount, "pinchOnPaths", seconds, pathBases(*vg1) + pathBases(*vg2), "bp");
+
+        if(kmerSize > 0) {
+            // Pinching on kmers. Indexing isn't part of what we measure.
+            std::string indexDir1 = buildTemporaryIndex(*vg1, kmerSize, edgeMax);
+            std::string indexDir2 = buildTemporaryIndex(*vg2, kmerSize, edgeMax);
+            vg::Index* index1 = new vg::Index();
+            index1->open_read_only(indexDir1);
+            vg::Index* index2 = new vg::Index();
+            index2->open_read_only(indexDir2);
+
+#ifdef COUNT_ALLOCATIONS
+            size_t allocationsBefore = allocationCount;
+#endif
+            seconds = timeIt([&]() {
+                embedding1->pinchOnKmers(*index1, *embedding2, *index2, kmerSize, edgeMax);
+            });
+            report(nodeCount, "pinchOnKmers", seconds, graphBases(*vg1) + graphBases(*vg2), "bp");
+#ifdef COUNT_ALLOCATIONS
+            report(nodeCount, "pinchOnKmersAllocations", 0, allocationCount - allocationsBefore, "allocations");
+#endif
+
+            delete index1;
+            delete index2;
+            // Clean up the directories that mkdtemp made
+            removeDirectory(indexDir1.substr(0, indexDir1.rfind('/')));
+            removeDirectory(indexDir2.substr(0, indexDir2.rfind('/')));
+        }
+
+        if(kmerSize > 0 && kmerSize <= 32) {
+            // Pinching on kmers read off the paths, which needs no index. The
+            // main pinch graph already has the graph kmers pinched, so use a
+            // fresh one, pinched on paths only, to compare with pinchOnKmers.
+            int64_t freshNextId = 1;
+            std::function<int64_t(void)> freshGetId = [&]() {
+                return freshNextId++;
+            };
+            std::unique_ptr<coregraph::PinchGraph> freshPinchGraph = coregraph::makePinchGraph(nativePinch);
+            coregraph::SequenceStore freshSequences;
+            {
+                coregraph::EmbeddedGraph fresh1(*vg1, *freshPinchGraph, freshSequences, freshGetId, "synthetic1");
+                coregraph::EmbeddedGraph fresh2(*vg2, *freshPinchGraph, freshSequences, freshGetId, "synthetic2");
+                fresh1.pinchWith(fresh2);
+
+                seconds = timeIt([&]() {
+                    fresh1.pinchOnPathKmers(fresh2, kmerSize, freshSequences);
+                });
+                report(nodeCount, "pinchOnPathKmers", seconds, pathBases(*vg1) + pathBases(*vg2), "bp");
+            }
+        }
+
+        seconds = timeIt([&]() {
+            pinchGraph->joinTrivialBoundaries();
+        });
+        report(nodeCount, "joinTrivialBoundaries", seconds, 0, "");
+
+        {
+            // Working out the segments and blocks, which is where the native
+            // engine does its pinching. It keeps what it works out, so the
+            // core graphs below don't do it again.
+            coregraph::FlatPinchGraph flat;
+            seconds = timeIt([&]() {
+                pinchGraph->flatten(flat);
+            });
+            report(nodeCount, "flatten", seconds, flat.segmentStarts.size(), "segments");
+        }
+
+        // Build and write the core graph once with the input graphs still
+        // held, to see how high memory goes if they aren't freed first.
+        bool peakReset = resetPeakMemory();
+        {
+            vg::VG heldCore = coregraph::pinchToVG(*pinchGraph, threadSequences);
+            std::ostringstream out;
+            coregraph::writeVGParallel(heldCore, out);
+        }
+        size_t heldPeak = peakMemory();
+        if(!peakReset) {
+            std::cerr << "WARNING: Could not reset peak memory; output peaks include earlier phases" << std::endl;
+        }
+
+        // Free the input graphs, and see how much memory that gives back
+        trimMemory();
+        size_t heldMemory = currentMemory();
+        seconds = timeIt([&]() {
+            embedding1->releaseSource();
+            embedding2->releaseSource();
+            vg1.reset();
+            vg2.reset();
+            trimMemory();
+        });
+        report(nodeCount, "releaseInputs", seconds, heldMemory - std::min(heldMemory, currentMemory()), "kB freed");
+
+        // Now measure the output peak again, with the inputs freed, as corg
+        // does it.
+        resetPeakMemory();
+
+        // Building the output graph
+        size_t coreNodes = 0;
+        // We keep it around by pointer to write it out next.
+        std::unique_ptr<vg::VG> core;
+#ifdef COUNT_ALLOCATIONS
+        size_t allocationsBefore = allocationCount;
+#endif
+        seconds = timeIt([&]() {
+            core.reset(new vg::VG(coregraph::pinchToVG(*pinchGraph, threadSequences)));
+            coreNodes = core->node_count();
+        });
+        report(nodeCount, "pinchToVG", seconds, coreNodes, "nodes");
+#ifdef COUNT_ALLOCATIONS
+        report(nodeCount, "pinchToVGAllocations", 0, allocationCount - allocationsBefore, "allocations");
+#endif
+
+        // Writing it out, as main does, to count how fast it encodes
+        size_t coreBytes = 0;
+        seconds = timeIt([&]() {
+            std::ostringstream out;
+            coregraph::writeVGParallel(*core, out);
+            coreBytes = out.str().size();
+        });
+        report(nodeCount, "writeVG", seconds, coreBytes, "bytes");
+
+        // Both peaks cover just building and writing the core graph, on top
+        // of whatever was resident when it started.
+        report(nodeCount, "outputPeakMemoryInputsHeld", 0, heldPeak, "kB");
+        report(nodeCount, "outputPeakMemory", 0, peakMemory(), "kB");
+
+        delete embedding1;
+        delete embedding2;
+        pinchGraph.reset();
+    }
+
+    return failures > 0 ? 1 : 0;
+}
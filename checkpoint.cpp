@@ -0,0 +1,235 @@
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+#include "embeddedGraph.hpp"
+
+namespace coregraph {
+
+// This goes at the start of every checkpoint file, so we can tell if we were
+// handed something else. The number at the end is the format version.
+static const std::string CHECKPOINT_MAGIC = "corgckpt3";
+
+CheckpointWriter::CheckpointWriter(const std::string& filename): file(filename, std::ios::binary) {
+    if(!file.good()) {
+        throw std::runtime_error("Could not write checkpoint " + filename);
+    }
+    rawOut.reset(new ::google::protobuf::io::OstreamOutputStream(&file));
+    gzipOut.reset(new ::google::protobuf::io::GzipOutputStream(rawOut.get()));
+    codedOut.reset(new ::google::protobuf::io::CodedOutputStream(gzipOut.get()));
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    // Tear down in order, so everything gets flushed through
+    codedOut.reset();
+    gzipOut.reset();
+    rawOut.reset();
+}
+
+void CheckpointWriter::writeNumber(uint64_t number) {
+    codedOut->WriteVarint64(number);
+}
+
+void CheckpointWriter::writeSigned(int64_t number) {
+    codedOut->WriteVarint64(((uint64_t) number << 1) ^ (uint64_t) (number >> 63));
+}
+
+void CheckpointWriter::writeString(const std::string& string) {
+    writeNumber(string.size());
+    codedOut->WriteString(string);
+}
+
+void CheckpointWriter::close() {
+    bool failed = codedOut->HadError();
+    codedOut.reset();
+    failed = !gzipOut->Close() || failed;
+    gzipOut.reset();
+    rawOut.reset();
+    file.close();
+    if(failed || file.fail()) {
+        throw std::runtime_error("Could not finish writing checkpoint");
+    }
+}
+
+CheckpointReader::CheckpointReader(const std::string& filename): file(filename, std::ios::binary) {
+    if(!file.good()) {
+        throw std::runtime_error("Could not read checkpoint " + filename);
+    }
+    rawIn.reset(new ::google::protobuf::io::IstreamInputStream(&file));
+    gzipIn.reset(new ::google::protobuf::io::GzipInputStream(rawIn.get()));
+    renewCodedIn();
+}
+
+CheckpointReader::~CheckpointReader() {
+    codedIn.reset();
+    gzipIn.reset();
+    rawIn.reset();
+}
+
+void CheckpointReader::renewCodedIn() {
+    // The old one has to go first, so it gives back what it read ahead
+    codedIn.reset();
+    codedIn.reset(new ::google::protobuf::io::CodedInputStream(gzipIn.get()));
+    readsSinceRenew = 0;
+}
+
+uint64_t CheckpointReader::readNumber() {
+    if(++readsSinceRenew > 100000) {
+        // Numbers are at most 10 bytes, so this keeps us well under the limit
+        renewCodedIn();
+    }
+    uint64_t number;
+    if(!codedIn->ReadVarint64(&number)) {
+        throw std::runtime_error("Checkpoint is truncated or corrupt");
+    }
+    return number;
+}
+
+int64_t CheckpointReader::readSigned() {
+    uint64_t number = readNumber();
+    return (int64_t) (number >> 1) ^ -(int64_t) (number & 1);
+}
+
+std::string CheckpointReader::readString() {
+    uint64_t length = readNumber();
+    // Strings can be big, so give each its own CodedInputStream
+    renewCodedIn();
+    std::string string;
+    if(length > (uint64_t) INT32_MAX || !codedIn->ReadString(&string, length)) {
+        throw std::runtime_error("Checkpoint is truncated or corrupt");
+    }
+    return string;
+}
+
+void saveCheckpoint(const std::string& filename, CheckpointPhase phase, bool pathsPinched, int64_t nextId,
+    PinchGraph& pinchGraph, const SequenceStore& threadSequences,
+    const std::vector<EmbeddedGraph*>& graphs) {
+    
+    std::cerr << "Writing checkpoint to " << filename << "..." << std::endl;
+    
+    std::string tempFilename = filename + ".tmp";
+    {
+        CheckpointWriter out(tempFilename);
+        
+        out.writeString(CHECKPOINT_MAGIC);
+        out.writeNumber(phase);
+        out.writeNumber(pathsPinched);
+        out.writeSigned(nextId);
+        
+        FlatPinchGraph flat;
+        pinchGraph.flatten(flat);
+        
+        // Write all the threads. Their segments are remade by pinching.
+        out.writeNumber(flat.threadCount());
+        for(size_t thread = 0; thread < flat.threadCount(); thread++) {
+            out.writeSigned(flat.threadNames[thread]);
+            out.writeSigned(flat.threadStarts[thread]);
+            out.writeSigned(flat.threadLengths[thread]);
+        }
+        
+        // Write all the blocks, as the segments in them and which way each
+        // faces.
+        out.writeNumber(flat.blockCount());
+        for(size_t block = 0; block < flat.blockCount(); block++) {
+            size_t leader = flat.blockMembers[flat.blockSegments[block]];
+            out.writeNumber(flat.segmentLengths[leader]);
+            out.writeNumber(flat.blockSegments[block + 1] - flat.blockSegments[block]);
+            for(size_t i = flat.blockSegments[block]; i < flat.blockSegments[block + 1]; i++) {
+                size_t segment = flat.blockMembers[i];
+                out.writeSigned(flat.getSegmentName(segment));
+                out.writeSigned(flat.segmentStarts[segment]);
+                out.writeNumber(flat.segmentOrientations[segment]);
+            }
+        }
+        
+        // Write the sequences
+        out.writeNumber(threadSequences.size());
+        threadSequences.forEach([&](int64_t name, const std::string& sequence) {
+            out.writeSigned(name);
+            out.writeString(sequence);
+        });
+        
+        // Write the embedded graphs
+        out.writeNumber(graphs.size());
+        for(auto graph : graphs) {
+            graph->save(out);
+        }
+        
+        out.close();
+    }
+    
+    // Only now replace the old checkpoint
+    if(std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        throw std::runtime_error("Could not move checkpoint into place at " + filename);
+    }
+}
+
+void loadCheckpoint(const std::string& filename, PinchGraph& pinchGraph, CheckpointPhase& phase,
+    bool& pathsPinched, int64_t& nextId, SequenceStore& threadSequences,
+    std::vector<std::unique_ptr<EmbeddedGraph>>& graphs) {
+    
+    std::cerr << "Reading checkpoint from " << filename << "..." << std::endl;
+    
+    CheckpointReader in(filename);
+    
+    if(in.readString() != CHECKPOINT_MAGIC) {
+        throw std::runtime_error(filename + " is not a corg checkpoint");
+    }
+    phase = (CheckpointPhase) in.readNumber();
+    pathsPinched = in.readNumber();
+    nextId = in.readSigned();
+    
+    // Make all the threads
+    uint64_t threadCount = in.readNumber();
+    for(uint64_t i = 0; i < threadCount; i++) {
+        int64_t name = in.readSigned();
+        int64_t start = in.readSigned();
+        int64_t length = in.readSigned();
+        pinchGraph.addThread(name, start, length);
+    }
+    
+    // Remake each block by pinching its first segment to each of the others,
+    // in the right relative orientation.
+    uint64_t blockCount = in.readNumber();
+    for(uint64_t i = 0; i < blockCount; i++) {
+        int64_t length = in.readNumber();
+        uint64_t degree = in.readNumber();
+        
+        int64_t firstThread = 0;
+        int64_t firstStart = 0;
+        bool firstOrientation = true;
+        for(uint64_t j = 0; j < degree; j++) {
+            int64_t thread = in.readSigned();
+            int64_t start = in.readSigned();
+            bool orientation = in.readNumber();
+            if(!pinchGraph.hasThread(thread)) {
+                throw std::runtime_error("Checkpoint block refers to a missing thread");
+            }
+            
+            if(j == 0) {
+                firstThread = thread;
+                firstStart = start;
+                firstOrientation = orientation;
+            } else {
+                pinchGraph.pinch(firstThread, thread, firstStart, start, length, firstOrientation == orientation);
+            }
+        }
+    }
+    
+    // Load the sequences
+    uint64_t sequenceCount = in.readNumber();
+    for(uint64_t i = 0; i < sequenceCount; i++) {
+        int64_t name = in.readSigned();
+        threadSequences.add(name, in.readString());
+    }
+    
+    // Load the embedded graphs
+    uint64_t graphCount = in.readNumber();
+    for(uint64_t i = 0; i < graphCount; i++) {
+        graphs.emplace_back(new EmbeddedGraph(in, pinchGraph));
+    }
+}
+
+}
@@ -0,0 +1,153 @@
+#ifndef COREGRAPH_CHECKPOINT_HPP
+#define COREGRAPH_CHECKPOINT_HPP
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/io/gzip_stream.h>
+#include <google/protobuf/io/coded_stream.h>
+
+#include "pinchGraph.hpp"
+#include "sequenceStore.hpp"
+
+namespace coregraph {
+
+class EmbeddedGraph;
+
+/**
+ * How far a merge had gotten when a checkpoint was written. Each phase
+ * includes all the ones before it.
+ */
+enum CheckpointPhase {
+    // Nothing is done
+    CHECKPOINT_NONE = 0,
+    // Both graphs are embedded in the pinch graph
+    CHECKPOINT_EMBEDDED = 1,
+    // The graphs are pinched together on their shared paths
+    CHECKPOINT_PATHS = 2,
+    // The graphs are pinched together on their shared kmers
+    CHECKPOINT_KMERS = 3
+};
+
+/**
+ * Writes the pieces of a checkpoint to a file, as gzipped varints and
+ * length-prefixed strings.
+ */
+class CheckpointWriter {
+public:
+    /**
+     * Start writing to the given file. Throws std::runtime_error if it can't
+     * be opened.
+     */
+    CheckpointWriter(const std::string& filename);
+    
+    /**
+     * Finish writing, if close() wasn't called.
+     */
+    ~CheckpointWriter();
+    
+    /**
+     * Write an unsigned number.
+     */
+    void writeNumber(uint64_t number);
+    
+    /**
+     * Write a signed number, zig-zag encoded so small negative numbers are
+     * small too.
+     */
+    void writeSigned(int64_t number);
+    
+    /**
+     * Write a string.
+     */
+    void writeString(const std::string& string);
+    
+    /**
+     * Flush everything out to the file. Throws std::runtime_error if anything
+     * went wrong.
+     */
+    void close();
+
+protected:
+    std::ofstream file;
+    std::unique_ptr<::google::protobuf::io::OstreamOutputStream> rawOut;
+    std::unique_ptr<::google::protobuf::io::GzipOutputStream> gzipOut;
+    std::unique_ptr<::google::protobuf::io::CodedOutputStream> codedOut;
+};
+
+/**
+ * Reads back the pieces of a checkpoint written by a CheckpointWriter. Every
+ * read throws std::runtime_error if the file is truncated or corrupt.
+ */
+class CheckpointReader {
+public:
+    /**
+     * Start reading from the given file. Throws std::runtime_error if it can't
+     * be opened.
+     */
+    CheckpointReader(const std::string& filename);
+    
+    ~CheckpointReader();
+    
+    /**
+     * Read an unsigned number.
+     */
+    uint64_t readNumber();
+    
+    /**
+     * Read a zig-zag encoded signed number.
+     */
+    int64_t readSigned();
+    
+    /**
+     * Read a string.
+     */
+    std::string readString();
+
+protected:
+    /**
+     * Start a new CodedInputStream, so we never hit protobuf's limit on how
+     * much one can read.
+     */
+    void renewCodedIn();
+    
+    std::ifstream file;
+    std::unique_ptr<::google::protobuf::io::IstreamInputStream> rawIn;
+    std::unique_ptr<::google::protobuf::io::GzipInputStream> gzipIn;
+    std::unique_ptr<::google::protobuf::io::CodedInputStream> codedIn;
+    
+    // How many numbers have been read from the current CodedInputStream
+    size_t readsSinceRenew = 0;
+};
+
+/**
+ * Save the state of a merge to the given file: how far it got, whether the
+ * graphs were pinched on their shared paths (they aren't when merging only on
+ * kmers, even past CHECKPOINT_PATHS), the next thread name to hand out, the
+ * threads and blocks of the pinch graph, the thread sequences, and each
+ * embedded graph's embedding and paths. The file is written under a temporary
+ * name and moved into place, so an interrupted write never clobbers the last
+ * good checkpoint.
+ */
+void saveCheckpoint(const std::string& filename, CheckpointPhase phase, bool pathsPinched, int64_t nextId,
+    PinchGraph& pinchGraph, const SequenceStore& threadSequences,
+    const std::vector<EmbeddedGraph*>& graphs);
+
+/**
+ * Load the state of a merge saved by saveCheckpoint(). Remakes the same threads
+ * pinched into the same blocks in the given empty pinch graph, and fills in
+ * the phase, whether paths were pinched, the next thread name, the thread
+ * sequences, and the embedded graphs. The embedded graphs have no source graph
+ * attached, but still know their paths.
+ */
+void loadCheckpoint(const std::string& filename, PinchGraph& pinchGraph, CheckpointPhase& phase,
+    bool& pathsPinched, int64_t& nextId, SequenceStore& threadSequences,
+    std::vector<std::unique_ptr<EmbeddedGraph>>& graphs);
+
+}
+
+#endif
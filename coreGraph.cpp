@@ -0,0 +1,687 @@
+#include "coreGraph.hpp"
+
+#include <algorithm>
+#include <queue>
+#include <stdexcept>
+#include <set>
+#include <tuple>
+
+#include <omp.h>
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/io/gzip_stream.h>
+#include <google/protobuf/io/coded_stream.h>
+
+namespace coregraph {
+
+// How many nodes, edges, and path mappings to hand to xg in each chunk
+static const size_t XG_CHUNK_ELEMENTS = 100000;
+
+std::string getBlockSequence(const FlatPinchGraph& graph, size_t segment,
+    SequenceStore& threadSequences) {
+    
+    // See if the segment is in a block
+    size_t block = graph.segmentBlocks[segment];
+    
+    // We need the sequence
+    std::string sequence;
+    
+    if(block != FlatPinchGraph::NO_BLOCK) {
+        // Get the sequence by scanning through the block for the first sequence
+        // that isn't all Ns, if any.
+        for(size_t i = graph.blockSegments[block]; i < graph.blockSegments[block + 1]; i++) {
+            size_t sequenceSegment = graph.blockMembers[i];
+            int64_t thread = graph.getSegmentName(sequenceSegment);
+            if(!threadSequences.has(thread)) {
+                // This segment is part of a staple. Pass it up
+                continue;
+            }
+            
+            // Go get the sequence of the thread, and clip out the part relevant to this segment.
+            sequence = threadSequences.getSequence(thread, graph.segmentStarts[sequenceSegment],
+                graph.segmentLengths[sequenceSegment]);
+            
+            // If necessary, flip the segment around
+            if(graph.getOrientation(sequenceSegment)) {
+                sequence = vg::reverse_complement(sequence);
+            }
+            
+            if(std::count(sequence.begin(), sequence.end(), 'N') +
+                std::count(sequence.begin(), sequence.end(), 'n') < sequence.size()) {\
+                
+                // The sequence has some non-N characters
+                // If it's not all Ns, break
+                break;
+            }
+            
+            // Otherwise try the next segment
+        }
+    } else {
+        // Just pull the sequence from the lone segment
+        sequence = threadSequences.getSequence(graph.getSegmentName(segment), graph.segmentStarts[segment],
+            graph.segmentLengths[segment]);
+        
+        // It doesn't need to flip, since it can't be backwards in a block
+    }
+    
+    return sequence;
+}
+
+std::vector<size_t> topologicalOrder(size_t nodeCount, const std::vector<std::tuple<size_t, bool, size_t, bool>>& edges) {
+    
+    // Read each edge in the direction it goes when its from node is read
+    // forward, or backward if it leaves its from node's start, and lay out
+    // the successors in one flat array with an offset for each node.
+    std::vector<size_t> successorStart(nodeCount + 1, 0);
+    std::vector<size_t> inDegree(nodeCount, 0);
+    for(auto& edge : edges) {
+        size_t from = std::get<0>(edge);
+        size_t to = std::get<2>(edge);
+        if(from == to) {
+            // Self loops don't constrain the order
+            continue;
+        }
+        if(std::get<1>(edge)) {
+            std::swap(from, to);
+        }
+        successorStart[from + 1]++;
+        inDegree[to]++;
+    }
+    for(size_t i = 0; i < nodeCount; i++) {
+        successorStart[i + 1] += successorStart[i];
+    }
+    std::vector<size_t> successors(successorStart.back());
+    std::vector<size_t> successorsFilled(successorStart.begin(), successorStart.end() - 1);
+    for(auto& edge : edges) {
+        size_t from = std::get<0>(edge);
+        size_t to = std::get<2>(edge);
+        if(from == to) {
+            continue;
+        }
+        if(std::get<1>(edge)) {
+            std::swap(from, to);
+        }
+        successors[successorsFilled[from]++] = to;
+    }
+    
+    // Kahn's algorithm, always taking the lowest-numbered ready node so the
+    // order is deterministic and stays close to the input order.
+    std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> ready;
+    for(size_t i = 0; i < nodeCount; i++) {
+        if(inDegree[i] == 0) {
+            ready.push(i);
+        }
+    }
+    
+    std::vector<bool> placed(nodeCount, false);
+    std::vector<size_t> order;
+    order.reserve(nodeCount);
+    
+    // Where to look for a node to break a cycle with
+    size_t nextSeed = 0;
+    
+    while(order.size() < nodeCount) {
+        if(ready.empty()) {
+            // Only cycles are left. Break one at the lowest-numbered node left.
+            while(placed[nextSeed]) {
+                nextSeed++;
+            }
+            ready.push(nextSeed);
+        }
+        
+        size_t node = ready.top();
+        ready.pop();
+        if(placed[node]) {
+            // We already took this one to break a cycle
+            continue;
+        }
+        placed[node] = true;
+        order.push_back(node);
+        
+        for(size_t i = successorStart[node]; i < successorStart[node + 1]; i++) {
+            size_t next = successors[i];
+            if(!placed[next] && inDegree[next] > 0 && --inDegree[next] == 0) {
+                ready.push(next);
+            }
+        }
+    }
+    
+    return order;
+}
+
+/**
+ * The core graph for one connected component of a flattened pinch graph. Node
+ * IDs in it start at 1, and are shifted to their place in the whole graph when
+ * they are sent out.
+ */
+struct CoreComponent {
+    // The numbers of the threads in the component, in name order
+    std::vector<size_t> threads;
+    
+    // The first local ID of each leader's node, and how many pieces (and thus
+    // IDs) it is chopped into.
+    std::vector<int64_t> firstId;
+    std::vector<int64_t> pieceCount;
+    
+    // How many IDs the component needs in all
+    int64_t idCount = 0;
+    
+    // What to add to local IDs to get IDs in the whole graph
+    int64_t idBase = 0;
+    
+    // The nodes and edges, with local IDs, waiting to be sent out. Edges are
+    // kept as plain (from, from_start, to, to_end) tuples, and only made into
+    // a protobuf Edge, reused for each, as they are sent.
+    std::vector<std::pair<int64_t, std::string>> nodes;
+    std::vector<std::tuple<int64_t, bool, int64_t, bool>> edges;
+    
+    // If building failed, why. We can't throw out of an OpenMP loop.
+    std::string error;
+};
+
+/**
+ * Work out and make the nodes and edges for one component of the core graph,
+ * numbering and chopping them according to the given options. Fills in the
+ * number of each of the component's leader segments in leaderIndex.
+ */
+void buildCoreComponent(CoreComponent& component, const FlatPinchGraph& graph, std::vector<size_t>& leaderIndex,
+    SequenceStore& threadSequences, const CoreGraphOptions& options) {
+    
+    // Number the leader segments in the order we find them. The segments in
+    // the component are only ever looked at by this component's build, so
+    // their leaderIndex entries are ours to fill in.
+    std::vector<size_t> leaders;
+    for(auto thread : component.threads) {
+        for(size_t segment = graph.threadSegments[thread]; segment < graph.threadSegments[thread + 1]; segment++) {
+            // For every segment, we need to make a VG node for it or its block
+            // (if it has one).
+            
+#ifdef debug
+            std::cerr << "Found segment " << segment << std::endl;
+#endif
+            
+            // Get the leader segment: first in the block, or this segment if no block
+            size_t leader = graph.getLeader(segment);
+            
+            if(leaderIndex[leader] != FlatPinchGraph::NO_BLOCK) {
+                // A node is already coming for this block.
+                continue;
+            }
+            
+            leaderIndex[leader] = leaders.size();
+            leaders.push_back(leader);
+        }
+    }
+    
+    // Each edge is seen from both of its ends, and from every segment in the
+    // blocks it connects, so we only keep the ones we haven't seen, by their
+    // canonical from, from_start, to, to_end tuples. Edges are between leader
+    // numbers until we know the node IDs.
+    std::set<std::tuple<size_t, bool, size_t, bool>> edgesSeen;
+    std::vector<std::tuple<size_t, bool, size_t, bool>> edges;
+    auto addEdge = [&](size_t from, bool fromStart, size_t to, bool toEnd) {
+        auto forward = std::make_tuple(from, fromStart, to, toEnd);
+        auto reverse = std::make_tuple(to, !toEnd, from, !fromStart);
+        if(edgesSeen.insert(std::min(forward, reverse)).second) {
+            edges.push_back(forward);
+        }
+    };
+    
+    // Now go through the segments again and wire them up. Each segment is
+    // wired to the one 3' of it, which covers its 5' side as well.
+    for(auto thread : component.threads) {
+        for(size_t segment = graph.threadSegments[thread]; segment + 1 < graph.threadSegments[thread + 1]; segment++) {
+            size_t nextSegment = segment + 1;
+            
+            // Get the node numbers and orientations
+            auto node = leaderIndex[graph.getLeader(segment)];
+            auto orientation = graph.getOrientation(segment);
+            auto nextNode = leaderIndex[graph.getLeader(nextSegment)];
+            auto nextOrientation = graph.getOrientation(nextSegment);
+#ifdef debug
+            std::cerr << "Found node " << node << " in orientation " << (orientation ? "reverse" : "forward") <<
+                " followed by " << nextNode << " in orientation " << (nextOrientation ? "reverse" : "forward") << std::endl;
+#endif
+            
+            // Make an edge, if it's new
+            addEdge(node, orientation, nextNode, nextOrientation);
+        }
+    }
+    
+    // Work out what order to number the nodes in
+    std::vector<size_t> order;
+    if(options.sortIds) {
+        order = topologicalOrder(leaders.size(), edges);
+    } else {
+        order.resize(leaders.size());
+        for(size_t i = 0; i < leaders.size(); i++) {
+            order[i] = i;
+        }
+    }
+    
+    // Hand out node IDs in that order, starting at 1, leaving room for all the
+    // pieces each node is going to be chopped into.
+    component.firstId.resize(leaders.size());
+    component.pieceCount.resize(leaders.size());
+    int64_t nextNodeId = 1;
+    for(auto i : order) {
+        int64_t length = graph.segmentLengths[leaders[i]];
+        component.pieceCount[i] = options.maxNodeLength == 0 ? 1 :
+            (length + options.maxNodeLength - 1) / options.maxNodeLength;
+        component.firstId[i] = nextNodeId;
+        nextNodeId += component.pieceCount[i];
+    }
+    component.idCount = nextNodeId - 1;
+    
+    // Make the nodes, in ID order, and hook up the pieces of each.
+    component.nodes.reserve(component.idCount);
+    for(auto i : order) {
+        std::string sequence = getBlockSequence(graph, leaders[i], threadSequences);
+        int64_t firstId = component.firstId[i];
+        int64_t pieceCount = component.pieceCount[i];
+        
+        for(int64_t piece = 0; piece < pieceCount; piece++) {
+            if(pieceCount == 1) {
+                component.nodes.emplace_back(firstId, std::move(sequence));
+            } else {
+                component.nodes.emplace_back(firstId + piece,
+                    sequence.substr(piece * options.maxNodeLength, options.maxNodeLength));
+            }
+            
+            if(piece > 0) {
+                // Attach it to the piece before
+                component.edges.emplace_back(firstId + piece - 1, false, firstId + piece, false);
+            }
+        }
+    }
+    
+    // Make the edges between blocks. Leaving a node from its start, or
+    // entering it at its start, happens at its first piece; otherwise it
+    // happens at its last piece.
+    for(auto& leaderEdge : edges) {
+        size_t from, to;
+        bool fromStart, toEnd;
+        std::tie(from, fromStart, to, toEnd) = leaderEdge;
+        
+        component.edges.emplace_back(
+            fromStart ? component.firstId[from] : component.firstId[from] + component.pieceCount[from] - 1, fromStart,
+            toEnd ? component.firstId[to] + component.pieceCount[to] - 1 : component.firstId[to], toEnd);
+    }
+}
+
+void forEachCoreElement(PinchGraph& pinchGraph, SequenceStore& threadSequences,
+    const std::function<void(int64_t, const std::string&)>& nodeCallback,
+    const std::function<void(const vg::Edge&)>& edgeCallback, const CoreGraphOptions& options,
+    const std::vector<EmbeddedGraph*>& pathGraphs, const std::function<void(const vg::Path&)>& pathCallback) {
+    
+    // Get everything into arrays we can walk along
+    FlatPinchGraph graph;
+    pinchGraph.flatten(graph);
+    
+    // Split the threads up into connected components, which share no blocks
+    // or edges, so each can be made into graph on its own. Threads are only
+    // connected through blocks, so union each block's threads together.
+    std::vector<size_t> threadParent(graph.threadCount());
+    for(size_t i = 0; i < threadParent.size(); i++) {
+        threadParent[i] = i;
+    }
+    auto findRoot = [&](size_t thread) {
+        while(threadParent[thread] != thread) {
+            // Halve the path as we go
+            threadParent[thread] = threadParent[threadParent[thread]];
+            thread = threadParent[thread];
+        }
+        return thread;
+    };
+    for(size_t block = 0; block < graph.blockCount(); block++) {
+        size_t firstRoot = findRoot(graph.segmentThreads[graph.blockMembers[graph.blockSegments[block]]]);
+        for(size_t i = graph.blockSegments[block] + 1; i < graph.blockSegments[block + 1]; i++) {
+            size_t root = findRoot(graph.segmentThreads[graph.blockMembers[i]]);
+            // Always keep the lower thread as the root
+            threadParent[std::max(root, firstRoot)] = std::min(root, firstRoot);
+            firstRoot = std::min(root, firstRoot);
+        }
+    }
+    
+    // Threads are in name order, so going through them in order puts the
+    // components in order of their first threads, and the threads of each
+    // component in name order. That way the IDs don't depend on anything but
+    // the input. We also need to know where each thread's component is, to
+    // find path segments.
+    std::vector<CoreComponent> components;
+    std::vector<size_t> componentOfThread(graph.threadCount());
+    for(size_t thread = 0; thread < graph.threadCount(); thread++) {
+        size_t root = findRoot(thread);
+        if(root == thread) {
+            // This thread starts a new component
+            componentOfThread[thread] = components.size();
+            components.emplace_back();
+        } else {
+            // The root comes before us, so its component is already made
+            componentOfThread[thread] = componentOfThread[root];
+        }
+        components[componentOfThread[thread]].threads.push_back(thread);
+    }
+    
+    // The node number of each leader segment within its component. Leaders
+    // without numbers yet are marked with NO_BLOCK.
+    std::vector<size_t> leaderIndex(graph.segmentThreads.size(), FlatPinchGraph::NO_BLOCK);
+    
+    // Build components in parallel, a batch at a time, so we never hold the
+    // sequences for more than one batch. Then send each batch out in order.
+    size_t batchSize = 4 * omp_get_max_threads();
+    int64_t nextIdBase = 0;
+    // We fill in this one Edge for every edge we send out
+    vg::Edge edge;
+    for(size_t batchStart = 0; batchStart < components.size(); batchStart += batchSize) {
+        size_t batchEnd = std::min(batchStart + batchSize, components.size());
+        
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(size_t i = batchStart; i < batchEnd; i++) {
+            try {
+                buildCoreComponent(components[i], graph, leaderIndex, threadSequences, options);
+            } catch(std::exception& e) {
+                components[i].error = e.what();
+            }
+        }
+        
+        for(size_t i = batchStart; i < batchEnd; i++) {
+            CoreComponent& component = components[i];
+            if(!component.error.empty()) {
+                throw std::runtime_error("Could not make core graph: " + component.error);
+            }
+            
+            // Give the component the next range of IDs
+            component.idBase = nextIdBase;
+            nextIdBase += component.idCount;
+            
+            for(auto& node : component.nodes) {
+                nodeCallback(node.first + component.idBase, node.second);
+            }
+            for(auto& localEdge : component.edges) {
+                edge.set_from(std::get<0>(localEdge) + component.idBase);
+                edge.set_from_start(std::get<1>(localEdge));
+                edge.set_to(std::get<2>(localEdge) + component.idBase);
+                edge.set_to_end(std::get<3>(localEdge));
+#ifdef debug
+                std::cerr << "Made edge: " << pb2json(edge) << std::endl;
+#endif
+                edgeCallback(edge);
+            }
+            
+            // Free the sequences, but keep the numbering for the paths
+            component.nodes.clear();
+            component.nodes.shrink_to_fit();
+            component.edges.clear();
+            component.edges.shrink_to_fit();
+        }
+    }
+    
+    if(!pathCallback) {
+        // Nobody wants the paths
+        return;
+    }
+    
+    // Now project the paths. We keep just one path in memory at a time.
+    vg::Path path;
+    
+    // Add a visit to a piece of a node, given the visited part of the piece in
+    // forward coordinates.
+    auto addMapping = [&](int64_t nodeId, int64_t start, int64_t length, bool isReverse) {
+        vg::Mapping* mapping = path.add_mapping();
+        mapping->mutable_position()->set_node_id(nodeId);
+        // Reverse mappings start at the last base of the part they visit.
+        mapping->mutable_position()->set_offset(isReverse ? start + length - 1 : start);
+        mapping->set_is_reverse(isReverse);
+        vg::Edit* edit = mapping->add_edit();
+        edit->set_from_length(length);
+        edit->set_to_length(length);
+        mapping->set_rank(path.mapping_size());
+    };
+    
+    // Don't send the same path twice, if it was in more than one graph and
+    // the copies were zipped together. Remember whether the copy we sent for
+    // each name was.
+    std::map<std::string, bool> pathsDone;
+    
+    for(auto pathGraph : pathGraphs) {
+        pathGraph->forEachThreadPath([&](const std::string& pathName, ThreadCursor cursor) {
+            bool pinched = pathGraph->isPathPinched(pathName);
+            auto found = pathsDone.find(pathName);
+            
+            path.Clear();
+            if(found == pathsDone.end()) {
+                // This is the first copy
+                pathsDone[pathName] = pinched;
+                path.set_name(pathName);
+            } else if(found->second && pinched) {
+                // Both copies run through the same blocks, so we already did
+                // this one.
+                return;
+            } else {
+                // This copy may go somewhere else, so send it too, under a
+                // name of its own.
+                std::cerr << "WARNING: Path " << pathName << " in " << pathGraph->getName() <<
+                    " was not merged with another graph's; writing it as " << pathName << "@" <<
+                    pathGraph->getName() << std::endl;
+                path.set_name(pathName + "@" + pathGraph->getName());
+            }
+            
+            ThreadStep step;
+            while(cursor(step)) {
+                // Walk the segments the run of thread bases covers, in the
+                // order the path reads them.
+                int64_t stepEnd = step.start + step.length;
+                size_t thread = graph.findThread(step.thread);
+                size_t firstSegment = graph.threadSegments[thread];
+                size_t endSegment = graph.threadSegments[thread + 1];
+                size_t segment = graph.findSegment(thread, step.isReverse ? stepEnd - 1 : step.start);
+                
+                // Stepping back off the start of the thread wraps segment
+                // around, so it fails this check too.
+                while(segment >= firstSegment && segment < endSegment) {
+                    int64_t segmentStart = graph.segmentStarts[segment];
+                    int64_t segmentEnd = segmentStart + graph.segmentLengths[segment];
+                    
+                    // What part of the segment do we visit?
+                    int64_t overlapStart = std::max(step.start, segmentStart);
+                    int64_t overlapEnd = std::min(stepEnd, segmentEnd);
+                    if(overlapStart >= overlapEnd) {
+                        // We're past the end of the run
+                        break;
+                    }
+                    
+                    // Find that part along the block's node, which may run
+                    // against the segment.
+                    CoreComponent& component = components[componentOfThread[thread]];
+                    size_t leader = leaderIndex[graph.getLeader(segment)];
+                    int64_t firstId = component.firstId[leader] + component.idBase;
+                    bool orientation = graph.getOrientation(segment);
+                    int64_t nodeStart = orientation ? segmentEnd - overlapEnd : overlapStart - segmentStart;
+                    int64_t nodeEnd = nodeStart + (overlapEnd - overlapStart);
+                    bool isReverse = (orientation != step.isReverse);
+                    
+                    if(component.pieceCount[leader] == 1) {
+                        addMapping(firstId, nodeStart, nodeEnd - nodeStart, isReverse);
+                    } else {
+                        // Visit each piece of the node in turn, in the
+                        // direction we are reading the node.
+                        int64_t firstPiece = nodeStart / options.maxNodeLength;
+                        int64_t lastPiece = (nodeEnd - 1) / options.maxNodeLength;
+                        for(int64_t i = 0; i <= lastPiece - firstPiece; i++) {
+                            int64_t piece = isReverse ? lastPiece - i : firstPiece + i;
+                            int64_t pieceStart = piece * options.maxNodeLength;
+                            int64_t visitStart = std::max(nodeStart, pieceStart);
+                            int64_t visitEnd = std::min(nodeEnd, pieceStart + (int64_t) options.maxNodeLength);
+                            addMapping(firstId + piece, visitStart - pieceStart, visitEnd - visitStart, isReverse);
+                        }
+                    }
+                    
+                    if(step.isReverse) {
+                        segment--;
+                    } else {
+                        segment++;
+                    }
+                }
+            }
+            
+            pathCallback(path);
+        });
+    }
+
+}
+
+vg::VG pinchToVG(PinchGraph& pinchGraph, SequenceStore& threadSequences,
+    const CoreGraphOptions& options, const std::vector<EmbeddedGraph*>& pathGraphs) {
+    // Make an empty graph
+    vg::VG graph;
+    
+    std::cerr << "Making pinch graph into vg graph with " << threadSequences.size() << " relevant threads" << std::endl;
+    
+    forEachCoreElement(pinchGraph, threadSequences, [&](int64_t nodeId, const std::string& sequence) {
+        // Make a node in the graph to represent the block
+        graph.create_node(sequence, nodeId);
+#ifdef debug
+        std::cerr << "Made node: " << nodeId << ": " << sequence << std::endl;
+#endif
+    }, [&](const vg::Edge& edge) {
+        // Add it in
+        graph.add_edge(edge);
+    }, options, pathGraphs, [&](const vg::Path& path) {
+        // Keep the path
+        for(auto& mapping : path.mapping()) {
+            graph.paths.append_mapping(path.name(), mapping);
+        }
+    });
+    
+    // Spit out the graph.
+    return graph;
+
+}
+
+void writeVGParallel(vg::VG& graph, std::ostream& out) {
+    
+    // Collect this many chunks at a time before encoding them all together
+    size_t batchSize = 4 * omp_get_max_threads();
+    
+    std::vector<vg::Graph> chunks(batchSize);
+    std::vector<std::string> encoded(batchSize);
+    size_t chunkCount = 0;
+    
+    // Encode and compress all the chunks we have, and write them out in order
+    auto writeBatch = [&]() {
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(size_t i = 0; i < chunkCount; i++) {
+            // Each chunk is a group of one message, in its own gzip member,
+            // just as vg writes it.
+            std::string message;
+            chunks[i].SerializeToString(&message);
+            chunks[i].Clear();
+            
+            encoded[i].clear();
+            ::google::protobuf::io::StringOutputStream stringOut(&encoded[i]);
+            ::google::protobuf::io::GzipOutputStream gzipOut(&stringOut);
+            {
+                ::google::protobuf::io::CodedOutputStream codedOut(&gzipOut);
+                codedOut.WriteVarint64(1);
+                codedOut.WriteVarint32(message.size());
+                codedOut.WriteString(message);
+            }
+            gzipOut.Close();
+        }
+        
+        for(size_t i = 0; i < chunkCount; i++) {
+            out.write(encoded[i].data(), encoded[i].size());
+        }
+        chunkCount = 0;
+    };
+    
+    graph.serialize_to_function([&](vg::Graph& chunk) {
+        chunks[chunkCount++].Swap(&chunk);
+        if(chunkCount == batchSize) {
+            writeBatch();
+        }
+    });
+    writeBatch();
+    
+    out.flush();
+    if(!out.good()) {
+        throw std::runtime_error("Could not write vg graph");
+    }
+}
+
+void pinchToGFA(PinchGraph& pinchGraph, SequenceStore& threadSequences, std::ostream& out,
+    const CoreGraphOptions& options, const std::vector<EmbeddedGraph*>& pathGraphs) {
+    
+    std::cerr << "Making pinch graph into GFA with " << threadSequences.size() << " relevant threads" << std::endl;
+    
+    out << "H\tVN:Z:1.0\n";
+    
+    // Stream out each segment and link as it is made. Leaving a node from its
+    // start, or entering it at its end, means visiting it in reverse.
+    forEachCoreElement(pinchGraph, threadSequences, [&](int64_t nodeId, const std::string& sequence) {
+        out << "S\t" << nodeId << "\t" << sequence << "\n";
+    }, [&](const vg::Edge& edge) {
+        out << "L\t" << edge.from() << "\t" << (edge.from_start() ? '-' : '+') << "\t"
+            << edge.to() << "\t" << (edge.to_end() ? '-' : '+') << "\t0M\n";
+    }, options, pathGraphs, [&](const vg::Path& path) {
+        // GFA paths can only visit whole segments, so any partial visits at
+        // the ends of the path get rounded out to whole segments.
+        out << "P\t" << path.name() << "\t";
+        for(size_t i = 0; i < path.mapping_size(); i++) {
+            auto& mapping = path.mapping(i);
+            out << (i == 0 ? "" : ",") << mapping.position().node_id() << (mapping.is_reverse() ? '-' : '+');
+        }
+        out << "\t*\n";
+    });
+    
+    out.flush();
+}
+
+void pinchToXG(PinchGraph& pinchGraph, SequenceStore& threadSequences, std::ostream& out,
+    const CoreGraphOptions& options, const std::vector<EmbeddedGraph*>& pathGraphs) {
+    
+    std::cerr << "Making pinch graph into xg index with " << threadSequences.size() << " relevant threads" << std::endl;
+    
+    // xg pulls its graph in as a series of Graph chunks, so we make the core
+    // graph inside its callback and hand it over a chunk at a time.
+    xg::XG index([&](std::function<void(vg::Graph&)> takeChunk) {
+        vg::Graph chunk;
+        
+        // How many nodes, edges, and mappings are in the chunk so far
+        size_t chunkElements = 0;
+        
+        // Send the chunk off if it is big enough, or if we are done
+        auto sendChunk = [&](bool force) {
+            if(chunkElements > 0 && (force || chunkElements >= XG_CHUNK_ELEMENTS)) {
+                takeChunk(chunk);
+                chunk.Clear();
+                chunkElements = 0;
+            }
+        };
+        
+        forEachCoreElement(pinchGraph, threadSequences, [&](int64_t nodeId, const std::string& sequence) {
+            vg::Node* node = chunk.add_node();
+            node->set_id(nodeId);
+            node->set_sequence(sequence);
+            chunkElements++;
+            sendChunk(false);
+        }, [&](const vg::Edge& edge) {
+            *chunk.add_edge() = edge;
+            chunkElements++;
+            sendChunk(false);
+        }, options, pathGraphs, [&](const vg::Path& path) {
+            // Each path goes in whole, in one chunk
+            *chunk.add_path() = path;
+            chunkElements += path.mapping_size();
+            sendChunk(false);
+        });
+        
+        sendChunk(true);
+    });
+    
+    index.serialize(out);
+    out.flush();
+}
+
+}
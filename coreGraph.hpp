@@ -0,0 +1,114 @@
+#ifndef COREGRAPH_COREGRAPH_HPP
+#define COREGRAPH_COREGRAPH_HPP
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "ekg/vg/vg.hpp"
+#include "ekg/vg/xg/xg.hpp"
+
+#include "embeddedGraph.hpp"
+#include "pinchGraph.hpp"
+#include "sequenceStore.hpp"
+
+namespace coregraph {
+
+/**
+ * Options for how the core graph's nodes are laid out as they are made.
+ */
+struct CoreGraphOptions {
+    // Chop nodes into pieces no longer than this. 0 means don't chop.
+    size_t maxNodeLength = 0;
+    // Number nodes 1, 2, 3... in topologically sorted order, instead of in the
+    // order their blocks are found in.
+    bool sortIds = false;
+};
+
+/**
+ * Get the sequence for the node made for a segment's block, or for the segment
+ * itself if it has no block, in the orientation of the block. Takes it from
+ * the first segment in the block that isn't a staple and isn't all Ns, if any.
+ */
+std::string getBlockSequence(const FlatPinchGraph& graph, size_t segment,
+    SequenceStore& threadSequences);
+
+/**
+ * Put the nodes of a bidirected graph, numbered from 0, into an order where
+ * edges mostly go forward. Edges are (from, from_start, to, to_end) tuples.
+ * Uses Kahn's algorithm, reading each edge forward from its from node unless
+ * it leaves its from node's start. When only cycles are left, the
+ * lowest-numbered remaining node is taken to break them, and ties are always
+ * broken by number, so the order is deterministic.
+ */
+std::vector<size_t> topologicalOrder(size_t nodeCount, const std::vector<std::tuple<size_t, bool, size_t, bool>>& edges);
+
+/**
+ * Walk the core graph for a pinch graph, calling nodeCallback with the ID
+ * and sequence of each node, in ID order, and then edgeCallback with each
+ * distinct edge. Nodes are chopped and numbered according to the given
+ * options as they are made, so the result needs no further processing.
+ *
+ * The pinch graph is flattened into arrays first, and everything after that
+ * works from the arrays. Each connected component is built on its own, in
+ * parallel, and gets its own range of IDs. Components are numbered in the
+ * order of their first threads, so IDs don't depend on the number of threads.
+ * Elements are sent to the callbacks from one thread at a time, a component at
+ * a time.
+ *
+ * After that, the paths of each of the given embedded graphs are projected
+ * onto the core graph and sent to pathCallback, one at a time. A path name
+ * found in more than one graph is only sent once, as projected from the first
+ * graph that has it, if the copies were zipped together by pinchWith(), since
+ * then they are all the same. Copies that weren't (as when merging only on
+ * kmers) are each sent, with "@" and their graph's name added to the name of
+ * all but the first.
+ */
+void forEachCoreElement(PinchGraph& pinchGraph, SequenceStore& threadSequences,
+    const std::function<void(int64_t, const std::string&)>& nodeCallback,
+    const std::function<void(const vg::Edge&)>& edgeCallback, const CoreGraphOptions& options = CoreGraphOptions(),
+    const std::vector<EmbeddedGraph*>& pathGraphs = std::vector<EmbeddedGraph*>(),
+    const std::function<void(const vg::Path&)>& pathCallback = nullptr);
+
+/**
+ * Create a VG grpah from a pinch graph, with the paths of the given
+ * embedded graphs.
+ */
+vg::VG pinchToVG(PinchGraph& pinchGraph, SequenceStore& threadSequences,
+    const CoreGraphOptions& options = CoreGraphOptions(),
+    const std::vector<EmbeddedGraph*>& pathGraphs = std::vector<EmbeddedGraph*>());
+
+/**
+ * Write a VG graph to the given stream in vg's chunked, gzipped format. The
+ * graph is cut into the same chunks vg would use, and a batch of chunks at a
+ * time is encoded and compressed in parallel, each as its own gzip member.
+ * The members are written in order, so the result reads like any other vg
+ * file.
+ */
+void writeVGParallel(vg::VG& graph, std::ostream& out);
+
+/**
+ * Stream the core graph for a pinch graph out as GFA, without building a
+ * VG graph in memory. The paths of the given embedded graphs are written as P
+ * lines.
+ */
+void pinchToGFA(PinchGraph& pinchGraph, SequenceStore& threadSequences, std::ostream& out,
+    const CoreGraphOptions& options = CoreGraphOptions(),
+    const std::vector<EmbeddedGraph*>& pathGraphs = std::vector<EmbeddedGraph*>());
+
+/**
+ * Build an xg index of the core graph for a pinch graph, with the paths of the
+ * given embedded graphs, and write it to the given stream. The core graph is
+ * fed to xg construction a chunk at a time as it is made, so no VG graph is
+ * built in memory.
+ */
+void pinchToXG(PinchGraph& pinchGraph, SequenceStore& threadSequences, std::ostream& out,
+    const CoreGraphOptions& options = CoreGraphOptions(),
+    const std::vector<EmbeddedGraph*>& pathGraphs = std::vector<EmbeddedGraph*>());
+
+}
+
+#endif
@@ -1,14 +1,23 @@
 #include "embeddedGraph.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <vector>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <omp.h>
+
+#include "externalSorter.hpp"
+#include "kmerWalker.hpp"
 
 namespace coregraph {
 
-EmbeddedGraph::EmbeddedGraph(vg::VG& graph, stPinchThreadSet* threadSet,
-    std::map<int64_t, std::string>& threadSequences,
-    std::function<int64_t(void)> getId, const std::string& name): graph(graph),
-    threadSet(threadSet), name(name) {
+EmbeddedGraph::EmbeddedGraph(vg::VG& graph, PinchGraph& pinchGraph,
+    SequenceStore& threadSequences,
+    std::function<int64_t(void)> getId, const std::string& name, const EmbeddingPlan* plan): graph(&graph),
+    pinchGraph(pinchGraph), name(name) {
     
     // We need to construct some embedding of xg nodes in a pinch graph.
 
@@ -23,69 +32,332 @@ EmbeddedGraph::EmbeddedGraph(vg::VG& graph, stPinchThreadSet* threadSet,
     // After doing that for all the nodes, turn all remaining nodes into their own threads.
     // For every edge, if it's not implicit, make an "NN" staple and attach the nodes it wants together.
     
+    EmbeddingPlan ownPlan;
+    if(plan == nullptr) {
+        planEmbedding(graph, ownPlan);
+        plan = &ownPlan;
+    }
+    applyPlan(*plan, threadSequences, getId);
+}
+
+EmbeddedGraph::EmbeddedGraph(xg::XG& index, PinchGraph& pinchGraph,
+    SequenceStore& threadSequences,
+    std::function<int64_t(void)> getId, const std::string& name, const EmbeddingPlan* plan): index(&index),
+    pinchGraph(pinchGraph), name(name) {
+    
+    // This is the same embedding as for a vg graph, but we go through the
+    // nodes by rank in the index.
+    EmbeddingPlan ownPlan;
+    if(plan == nullptr) {
+        planEmbedding(index, ownPlan);
+        plan = &ownPlan;
+    }
+    applyPlan(*plan, threadSequences, getId);
+}
+
+EmbeddedGraph::EmbeddedGraph(GFAGraph& gfa, PinchGraph& pinchGraph,
+    SequenceStore& threadSequences,
+    std::function<int64_t(void)> getId, const std::string& name, const EmbeddingPlan* plan): gfa(&gfa),
+    pinchGraph(pinchGraph), name(name) {
+    
+    // This is the same embedding as for a vg graph, but the nodes and edges
+    // come straight from the parsed GFA records.
+    EmbeddingPlan ownPlan;
+    if(plan == nullptr) {
+        planEmbedding(gfa, ownPlan);
+        plan = &ownPlan;
+    }
+    applyPlan(*plan, threadSequences, getId);
+}
+
+void EmbeddedGraph::planEmbedding(vg::VG& graph, EmbeddingPlan& plan) {
+    // The nodes keep their sequences, so we can just point at them.
     graph.for_each_node([&](vg::Node* node) {
 #ifdef debug
         std::cerr << "Node: " << node->id() << ": " << node->sequence() << std::endl;
 #endif
-        // Add a thread
-        int64_t threadName = getId();
-        stPinchThread* thread = stPinchThreadSet_addThread(threadSet, threadName, 0, node->sequence().size());
-        // Copy over its sequence
-        threadSequences[threadName] = node->sequence();
-        
-        // TODO: for now just give every node its own thread.
-        embedding[node->id()] = std::make_tuple(thread, 0, false);
-    
+        plan.nodeIds.push_back(node->id());
+        plan.nodeSequences.push_back(node->sequence().data());
+        plan.nodeLengths.push_back(node->sequence().size());
     });
     
+    std::vector<std::tuple<int64_t, bool, int64_t, bool>> edges;
     graph.for_each_edge([&](vg::Edge* edge) {
-                
-        // Attach the nodes as specified by the edges
-                
-        // Make a 2-base staple sequence
-        stPinchThread* thread = stPinchThreadSet_addThread(threadSet, getId(), 0, 2);
+        edges.emplace_back(edge->from(), edge->from_start(), edge->to(), edge->to_end());
+    });
+    
+    planStaples(edges, plan);
+}
+
+void EmbeddedGraph::planEmbedding(xg::XG& index, EmbeddingPlan& plan) {
+    size_t nodeCount = index.max_node_rank();
+    plan.nodeIds.resize(nodeCount);
+    plan.nodeLengths.resize(nodeCount);
+    
+    // The edges to embed for each node, by rank
+    std::vector<std::vector<std::tuple<int64_t, bool, int64_t, bool>>> nodeEdges(nodeCount);
+    
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for(size_t i = 0; i < nodeCount; i++) {
+        int64_t nodeId = index.rank_to_id(i + 1);
+        plan.nodeIds[i] = nodeId;
+        plan.nodeLengths[i] = index.node_length(nodeId);
         
-        // Unpack the tuples describing the embeddings, so we're holding thread,
-        // offset, is-end-of-the-node-and-not-start tuples representing the two
-        // sides to weld together.
-        stPinchThread* thread1, *thread2;
-        int64_t offset1, offset2;
-        bool isEnd1, isEnd2; // These are basically !from_start and to_end
+        // Self loops can come out more than once for their node, so we keep
+        // track of which ones we did by their from_start and to_end flags.
+        std::set<std::pair<bool, bool>> selfLoopsDone;
         
-        std::tie(thread1, offset1, isEnd1) = embedding.at(edge->from());
-        std::tie(thread2, offset2, isEnd2) = embedding.at(edge->to());
+        for(auto& edge : index.edges_of(nodeId)) {
+            if(edge.from() != nodeId) {
+                // Every edge is reported for both of its nodes, so we only
+                // embed it when looking from its from node.
+                continue;
+            }
+            
+            if(edge.to() == nodeId) {
+                auto flags = std::make_pair(edge.from_start(), edge.to_end());
+                if(selfLoopsDone.count(flags)) {
+                    continue;
+                }
+                selfLoopsDone.insert(flags);
+            }
+            
+            nodeEdges[i].emplace_back(edge.from(), edge.from_start(), edge.to(), edge.to_end());
+        }
+    }
+    
+    // The index doesn't keep the sequences as strings, so pack them all into
+    // the plan, each at a place worked out ahead of time.
+    std::vector<size_t> sequenceStarts(nodeCount + 1, 0);
+    for(size_t i = 0; i < nodeCount; i++) {
+        sequenceStarts[i + 1] = sequenceStarts[i] + plan.nodeLengths[i];
+    }
+    plan.ownedSequences.resize(sequenceStarts.back());
+    
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for(size_t i = 0; i < nodeCount; i++) {
+        std::string sequence = index.node_sequence(plan.nodeIds[i]);
+#ifdef debug
+        #pragma omp critical (cerr)
+        std::cerr << "Node: " << plan.nodeIds[i] << ": " << sequence << std::endl;
+#endif
+        std::copy(sequence.begin(), sequence.end(), plan.ownedSequences.begin() + sequenceStarts[i]);
+    }
+    
+    plan.nodeSequences.resize(nodeCount);
+    for(size_t i = 0; i < nodeCount; i++) {
+        plan.nodeSequences[i] = plan.ownedSequences.data() + sequenceStarts[i];
+    }
+    
+    // Put the edges in rank order, the order they would have been embedded in
+    std::vector<std::tuple<int64_t, bool, int64_t, bool>> edges;
+    for(auto& found : nodeEdges) {
+        edges.insert(edges.end(), found.begin(), found.end());
         
-        // Adapt these to point to the sequence ends we want to weld together.
-        // They start out pointing to the low ends, which are the starts if the
-        // nodes are not embedded in reverse, and the ends otherwise.
+        // Free as we go
+        found.clear();
+        found.shrink_to_fit();
+    }
+    
+    planStaples(edges, plan);
+}
+
+void EmbeddedGraph::planEmbedding(GFAGraph& gfa, EmbeddingPlan& plan) {
+    gfa.forEachNodeData([&](int64_t nodeId, const char* sequence, size_t length) {
+#ifdef debug
+        std::cerr << "Node: " << nodeId << ": " << std::string(sequence, length) << std::endl;
+#endif
+        plan.nodeIds.push_back(nodeId);
+        plan.nodeSequences.push_back(sequence);
+        plan.nodeLengths.push_back(length);
+    });
+    
+    std::vector<std::tuple<int64_t, bool, int64_t, bool>> edges;
+    gfa.forEachEdge([&](const vg::Edge& edge) {
+        edges.emplace_back(edge.from(), edge.from_start(), edge.to(), edge.to_end());
+    });
+    
+    planStaples(edges, plan);
+}
+
+void EmbeddedGraph::planStaples(const std::vector<std::tuple<int64_t, bool, int64_t, bool>>& edges,
+    EmbeddingPlan& plan) {
+    
+    // Find nodes by ID. If a node comes up twice, the last one wins, as it
+    // would for the embedding.
+    std::unordered_map<int64_t, size_t> nodeIndex;
+    nodeIndex.reserve(plan.nodeIds.size());
+    for(size_t i = 0; i < plan.nodeIds.size(); i++) {
+        nodeIndex[plan.nodeIds[i]] = i;
+    }
+    
+    plan.staples.resize(edges.size());
+    std::vector<std::string> errors(omp_get_max_threads());
+    
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for(size_t i = 0; i < edges.size(); i++) {
+        int64_t from;
+        bool fromStart;
+        int64_t to;
+        bool toEnd;
+        std::tie(from, fromStart, to, toEnd) = edges[i];
         
-        if(!edge->from_start()) {
-            // Move the thread1 set to the end
-            offset1 += (stPinchThread_getLength(thread1) - 1) * (isEnd1 ? -1 : 1);
-            isEnd1 = !isEnd1;
+        auto found1 = nodeIndex.find(from);
+        auto found2 = nodeIndex.find(to);
+        if(found1 == nodeIndex.end() || found2 == nodeIndex.end()) {
+            errors[omp_get_thread_num()] = "Edge from " + std::to_string(from) + " to " + std::to_string(to) +
+                " touches a node that isn't in the graph";
+            continue;
         }
         
-        if(edge->to_end()) {
-            // Move the thread2 set to the end
-            offset2 += (stPinchThread_getLength(thread2) - 1) * (isEnd2 ? -1 : 1);
-            isEnd2 = !isEnd2;
+        // Every node is forward at the start of its own thread, so welding to
+        // the end of a node means welding to the last base of its thread.
+        // Pinch graphs use 0 for the relatively backward orientation, and
+        // we're holding the ends looking outwards from the join, so the weld
+        // to the to node is flipped.
+        EmbeddingPlan::Staple& staple = plan.staples[i];
+        staple.node1 = found1->second;
+        staple.offset1 = fromStart ? 0 : (int64_t) plan.nodeLengths[staple.node1] - 1;
+        staple.strand1 = !fromStart;
+        staple.node2 = found2->second;
+        staple.offset2 = toEnd ? (int64_t) plan.nodeLengths[staple.node2] - 1 : 0;
+        staple.strand2 = !toEnd;
+    }
+    
+    for(auto& error : errors) {
+        if(!error.empty()) {
+            throw std::runtime_error(error);
         }
-        
-        // Do the welding. We're holding the ends looking outwards from the
-        // join, so we need to flip the orientation of one of them. Also, pinch
-        // graphs use 0 for the relatively backward orientation, so we invert
-        // here. We still report the orientations the VG way.
-#ifdef debug
-        std::cerr << "Welding 0 on staple to " << offset1 << " on " << stPinchThread_getName(thread1) <<
-            " in orientation " << (isEnd1 ? "forward" : "reverse") << std::endl;
-#endif
-        stPinchThread_pinch(thread, thread1, 0, offset1, 1, isEnd1);
+    }
+}
+
+void EmbeddedGraph::applyPlan(const EmbeddingPlan& plan, SequenceStore& threadSequences,
+    std::function<int64_t(void)>& getId) {
+    
+    // TODO: for now just give every node its own thread.
+    std::vector<int64_t> nodeThreads(plan.nodeIds.size());
+    for(size_t i = 0; i < plan.nodeIds.size(); i++) {
+        nodeThreads[i] = getId();
+        pinchGraph.addThread(nodeThreads[i], 0, plan.nodeLengths[i]);
+        // Copy over its sequence
+        threadSequences.add(nodeThreads[i], plan.nodeSequences[i], plan.nodeLengths[i]);
+        embedding[plan.nodeIds[i]] = std::make_tuple(nodeThreads[i], 0, false);
+    }
+    
+    for(auto& staple : plan.staples) {
+        // Make a 2-base staple sequence, and weld one base to each node
+        int64_t thread = getId();
+        pinchGraph.addThread(thread, 0, 2);
 #ifdef debug
-        std::cerr << "Welding 1 on staple to " << offset2 << " on " << stPinchThread_getName(thread2) <<
-            " in orientation " << (isEnd2 ? "reverse" : "forward") << std::endl;
+        std::cerr << "Welding 0 on staple to " << staple.offset1 << " on " << nodeThreads[staple.node1] <<
+            " in orientation " << (staple.strand1 ? "forward" : "reverse") << std::endl;
+        std::cerr << "Welding 1 on staple to " << staple.offset2 << " on " << nodeThreads[staple.node2] <<
+            " in orientation " << (staple.strand2 ? "forward" : "reverse") << std::endl;
 #endif
-        stPinchThread_pinch(thread, thread2, 1, offset2, 1, !isEnd2);
-    });
+        pinchGraph.pinch(thread, nodeThreads[staple.node1], 0, staple.offset1, 1, staple.strand1);
+        pinchGraph.pinch(thread, nodeThreads[staple.node2], 1, staple.offset2, 1, staple.strand2);
+    }
+}
+
+EmbeddedGraph::EmbeddedGraph(const EmbeddedGraph& other, PinchGraph& pinchGraph): graph(other.graph),
+    index(other.index), gfa(other.gfa), savedPaths(other.savedPaths), pathCache(other.pathCache),
+    pathsValidated(other.pathsValidated), coveredByPaths(other.coveredByPaths), pinchedPaths(other.pinchedPaths),
+    pinchGraph(pinchGraph), embedding(other.embedding), name(other.name) {
+    
+    // Nothing to do
+}
+
+EmbeddedGraph::EmbeddedGraph(CheckpointReader& in, PinchGraph& pinchGraph): pinchGraph(pinchGraph) {
+    
+    name = in.readString();
+    
+    // Load where each node went
+    uint64_t nodeCount = in.readNumber();
+    for(uint64_t i = 0; i < nodeCount; i++) {
+        int64_t nodeId = in.readSigned();
+        int64_t thread = in.readSigned();
+        int64_t offset = in.readSigned();
+        bool isReverse = in.readNumber();
+        if(!pinchGraph.hasThread(thread)) {
+            throw std::runtime_error("Checkpoint embeds node " + std::to_string(nodeId) + " on a missing thread");
+        }
+        embedding[nodeId] = std::make_tuple(thread, offset, isReverse);
+    }
+    
+    // Load the paths
+    uint64_t pathCount = in.readNumber();
+    for(uint64_t i = 0; i < pathCount; i++) {
+        auto& steps = savedPaths[in.readString()];
+        steps.resize(in.readNumber());
+        for(auto& step : steps) {
+            step.nodeId = in.readSigned();
+            step.offset = in.readSigned();
+            step.isReverse = in.readNumber();
+            step.length = in.readSigned();
+        }
+    }
+    
+    // Load which paths were zipped up with another graph's
+    uint64_t pinchedCount = in.readNumber();
+    for(uint64_t i = 0; i < pinchedCount; i++) {
+        pinchedPaths.insert(in.readString());
+    }
+}
+
+void EmbeddedGraph::save(CheckpointWriter& out) {
+    out.writeString(name);
+    
+    // Save where each node went, by thread name
+    out.writeNumber(embedding.size());
+    for(auto& kv : embedding) {
+        out.writeSigned(kv.first);
+        out.writeSigned(std::get<0>(kv.second));
+        out.writeSigned(std::get<1>(kv.second));
+        out.writeNumber(std::get<2>(kv.second));
+    }
+    
+    // Save the paths, which we may not be able to get back from the source
+    // graph without loading it again.
+    std::set<std::string> pathNames = getPathNames();
+    out.writeNumber(pathNames.size());
+    for(auto& pathName : pathNames) {
+        std::vector<PathStep> steps;
+        PathCursor path = getPathCursor(pathName);
+        PathStep step;
+        while(path(step)) {
+            steps.push_back(step);
+        }
+        
+        out.writeString(pathName);
+        out.writeNumber(steps.size());
+        for(auto& savedStep : steps) {
+            out.writeSigned(savedStep.nodeId);
+            out.writeSigned(savedStep.offset);
+            out.writeNumber(savedStep.isReverse);
+            out.writeSigned(savedStep.length);
+        }
+    }
+    
+    // Save which paths were zipped up with another graph's, so we know which
+    // copies are the same when projecting them.
+    out.writeNumber(pinchedPaths.size());
+    for(auto& pathName : pinchedPaths) {
+        out.writeString(pathName);
+    }
+}
+
+void EmbeddedGraph::attachGraph(vg::VG& graph) {
+    this->graph = &graph;
+}
+
+void EmbeddedGraph::releaseSource() {
+    // Get everything we need out of the source first
+    validatePaths();
+    
+    // Now we look like a graph loaded from a checkpoint
+    graph = nullptr;
+    index = nullptr;
+    gfa = nullptr;
 }
 
 /**
@@ -104,32 +376,200 @@ bool mappingIsPerfectMatch(const vg::Mapping& mapping) {
     return true;
 }
 
-bool EmbeddedGraph::isCoveredByPaths() {
-    bool covered = true;
+void EmbeddedGraph::validatePaths() {
+    if(pathsValidated) {
+        return;
+    }
     
-    graph.for_each_node([&](vg::Node* node) {
-        if(!graph.paths.has_node_mapping(node)) {
-            // We found a node that doesn't have a path on it.
-            covered = false;
+    std::set<std::string> pathNameSet = getPathNames();
+    std::vector<std::string> pathNames(pathNameSet.begin(), pathNameSet.end());
+    std::vector<CachedPath> paths(pathNames.size());
+    // If checking a path failed, why. We can't throw out of an OpenMP loop.
+    std::vector<std::string> errors(pathNames.size());
+    
+    // Check and cache all the paths at once. Everything we look at in the
+    // source graph is only read.
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t i = 0; i < pathNames.size(); i++) {
+        if(graph != nullptr) {
+            // Only vg paths can have mappings that aren't perfect matches
+            size_t rank = 0;
+            for(auto& mapping : graph->paths.get_path(pathNames[i])) {
+                if(!mappingIsPerfectMatch(mapping)) {
+                    errors[i] = "Mapping " + std::to_string(rank) + " of path " + pathNames[i] + " in " + name +
+                        " is not a perfect match";
+                    break;
+                }
+                rank++;
+            }
+            if(!errors[i].empty()) {
+                continue;
+            }
+        }
+        
+        CachedPath& path = paths[i];
+        PathCursor cursor = getSourcePathCursor(pathNames[i]);
+        int64_t pathBase = 0;
+        PathStep step;
+        while(cursor(step)) {
+            if(!embedding.count(step.nodeId)) {
+                errors[i] = "Path " + pathNames[i] + " in " + name + " visits missing node " +
+                    std::to_string(step.nodeId);
+                break;
+            }
+            path.steps.push_back(step);
+            path.starts.push_back(pathBase);
+            pathBase += step.length;
+        }
+        path.starts.push_back(pathBase);
+    }
+    
+    for(size_t i = 0; i < pathNames.size(); i++) {
+        if(!errors[i].empty()) {
+            throw std::runtime_error(errors[i]);
+        }
+    }
+    
+    // Mark off the nodes on paths in a bitset over the range of node IDs, or
+    // in a hash set if the IDs are too spread out for that.
+    coveredByPaths = true;
+    if(!embedding.empty()) {
+        int64_t minId = embedding.begin()->first;
+        uint64_t idRange = embedding.rbegin()->first - minId + 1;
+        std::vector<bool> covered;
+        std::unordered_set<int64_t> coveredSparse;
+        bool useBitset = idRange <= 8 * embedding.size();
+        if(useBitset) {
+            covered.resize(idRange, false);
+        }
+        for(auto& path : paths) {
+            for(auto& step : path.steps) {
+                if(useBitset) {
+                    covered[step.nodeId - minId] = true;
+                } else {
+                    coveredSparse.insert(step.nodeId);
+                }
+            }
+        }
+        for(auto& kv : embedding) {
+            if(useBitset ? !covered[kv.first - minId] : !coveredSparse.count(kv.first)) {
+                // We found a node that doesn't have a path on it.
+                coveredByPaths = false;
 #ifdef debug
-            std::cerr << "Node: " << node->id() << ": " << node->sequence() << " is uncovered by any path" << std::endl;
+                std::cerr << "Node: " << kv.first << " is uncovered by any path" << std::endl;
 #endif
-            
+                break;
+            }
         }
+    }
     
-    });
+    for(size_t i = 0; i < pathNames.size(); i++) {
+        pathCache[pathNames[i]] = std::move(paths[i]);
+    }
+    pathsValidated = true;
+    
+    // Any paths loaded from a checkpoint are all in the cache now.
+    savedPaths.clear();
+}
+
+bool EmbeddedGraph::isCoveredByPaths() {
+    validatePaths();
+    return coveredByPaths;
+}
+
+size_t EmbeddedGraph::findPathStep(const std::string& pathName, int64_t pathBase) {
+    validatePaths();
+    const std::vector<int64_t>& starts = pathCache.at(pathName).starts;
+    // Find the last step starting at or before the base. Empty steps share
+    // their start with the next step, so they are skipped over.
+    return std::upper_bound(starts.begin(), starts.end(), pathBase) - starts.begin() - 1;
+}
+
+std::string EmbeddedGraph::spellPath(const std::string& pathName, int64_t start, int64_t end,
+    const SequenceStore& threadSequences) {
+    
+    const CachedPath& path = pathCache.at(pathName);
+    
+    std::string spelled;
+    spelled.reserve(end - start);
+    
+    // Find the step the range starts in
+    for(size_t i = findPathStep(pathName, start); i < path.steps.size() && path.starts[i] < end; i++) {
+        const PathStep& step = path.steps[i];
+        
+        // Find the bases of the step on its thread, as forEachThreadPath does
+        int64_t thread;
+        int64_t threadStart;
+        bool nodeIsReverse;
+        std::tie(thread, threadStart, nodeIsReverse) = embedding.at(step.nodeId);
+        threadStart += step.offset * (nodeIsReverse ? -1 : 1);
+        bool isReverse = (nodeIsReverse != step.isReverse);
+        if(isReverse) {
+            threadStart -= step.length - 1;
+        }
+        
+        std::string bases = threadSequences.getSequence(thread, threadStart, step.length);
+        if(isReverse) {
+            bases = vg::reverse_complement(bases);
+        }
+        
+        // Clip to the range
+        int64_t clipStart = std::max(start - path.starts[i], (int64_t) 0);
+        int64_t clipEnd = std::min(end - path.starts[i], step.length);
+        spelled.append(bases, clipStart, clipEnd - clipStart);
+    }
     
-    // Return the flag we've been updating
-    return covered;
+    return spelled;
+}
+
+void EmbeddedGraph::checkPathSequence(const std::string& pathName, EmbeddedGraph& other,
+    const SequenceStore& threadSequences) {
+    
+    validatePaths();
+    other.validatePaths();
+    
+    int64_t ourLength = pathCache.at(pathName).starts.back();
+    int64_t theirLength = other.pathCache.at(pathName).starts.back();
+    if(ourLength != theirLength) {
+        // These graphs disagree and we can't merge them without risking merging on an offset.
+        std::cerr << "Path length mismatch for " << pathName << ": " << ourLength << 
+            " in " << name << " vs. " << theirLength << " in " << other.name << std::endl;
+        throw std::runtime_error("Path length mismatch");
+    }
+    
+    // Spell out and compare the path in chunks, in parallel.
+    int64_t chunkCount = (ourLength + PATH_CHUNK_LENGTH - 1) / PATH_CHUNK_LENGTH;
+    // Where each chunk first differs, or -1 if it doesn't
+    std::vector<int64_t> mismatches(chunkCount, -1);
+    
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int64_t i = 0; i < chunkCount; i++) {
+        int64_t start = i * PATH_CHUNK_LENGTH;
+        int64_t end = std::min(start + PATH_CHUNK_LENGTH, ourLength);
+        std::string ours = spellPath(pathName, start, end, threadSequences);
+        std::string theirs = other.spellPath(pathName, start, end, threadSequences);
+        if(memcmp(ours.data(), theirs.data(), ours.size()) != 0) {
+            // Only go looking for where when we know they differ
+            mismatches[i] = start + (std::mismatch(ours.begin(), ours.end(), theirs.begin()).first - ours.begin());
+        }
+    }
+    
+    for(auto mismatch : mismatches) {
+        if(mismatch != -1) {
+            std::cerr << "Path sequence mismatch for " << pathName << " at base " << mismatch << " between " <<
+                name << " and " << other.name << std::endl;
+            throw std::runtime_error("Path sequence mismatch");
+        }
+    }
 }
 
 /**
  * Return the (from) length of a Mapping, even if thgat Mapping has no edits
- * (and is implicitly a full-length perfect match). Requires the graph that the
- * Mapping is to.
+ * (and is implicitly a full-length perfect match). Requires a way to get the
+ * lengths of nodes in the graph that the Mapping is to.
  * TODO: put in a util file or something.
  */
-int64_t mappingLength(const vg::Mapping& mapping, vg::VG& graph) {
+int64_t mappingLength(const vg::Mapping& mapping, const std::function<int64_t(int64_t)>& getNodeLength) {
     if(mapping.edit_size() == 0) {
         // There are no edits so we just use the (remaining) length of the node.
         
@@ -139,7 +579,7 @@ int64_t mappingLength(const vg::Mapping& mapping, vg::VG& graph) {
             return mapping.position().offset() + 1;
         } else {
             // We take the part at and right of the offset
-            int64_t nodeLength = graph.get_node(mapping.position().node_id())->sequence().size();
+            int64_t nodeLength = getNodeLength(mapping.position().node_id());
             return nodeLength - mapping.position().offset();       
        }
     } else {
@@ -148,57 +588,186 @@ int64_t mappingLength(const vg::Mapping& mapping, vg::VG& graph) {
     }
 }
 
+bool EmbeddedGraph::isPathPinched(const std::string& pathName) {
+    return pinchedPaths.count(pathName);
+}
+
 const std::string& EmbeddedGraph::getName() {
     return name;
 }
 
-size_t EmbeddedGraph::scanPath(std::list<vg::Mapping>& path) {
+int64_t EmbeddedGraph::getNodeLength(int64_t nodeId) {
+    if(graph != nullptr) {
+        return graph->get_node(nodeId)->sequence().size();
+    } else if(gfa != nullptr) {
+        return gfa->getNodeLength(nodeId);
+    } else if(index == nullptr) {
+        // We were loaded from a checkpoint, so go by the node's thread
+        return pinchGraph.getThreadLength(std::get<0>(embedding.at(nodeId)));
+    } else {
+        return index->node_length(nodeId);
+    }
+}
+
+std::set<std::string> EmbeddedGraph::getPathNames() {
+    std::set<std::string> pathNames;
+    
+    if(pathsValidated) {
+        // The cache has all the paths, even if the source is gone
+        for(auto& kv : pathCache) {
+            pathNames.insert(kv.first);
+        }
+    } else if(graph != nullptr) {
+        graph->paths.for_each([&](vg::Path& path) {
+            pathNames.insert(path.name());
+        });
+    } else if(gfa != nullptr) {
+        pathNames = gfa->getPathNames();
+    } else if(index == nullptr) {
+        for(auto& kv : savedPaths) {
+            pathNames.insert(kv.first);
+        }
+    } else {
+        for(size_t rank = 1; rank <= index->max_path_rank(); rank++) {
+            pathNames.insert(index->path_name(rank));
+        }
+    }
     
-    size_t totalLength = 0;
+    return pathNames;
+}
+
+PathCursor EmbeddedGraph::getPathCursor(const std::string& pathName) {
+    validatePaths();
     
-    for(auto& mapping : path) {
-        // Force it to be a perfect mapping
-        assert(mappingIsPerfectMatch(mapping));
+    // Walk the cached steps
+    const std::vector<PathStep>* steps = &pathCache.at(pathName).steps;
+    size_t nextStep = 0;
+    return [steps, nextStep](PathStep& step) mutable {
+        if(nextStep == steps->size()) {
+            // We ran out of path
+            return false;
+        }
+        step = (*steps)[nextStep++];
+        return true;
+    };
+}
+
+PathCursor EmbeddedGraph::getSourcePathCursor(const std::string& pathName) {
+    if(graph != nullptr) {
+        // Walk the stored Mappings
+        std::list<vg::Mapping>& path = graph->paths.get_path(pathName);
+        std::list<vg::Mapping>::iterator mapping = path.begin();
+        std::list<vg::Mapping>::iterator end = path.end();
+        
+        // We need a function variable to get node lengths for Mappings with no edits.
+        std::function<int64_t(int64_t)> nodeLength = [this](int64_t nodeId) {
+            return getNodeLength(nodeId);
+        };
         
-        // Calculate and incorporate its length
-        totalLength += mappingLength(mapping, graph);
+        return [mapping, end, nodeLength](PathStep& step) mutable {
+            if(mapping == end) {
+                // We ran out of path
+                return false;
+            }
+            
+            // Force it to be a perfect mapping
+            assert(mappingIsPerfectMatch(*mapping));
+            
+            step.nodeId = (*mapping).position().node_id();
+            step.offset = (*mapping).position().offset();
+            step.isReverse = (*mapping).is_reverse();
+            step.length = mappingLength(*mapping, nodeLength);
+            
+            ++mapping;
+            return true;
+        };
+    }
+    
+    if(gfa != nullptr || index == nullptr) {
+        // Walk the steps we parsed out of the GFA, or loaded from a checkpoint
+        const std::vector<PathStep>* steps = gfa != nullptr ? &gfa->getPath(pathName) : &savedPaths.at(pathName);
+        size_t nextStep = 0;
+        return [steps, nextStep](PathStep& step) mutable {
+            if(nextStep == steps->size()) {
+                // We ran out of path
+                return false;
+            }
+            step = (*steps)[nextStep++];
+            return true;
+        };
     }
     
-    return totalLength;
+    // Otherwise walk along the path in the xg index by position, a node at a
+    // time, since xg paths only ever visit whole nodes. We never need to pull
+    // out the whole path.
+    xg::XG* pathIndex = index;
+    size_t pathLength = index->path_length(pathName);
+    size_t pathBase = 0;
+    
+    return [pathIndex, pathName, pathLength, pathBase](PathStep& step) mutable {
+        if(pathBase >= pathLength) {
+            // We ran out of path
+            return false;
+        }
+        
+        vg::Mapping mapping = pathIndex->mapping_at_path_position(pathName, pathBase);
+        
+        step.nodeId = mapping.position().node_id();
+        step.isReverse = mapping.is_reverse();
+        step.length = pathIndex->node_length(step.nodeId);
+        // Reverse steps start from the last base of the node
+        step.offset = step.isReverse ? step.length - 1 : 0;
+        
+        pathBase += step.length;
+        return true;
+    };
+}
+
+PathCursor EmbeddedGraph::getPathCursor(const PathStep* steps, size_t count) {
+    const PathStep* end = steps + count;
+    
+    return [steps, end](PathStep& step) mutable {
+        if(steps == end) {
+            // We ran out of path
+            return false;
+        }
+        
+        step = *steps;
+        ++steps;
+        return true;
+    };
 }
 
-void EmbeddedGraph::pinchWith(EmbeddedGraph& other) {
+void EmbeddedGraph::pinchWith(EmbeddedGraph& other, std::set<std::string>* pathsDone,
+    const SequenceStore* threadSequences) {
+    // Check and cache the paths in both graphs
+    validatePaths();
+    other.validatePaths();
+    
     // Look for common path names
-    std::set<std::string> ourPaths;
+    std::set<std::string> ourPaths = getPathNames();
     
-    graph.paths.for_each([&](vg::Path& path) { 
-        ourPaths.insert(path.name());
-    });
     std::set<std::string> sharedPaths;
-    other.graph.paths.for_each([&](vg::Path& path) { 
-        std::string pathName = path.name();
-        if(ourPaths.count(pathName)) {
+    for(auto& pathName : other.getPathNames()) {
+        if(ourPaths.count(pathName) && (pathsDone == nullptr || !pathsDone->count(pathName))) {
             sharedPaths.insert(pathName);
         }
-    });
+    }
     
-    if(sharedPaths.size() == 0) {
+    if(pathsDone != nullptr) {
+        // These will all be done now
+        pathsDone->insert(sharedPaths.begin(), sharedPaths.end());
+    } else if(sharedPaths.size() == 0) {
         // Warn the user that no merging can happen.
         std::cerr << "WARNING: No shared paths exist to merge on!" << std::endl;
     }
     
     for(std::string pathName : sharedPaths) {
         // We zip along every shared path
-    
-        // Get the mappings
-        std::list<vg::Mapping>& ourPath = graph.paths.get_path(pathName);
-        std::list<vg::Mapping>& theirPath = other.graph.paths.get_path(pathName);
-    
-        // Go through each and make sure their lengths agree.
-        std::cerr << "Checking " << pathName << " in " << name << " graph." << std::endl;
-        size_t ourLength = scanPath(ourPath);
-        std::cerr << "Checking " << pathName << " in " << other.name << " graph." << std::endl;
-        size_t theirLength = other.scanPath(theirPath);
+        
+        // Make sure their lengths agree, from the checked paths.
+        size_t ourLength = pathCache.at(pathName).starts.back();
+        size_t theirLength = other.pathCache.at(pathName).starts.back();
         
         if(ourLength != theirLength) {
             // These graphs disagree and we can't merge them without risking merging on an offset.
@@ -207,47 +776,79 @@ void EmbeddedGraph::pinchWith(EmbeddedGraph& other) {
             throw std::runtime_error("Path length mismatch");
         }
         
+        if(threadSequences != nullptr) {
+            std::cerr << "Checking sequence of " << pathName << " in " << name << " and " << other.name <<
+                " graphs." << std::endl;
+            checkPathSequence(pathName, other, *threadSequences);
+        }
+        
         std::cerr << "Processing path " << pathName << std::endl;
         
         // Do thje actual merge
-        pinchOnPaths(ourPath, other, theirPath);
+        pinchOnSharedPath(pathName, other);
+        pinchedPaths.insert(pathName);
+        other.pinchedPaths.insert(pathName);
     }
 }
 
-void EmbeddedGraph::pinchOnPaths(std::list<vg::Mapping>& path, EmbeddedGraph& other, 
-    std::list<vg::Mapping>& otherPath) {
+void EmbeddedGraph::forEachThreadPath(const std::function<void(const std::string&, ThreadCursor)>& iteratee) {
+    for(auto& pathName : getPathNames()) {
+        PathCursor path = getPathCursor(pathName);
         
-    // Make iterators to go through them together
-    std::list<vg::Mapping>::iterator ourMapping = path.begin();
-    std::list<vg::Mapping>::iterator theirMapping = otherPath.begin();
+        iteratee(pathName, [&](ThreadStep& threadStep) {
+            PathStep step;
+            if(!path(step)) {
+                // We ran out of path
+                return false;
+            }
+            
+            // Find where the node starts on its thread
+            bool nodeIsReverse;
+            std::tie(threadStep.thread, threadStep.start, nodeIsReverse) = embedding.at(step.nodeId);
+            
+            // Advance by the offset in the node at which the mapping starts
+            threadStep.start += step.offset * (nodeIsReverse ? -1 : 1);
+            threadStep.length = step.length;
+            threadStep.isReverse = (nodeIsReverse != step.isReverse);
+            
+            if(threadStep.isReverse) {
+                // We have the last base of the run on the thread, but we want
+                // the first one.
+                threadStep.start -= step.length - 1;
+            }
+            
+            return true;
+        });
+    }
+}
+
+void EmbeddedGraph::pinchOnPaths(PathCursor path, EmbeddedGraph& other, PathCursor otherPath) {
+    
+    // Pull the first step from each path, so we can go through them together
+    PathStep ourStep, theirStep;
+    bool haveOurs = path(ourStep);
+    bool haveTheirs = otherPath(theirStep);
     
     // Keep track of where we are alogn each path, so we can get mapping
     // overlap
     int64_t ourPathBase = 0;
     int64_t theirPathBase = 0;
-
-    while(ourMapping != path.end() && theirMapping != otherPath.end()) {
+    
+    while(haveOurs && haveTheirs) {
         // Go along the two paths.
 #ifdef debug
         std::cerr << "At " << ourPathBase << " in graph 1, " << theirPathBase << " in graph 2." << std::endl;
-        
-        std::cerr << "Our mapping: " << pb2json(*ourMapping) << std::endl;
-        std::cerr << "Their mapping: " << pb2json(*theirMapping) << std::endl;
 #endif
         
-        // Make sure the mappings are perfect matches
-        assert(mappingIsPerfectMatch(*ourMapping));
-        assert(mappingIsPerfectMatch(*theirMapping));
-        
         // See how long our mapping is and how long their mapping is
-        int64_t ourMappingLength = mappingLength(*ourMapping, graph);
-        int64_t theirMappingLength = mappingLength(*theirMapping, other.graph);
-
+        int64_t ourMappingLength = ourStep.length;
+        int64_t theirMappingLength = theirStep.length;
+        
 #ifdef debug
-        std::cerr << "Our mapping is " << ourMappingLength << " bases on node " << (*ourMapping).position().node_id() <<
-            " offset " << (*ourMapping).position().offset() << " orientation " << (*ourMapping).is_reverse() << std::endl;
-        std::cerr << "Their mapping is " << theirMappingLength << " bases on node " << (*theirMapping).position().node_id() <<
-            " offset " << (*theirMapping).position().offset() << " orientation " << (*theirMapping).is_reverse() << std::endl;
+        std::cerr << "Our mapping is " << ourMappingLength << " bases on node " << ourStep.nodeId <<
+            " offset " << ourStep.offset << " orientation " << ourStep.isReverse << std::endl;
+        std::cerr << "Their mapping is " << theirMappingLength << " bases on node " << theirStep.nodeId <<
+            " offset " << theirStep.offset << " orientation " << theirStep.isReverse << std::endl;
 #endif
 
         // See how much they overlap (start and length in each mapping)
@@ -266,55 +867,11 @@ void EmbeddedGraph::pinchOnPaths(std::list<vg::Mapping>& path, EmbeddedGraph& ot
             std::cerr << "The mappings overlap for " << overlapLength << " bp" << std::endl;
 #endif
             
-            // Figure out where that overlapped region is in each graph
-            // (start, length, and orientation in each mapping's node).
-            // Start at the positions where the nodes start.
-            stPinchThread* ourThread, *theirThread;
-            int64_t ourOffset, theirOffset;
-            bool ourIsReverse, theirIsReverse;
-            
-            std::tie(ourThread, ourOffset, ourIsReverse) = embedding.at((*ourMapping).position().node_id());
-            std::tie(theirThread, theirOffset, theirIsReverse) = other.embedding.at((*theirMapping).position().node_id());
-            
-            // Advance by the offset in the node at which the mapping starts
-            ourOffset += (*ourMapping).position().offset() * (ourIsReverse ? -1 : 1);
-            theirOffset += (*theirMapping).position().offset() * (theirIsReverse ? -1 : 1);
-            
-            // Advance up to the start of the overlap, accounting for the
-            // orientation of both the mapping in the node and the node in
-            // the thread.
-            ourOffset += (overlapStart - ourPathBase) * (ourIsReverse != (*ourMapping).is_reverse() ? -1 : 1);
-            theirOffset += (overlapStart - theirPathBase) * (theirIsReverse != (*theirMapping).is_reverse() ? -1 : 1);
-            
-            // Pull back to the actual start of the overlap in thread
-            // coordinates if it is going backward on the thread in question
-            // from the mapping's start position. The -1 accounts for the
-            // inclusiveness of the original end coordinate, and going to an
-            // end-exclusive system.
-            if(ourIsReverse != (*ourMapping).is_reverse()) {
-                ourOffset -= overlapLength - 1;
-            }
-            if(theirIsReverse != (*theirMapping).is_reverse()) {
-                theirOffset -= overlapLength - 1;
-            }
-            
-            // Should we pinch the things relatively forward (0) or
-            // relatively reverse (1)? Calculated by xor-ing all the flags
-            // that could, by themselves, cause us to pinch in opposite
-            // orientations.
-            bool relativeOrientation = (ourIsReverse != (*ourMapping).is_reverse() != 
-                theirIsReverse != (*theirMapping).is_reverse());
-
-#ifdef debug
-            std::cerr << "Pinch thread " << stPinchThread_getName(ourThread) << ":" << ourOffset << " and " << 
-                stPinchThread_getName(theirThread) << ":" << theirOffset << " for " << overlapLength <<
-                " bases in orientation " << (relativeOrientation ? "reverse" : "forward") << std::endl;
-#endif
-            
-            // Pinch the threads, making sure to convert to pinch graph orientations, which are backward.
-            stPinchThread_pinch(ourThread, theirThread, ourOffset, theirOffset, overlapLength, !relativeOrientation);
-
-            
+            // Pinch the threads where the overlap is
+            PinchOp pinch = findPinch(ourStep, ourPathBase, other, theirStep, theirPathBase, overlapStart, overlapLength);
+            pinchGraph.pinch(pinch.thread1, pinch.thread2, pinch.start1, pinch.start2, pinch.length, pinch.strand);
+        
+        
         }
         
         // Advance the mapping that ends first, or, if both end at the same place, advance both
@@ -322,7 +879,7 @@ void EmbeddedGraph::pinchOnPaths(std::list<vg::Mapping>& path, EmbeddedGraph& ot
         if(ourPathBase + ourMappingLength == minNextBase) {
             // We end first, so advance us
             ourPathBase = minNextBase;
-            ++ourMapping;
+            haveOurs = path(ourStep);
 #ifdef debug
             std::cerr << "Advanced in our thread" << std::endl;
 #endif
@@ -330,7 +887,7 @@ void EmbeddedGraph::pinchOnPaths(std::list<vg::Mapping>& path, EmbeddedGraph& ot
         if(theirPathBase + theirMappingLength == minNextBase) {
             // They end first, so advance them
             theirPathBase = minNextBase;
-            ++theirMapping;
+            haveTheirs = otherPath(theirStep);
 #ifdef debug
             std::cerr << "Advanced in their thread" << std::endl;
 #endif
@@ -340,179 +897,326 @@ void EmbeddedGraph::pinchOnPaths(std::list<vg::Mapping>& path, EmbeddedGraph& ot
     
     }
     
-    if((ourMapping == path.end()) != (theirMapping == otherPath.end())) {
+    if(haveOurs != haveTheirs) {
         std::cerr << "We ran out of path in one graph and not in the other!" << std::endl;
         
-        if(ourMapping != path.end()) {
+        if(haveOurs) {
             std::cerr << "We have a mapping" << std::endl;
-            std::cerr << "Our mapping: " << pb2json(*ourMapping) << std::endl;
+            std::cerr << "Our mapping: node " << ourStep.nodeId << " offset " << ourStep.offset <<
+                " orientation " << ourStep.isReverse << " length " << ourStep.length << std::endl;
         }
         
-        if(theirMapping != otherPath.end()) {
+        if(haveTheirs) {
             std::cerr << "They have a mapping" << std::endl;
-            std::cerr << "Their mapping: " << pb2json(*theirMapping) << std::endl;
+            std::cerr << "Their mapping: node " << theirStep.nodeId << " offset " << theirStep.offset <<
+                " orientation " << theirStep.isReverse << " length " << theirStep.length << std::endl;
         }
         
         // We should reach the end at the same time, but we didn't
         throw std::runtime_error("Ran out of mappings on one path before the other!");
     }
-        
-}
 
-std::list<vg::Mapping> EmbeddedGraph::makeMinimalPath(
-    std::string& kmer, std::list<vg::NodeTraversal>::iterator occurrence,
-    int offset, std::list<vg::NodeTraversal>& path) {
+}
 
-    // Generate a path (std::list<vg::Mapping>) that describes only the
-    // kmer.
-    std::list<vg::Mapping> minimalPath;
+EmbeddedGraph::PinchOp EmbeddedGraph::findPinch(const PathStep& ourStep, int64_t ourPathBase, EmbeddedGraph& other,
+    const PathStep& theirStep, int64_t theirPathBase, int64_t overlapStart, int64_t overlapLength) {
     
-    // How many bases of the kmer are yet to be accounted for?
-    size_t remainingKmerLength = kmer.size();
+    // Figure out where that overlapped region is in each graph
+    // (start, length, and orientation in each mapping's node).
+    // Start at the positions where the nodes start.
+    int64_t ourThread, theirThread;
+    int64_t ourOffset, theirOffset;
+    bool ourIsReverse, theirIsReverse;
     
-    // What will the offset from where we enter the next node be? Will only
-    // be nonzero on the first node.
-    size_t nextOffset = offset;
+    std::tie(ourThread, ourOffset, ourIsReverse) = embedding.at(ourStep.nodeId);
+    std::tie(theirThread, theirOffset, theirIsReverse) = other.embedding.at(theirStep.nodeId);
     
-    for(std::list<vg::NodeTraversal>::iterator i = occurrence; i != path.end() && remainingKmerLength > 0; ++i) {
-        // For every node the kmer visits
-        
-        // Make a Mapping to this node
-        vg::Mapping mapping;
-        
-        // How long is the node we're mapping to?
-        size_t nodeLength = (*i).node->sequence().size();
+    // Advance by the offset in the node at which the mapping starts
+    ourOffset += ourStep.offset * (ourIsReverse ? -1 : 1);
+    theirOffset += theirStep.offset * (theirIsReverse ? -1 : 1);
+    
+    // Advance up to the start of the overlap, accounting for the
+    // orientation of both the mapping in the node and the node in
+    // the thread.
+    ourOffset += (overlapStart - ourPathBase) * (ourIsReverse != ourStep.isReverse ? -1 : 1);
+    theirOffset += (overlapStart - theirPathBase) * (theirIsReverse != theirStep.isReverse ? -1 : 1);
+    
+    // Pull back to the actual start of the overlap in thread
+    // coordinates if it is going backward on the thread in question
+    // from the mapping's start position. The -1 accounts for the
+    // inclusiveness of the original end coordinate, and going to an
+    // end-exclusive system.
+    if(ourIsReverse != ourStep.isReverse) {
+        ourOffset -= overlapLength - 1;
+    }
+    if(theirIsReverse != theirStep.isReverse) {
+        theirOffset -= overlapLength - 1;
+    }
+    
+    // Should we pinch the things relatively forward (0) or
+    // relatively reverse (1)? Calculated by xor-ing all the flags
+    // that could, by themselves, cause us to pinch in opposite
+    // orientations.
+    bool relativeOrientation = (ourIsReverse != ourStep.isReverse !=
+        theirIsReverse != theirStep.isReverse);
         
-        // Set the node ID we map to
-        mapping.mutable_position()->set_node_id((*i).node->id());
-        // Set the offset we map to
-        mapping.mutable_position()->set_offset(nextOffset);
-        if((*i).backward) {
-            // Adjust so we actually come to the right side instead of the
-            // left.
-            mapping.set_is_reverse(true);
-            
-            // We need to correct the offset to count from the start of the
-            // underlying, reversed node, instead of the start of the
-            // traversal.
-            mapping.mutable_position()->set_offset(nodeLength - nextOffset - 1);
-        }
+#ifdef debug
+    std::cerr << "Pinch thread " << ourThread << ":" << ourOffset << " and " << 
+        theirThread << ":" << theirOffset << " for " << overlapLength <<
+        " bases in orientation " << (relativeOrientation ? "reverse" : "forward") << std::endl;
+#endif
+    
+    // Make sure to convert to pinch graph orientations, which are backward.
+    return PinchOp{ourThread, theirThread, ourOffset, theirOffset, overlapLength, !relativeOrientation};
+}
+
+void EmbeddedGraph::pinchOnSharedPath(const std::string& pathName, EmbeddedGraph& other) {
+    
+    const CachedPath& ours = pathCache.at(pathName);
+    const CachedPath& theirs = other.pathCache.at(pathName);
+    int64_t pathLength = ours.starts.back();
+    
+    // Cut the path into coordinate ranges, and work out the pinches for each
+    // range in parallel. Only the embeddings are read, so that is safe. The
+    // pinch graph can't be changed from more than one thread, so the pinches
+    // are then done in order.
+    int64_t chunkCount = (pathLength + PATH_CHUNK_LENGTH - 1) / PATH_CHUNK_LENGTH;
+    std::vector<std::vector<PinchOp>> chunkPinches(chunkCount);
+    
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int64_t chunk = 0; chunk < chunkCount; chunk++) {
+        int64_t start = chunk * PATH_CHUNK_LENGTH;
+        int64_t end = std::min(start + PATH_CHUNK_LENGTH, pathLength);
         
-        // Populate the length of the mapping, in a single perfect match
-        // edit.
-        vg::Edit* edit = mapping.add_edit();
+        // Jump to the steps that the range starts in
+        size_t ourIndex = findPathStep(pathName, start);
+        size_t theirIndex = other.findPathStep(pathName, start);
+        int64_t pathBase = start;
         
-        if(remainingKmerLength >= (nodeLength - nextOffset)) {
-            // We don't finish with this node. Map over all of it.
-            edit->set_from_length(nodeLength - nextOffset);
-            edit->set_to_length(nodeLength - nextOffset);
+        while(pathBase < end && ourIndex < ours.steps.size() && theirIndex < theirs.steps.size()) {
+            // The steps overlap from here to where the first one ends
+            int64_t ourEnd = ours.starts[ourIndex + 1];
+            int64_t theirEnd = theirs.starts[theirIndex + 1];
+            int64_t overlapEnd = std::min(std::min(ourEnd, theirEnd), end);
             
-            // Update the remaining kmer length to account for how much we
-            // used in this node.
-            remainingKmerLength -= (nodeLength - nextOffset);
-        } else {
-            // We do finish in this node. Map over only the part we actually
-            // cover.
-            edit->set_from_length(remainingKmerLength);
-            edit->set_to_length(remainingKmerLength);
+            if(overlapEnd > pathBase) {
+                chunkPinches[chunk].push_back(findPinch(ours.steps[ourIndex], ours.starts[ourIndex], other,
+                    theirs.steps[theirIndex], theirs.starts[theirIndex], pathBase, overlapEnd - pathBase));
+            }
             
-            // We consumed the rest of the kmer length.
-            remainingKmerLength = 0;
+            // Advance whichever steps end here
+            pathBase = overlapEnd;
+            if(ourEnd == pathBase) {
+                ourIndex++;
+            }
+            if(theirEnd == pathBase) {
+                theirIndex++;
+            }
         }
-        
-        // Adjust the offset for the next iteration. It can only be nonzero
-        // for the first node.
-        nextOffset = 0;
-        
-        // Add the mapping to the path
-        minimalPath.push_back(mapping);
     }
     
-    // Spit back the minimal path we have constructed, with only the Mappings
-    // covering the actual kmer sequence.
-    return minimalPath;
-
+    for(auto& pinches : chunkPinches) {
+        for(auto& pinch : pinches) {
+            pinchGraph.pinch(pinch.thread1, pinch.thread2, pinch.start1, pinch.start2, pinch.length, pinch.strand);
+        }
+        
+        // Free as we go
+        pinches.clear();
+        pinches.shrink_to_fit();
+    }
 }
 
-bool EmbeddedGraph::paths_equal(std::list<vg::Mapping>& path1, std::list<vg::Mapping>& path2) {
-    // We're going to structurally compare paths that we know are made by makeMinimalPath.
-    // We therefore can look at only certain fields.
+size_t EmbeddedGraph::pinchOnAlignments(const std::vector<vg::Alignment>& alignments, size_t count,
+    EmbeddedGraph& other) {
     
-    if(path1.size() != path2.size()) {
-        // They can't be equal if they differ in number of mappings.
-        return false;
-    }
+    validatePaths();
     
-    // Loop through the two paths in parallel. See
-    // <http://stackoverflow.com/a/19933798>
-    auto i = path1.begin();
-    auto j = path2.begin();
+    // Mappings with no edits run to the end of their nodes in the other graph
+    std::function<int64_t(int64_t)> theirNodeLength = [&](int64_t nodeId) {
+        return other.getNodeLength(nodeId);
+    };
     
-    for(; i != path1.end() && j != path2.end(); ++i, ++j) {
-        auto& mapping1 = *i;
-        auto& mapping2 = *j;
-        
-        // Compare all the fields of the mappings
-        
-        if(mapping1.position().node_id() != mapping2.position().node_id()) {
-            return false;
-        }
-        
-        if(mapping1.position().offset() != mapping2.position().offset()) {
-            return false;
-        }
-        
-        if(mapping1.is_reverse() != mapping2.is_reverse()) {
-            return false;
-        }
-        
-        if(mapping1.edit_size() != mapping2.edit_size()) {
-            return false;
-        }
+    // Work out the pinches for each alignment in parallel. Only the
+    // embeddings are read, so that is safe. The pinches are then made in
+    // order, as pinchOnSharedPath() does.
+    std::vector<std::vector<PinchOp>> alignmentPinches(count);
+    std::vector<size_t> alignmentBases(count, 0);
+    std::vector<std::string> errors(count);
+    
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t i = 0; i < count; i++) {
+        const vg::Alignment& alignment = alignments[i];
         
-        for(int k = 0; k < mapping1.edit_size(); k++) {
-            auto& edit1 = mapping1.edit(k);
-            auto& edit2 = mapping2.edit(k);
-            
-            // Compare all the fields of each edit
+        try {
+            // Work out what path the alignment is along, and where
+            std::string pathName = alignment.name();
+            int64_t start = 0;
+            int64_t end = -1;
+            if(pathCache.count(pathName) == 0) {
+                size_t colon = pathName.rfind(':');
+                size_t dash = colon == std::string::npos ? colon : pathName.find('-', colon);
+                if(dash == std::string::npos) {
+                    throw std::runtime_error("Alignment " + alignment.name() + " is not named for a path in " + name);
+                }
+                start = std::stoll(pathName.substr(colon + 1, dash - colon - 1));
+                end = std::stoll(pathName.substr(dash + 1));
+                pathName.resize(colon);
+                if(pathCache.count(pathName) == 0) {
+                    throw std::runtime_error("Alignment " + alignment.name() + " is not named for a path in " + name);
+                }
+            }
+            const CachedPath& path = pathCache.at(pathName);
             
-            if(edit1.from_length() != edit2.from_length()) {
-                return false;
+            // Make sure the other graph has all the nodes, and count up the
+            // aligned bases
+            int64_t alignedLength = 0;
+            for(auto& mapping : alignment.path().mapping()) {
+                if(other.embedding.count(mapping.position().node_id()) == 0) {
+                    throw std::runtime_error("Alignment " + alignment.name() + " visits node " +
+                        std::to_string(mapping.position().node_id()) + ", which is not in " + other.name);
+                }
+                if(mapping.edit_size() == 0) {
+                    alignedLength += mappingLength(mapping, theirNodeLength);
+                } else {
+                    for(auto& edit : mapping.edit()) {
+                        alignedLength += edit.to_length();
+                    }
+                }
+            }
+            if(end == -1) {
+                end = start + alignedLength;
+            } else if(end - start != alignedLength) {
+                throw std::runtime_error("Alignment " + alignment.name() + " aligns " +
+                    std::to_string(alignedLength) + " bases, not " + std::to_string(end - start));
+            }
+            if(start < 0 || end > path.starts.back()) {
+                throw std::runtime_error("Alignment " + alignment.name() + " runs off the end of " + pathName);
             }
             
-            if(edit1.to_length() != edit2.to_length()) {
-                return false;
+            // Pinch a run of matching bases, starting at the given path base,
+            // against the steps of our path that it overlaps.
+            auto pinchMatch = [&](const PathStep& theirStep, int64_t pathBase) {
+                int64_t matchEnd = pathBase + theirStep.length;
+                size_t ourIndex = findPathStep(pathName, pathBase);
+                int64_t base = pathBase;
+                while(base < matchEnd) {
+                    int64_t ourEnd = path.starts[ourIndex + 1];
+                    int64_t overlapEnd = std::min(ourEnd, matchEnd);
+                    if(overlapEnd > base) {
+                        alignmentPinches[i].push_back(findPinch(path.steps[ourIndex], path.starts[ourIndex], other,
+                            theirStep, pathBase, base, overlapEnd - base));
+                    }
+                    
+                    // Advance whichever step ends here
+                    base = overlapEnd;
+                    if(ourEnd == base) {
+                        ourIndex++;
+                    }
+                }
+                alignmentBases[i] += theirStep.length;
+            };
+            
+            // Now go through the mappings, pinching on the edits that match
+            int64_t pathBase = start;
+            for(auto& mapping : alignment.path().mapping()) {
+                PathStep theirStep;
+                theirStep.nodeId = mapping.position().node_id();
+                theirStep.offset = mapping.position().offset();
+                theirStep.isReverse = mapping.is_reverse();
+                
+                if(mapping.edit_size() == 0) {
+                    // It is a perfect match to the rest of the node
+                    theirStep.length = mappingLength(mapping, theirNodeLength);
+                    pinchMatch(theirStep, pathBase);
+                    pathBase += theirStep.length;
+                    continue;
+                }
+                
+                for(auto& edit : mapping.edit()) {
+                    if(edit.from_length() == edit.to_length() && edit.sequence().empty() && edit.from_length() > 0) {
+                        theirStep.length = edit.from_length();
+                        pinchMatch(theirStep, pathBase);
+                    }
+                    
+                    // Step over the edit on both sides
+                    pathBase += edit.to_length();
+                    theirStep.offset += edit.from_length() * (theirStep.isReverse ? -1 : 1);
+                }
             }
+        } catch(std::exception& e) {
+            errors[i] = e.what();
+            alignmentPinches[i].clear();
         }
     }
     
-    // If we get here, all the mappings match
-    return true;
+    for(auto& error : errors) {
+        if(!error.empty()) {
+            throw std::runtime_error(error);
+        }
+    }
+    
+    size_t pinchedBases = 0;
+    for(size_t i = 0; i < count; i++) {
+        for(auto& pinch : alignmentPinches[i]) {
+            pinchGraph.pinch(pinch.thread1, pinch.thread2, pinch.start1, pinch.start2, pinch.length, pinch.strand);
+        }
+        pinchedBases += alignmentBases[i];
+    }
+    
+    return pinchedBases;
 }
 
-std::list<vg::Mapping> EmbeddedGraph::reverse_path(std::list<vg::Mapping> path) {
-    // We need a function variable so we can supply a non-const reference.
-    std::function<int64_t(int64_t)> getNodeLength = [&](int64_t nodeId) {
-        // We need to be able to provide the sizes of nodes to do
-        // this, and we get those sizes from our graph.
-        return graph.get_node(nodeId)->sequence().size();
-    };
+bool EmbeddedGraph::pathsEqual(const PathStep* steps1, size_t count1, const PathStep* steps2, size_t count2) {
+    if(count1 != count2) {
+        // They can't be equal if they differ in number of steps.
+        return false;
+    }
     
-    std::list<vg::Mapping> pathRev;
-    for(auto& mapping : path) {
-        // Reverse each mapping
-        vg::Mapping reversed = vg::reverse_mapping(mapping, getNodeLength);
-        
-        // Put the mapping at the front of our new list (to reverse the order)
-        pathRev.push_front(reversed);
+    for(size_t i = 0; i < count1; i++) {
+        // Compare all the fields of the steps
+        if(steps1[i].nodeId != steps2[i].nodeId || steps1[i].offset != steps2[i].offset ||
+            steps1[i].isReverse != steps2[i].isReverse || steps1[i].length != steps2[i].length) {
+            return false;
+        }
     }
     
-    return pathRev;
+    // If we get here, all the steps match
+    return true;
+}
+
+void EmbeddedGraph::reversePath(const PathStep* steps, size_t count, std::vector<PathStep>& reversed) {
+    reversed.clear();
+    for(size_t i = count; i > 0; i--) {
+        // Read the same bases of the node the other way, starting from the
+        // other end of the run.
+        PathStep step = steps[i - 1];
+        step.offset += step.isReverse ? -(step.length - 1) : step.length - 1;
+        step.isReverse = !step.isReverse;
+        reversed.push_back(step);
+    }
 }
 
 void EmbeddedGraph::pinchOnKmers(vg::Index& ourIndex, EmbeddedGraph& other,
     vg::Index& theirIndex, size_t kmerSize, size_t edgeMax) {
     
+    // Find the unique kmers in each graph
+    UniqueKmerPaths ourUniqueKmerPaths;
+    collectUniqueKmers(ourIndex, ourUniqueKmerPaths, kmerSize, edgeMax);
+    UniqueKmerPaths theirUniqueKmerPaths;
+    other.collectUniqueKmers(theirIndex, theirUniqueKmerPaths, kmerSize, edgeMax);
+    
+    // And pinch on the ones they share
+    pinchOnUniqueKmers(ourUniqueKmerPaths, other, theirUniqueKmerPaths, kmerSize);
+}
+
+void EmbeddedGraph::collectUniqueKmers(vg::Index& index, UniqueKmerPaths& uniqueKmerPaths,
+    size_t kmerSize, size_t edgeMax) {
+    
+    if(graph == nullptr) {
+        // We need a vg graph to enumerate kmers in
+        throw std::runtime_error("Kmer merging requires graphs to be loaded from vg files");
+    }
+    
     // Actually good strategy:
     // Loop through the kmer instances in our index
     // For each first kmer instance followed by a different kmer (or for the last kmer instance if it's the first with its value)
@@ -524,33 +1228,47 @@ void EmbeddedGraph::pinchOnKmers(vg::Index& ourIndex, EmbeddedGraph& other,
     
     // Alternate easy startegy that I will use:
     
-    // Keep track of the paths for unique kmers in our graph.
-    // A kmer that occurs along multiple paths, but which the index still thinks is unique, 
-    std::map<std::string, std::list<vg::Mapping>> ourUniqueKmerPaths;
-    // We need to protect it with a mutex
-    std::mutex ourUniqueKmerPathsMutex;
+    // Keep track of the paths for unique kmers in the graph. A kmer that
+    // occurs along multiple paths, but which the index still thinks is
+    // unique, gets an empty path. We need to protect it with a mutex.
+    std::mutex uniqueKmerPathsMutex;
     
-    // And in the other graph
-    std::map<std::string, std::list<vg::Mapping>> theirUniqueKmerPaths;
-    // We need to protect it with a mutex
-    std::mutex theirUniqueKmerPathsMutex;
+    // Each thread spells kmers and builds their paths in its own reused
+    // strings and vectors, so only paths that get kept are copied into the
+    // shared pool.
+    std::vector<std::string> threadKmers(omp_get_max_threads());
+    std::vector<std::string> threadReverseKmers(omp_get_max_threads());
+    std::vector<std::vector<PathStep>> threadPaths(omp_get_max_threads());
+    std::vector<std::vector<PathStep>> threadReversePaths(omp_get_max_threads());
     
     #ifdef debug
         std::cerr << "Looking for kmers of size " << kmerSize << "." << std::endl;
     #endif
     
-    auto observeKmer = [this](std::string& kmer,
-        std::list<vg::NodeTraversal>::iterator occurrence, int offset,
-        std::list<vg::NodeTraversal>& path, vg::Index& index,
-        std::map<std::string, std::list<vg::Mapping>>& uniqueKmerPaths,
-        std::mutex& uniqueKmerPathsMutex) {
+    // Walk the kmers in the graph ourselves, instead of having vg build a
+    // kpath and a string for each one.
+    KmerWalker walker(*graph, kmerSize, edgeMax);
+    if(edgeMax != 0) {
+        std::cerr << "Masked " << walker.getMaskedBases() << " bp of " << name << " where every " << kmerSize <<
+            "-mer passes " << edgeMax << " or more choice points." << std::endl;
+    }
+    
+    walker.forEachKmerParallel([&](const KmerAnchor& anchor, const KmerWalker::Walk& walk) {
         
-        // We receive each kmer, starting at the given offset from the left of
-        // the given traversal, along the given path.
+        // We receive each kmer, starting on the forward strand of a node,
+        // along the walk it was found on.
         
         // We will make sure it is unique in our graph, and then add it to our
         // table of unique kmers.
         
+        size_t thread = omp_get_thread_num();
+        std::string& kmer = threadKmers.at(thread);
+        std::string& reverseKmer = threadReverseKmers.at(thread);
+        std::vector<PathStep>& minimalPath = threadPaths.at(thread);
+        std::vector<PathStep>& minimalPathRev = threadReversePaths.at(thread);
+        
+        walker.spellKmer(anchor, walk, kmer);
+        
         if(index.approx_size_of_kmer_matches(kmer) > MAX_UNIQUE_KMER_BYTES) {
             // If its data takes up lots of space, it's not unique
             return;
@@ -563,7 +1281,8 @@ void EmbeddedGraph::pinchOnKmers(vg::Index& ourIndex, EmbeddedGraph& other,
         });
         
         // Also include occurrences of the reverse complement
-        index.for_kmer_range(vg::reverse_complement(kmer), [&](std::string& key, std::string& value) {
+        KmerWalker::reverseComplement(kmer, reverseKmer);
+        index.for_kmer_range(reverseKmer, [&](std::string& key, std::string& value) {
             kmerCount++;
         });
         
@@ -581,25 +1300,26 @@ void EmbeddedGraph::pinchOnKmers(vg::Index& ourIndex, EmbeddedGraph& other,
         // But does it occur on multiple paths?
         
         // Get the minimal path for the kmer
-        std::list<vg::Mapping> minimalPath(makeMinimalPath(kmer, occurrence, offset, path));
+        walker.getSteps(anchor, walk, minimalPath);
         
         // Compute what it would look like as a reverse complement
-        std::list<vg::Mapping> minimalPathRev = reverse_path(minimalPath);
+        reversePath(minimalPath.data(), minimalPath.size(), minimalPathRev);
         
         // Now we need to do serial access to the deduplication index
         std::lock_guard<std::mutex> guard(uniqueKmerPathsMutex);
         
         // Look up the kmer in the index
-        auto kv = uniqueKmerPaths.find(kmer);
+        auto kv = uniqueKmerPaths.paths.find(kmer);
         
         // And the reverse version
-        auto reverse_kv = uniqueKmerPaths.find(vg::reverse_complement(kmer));
+        auto reverse_kv = uniqueKmerPaths.paths.find(reverseKmer);
         
-        if(kv == uniqueKmerPaths.end()) {
-            if(reverse_kv == uniqueKmerPaths.end()) {
+        if(kv == uniqueKmerPaths.paths.end()) {
+            if(reverse_kv == uniqueKmerPaths.paths.end()) {
                 // It's not in there and neither is its reverse complement.
-                // Add it with the path we just made.
-                uniqueKmerPaths[kmer] = minimalPath;
+                // Add it with the path we just made, copied into the pool.
+                uniqueKmerPaths.paths[kmer] = std::make_pair(uniqueKmerPaths.steps.size(), minimalPath.size());
+                uniqueKmerPaths.steps.insert(uniqueKmerPaths.steps.end(), minimalPath.begin(), minimalPath.end());
 #ifdef debug
                 #pragma omp critical(cerr)
                 std::cerr << "Found unique kmer " << kmer << "." << std::endl;
@@ -609,17 +1329,18 @@ void EmbeddedGraph::pinchOnKmers(vg::Index& ourIndex, EmbeddedGraph& other,
                 // Find the path the reverse complement is using.
                 auto& oldPath = (*reverse_kv).second;
                 
-                if(oldPath.size() == 0) {
+                if(oldPath.second == 0) {
                     // If it's in there with an empty minimal path, it's already
                     // a dupe. Do nothing.
-                } else if(paths_equal(oldPath, minimalPathRev)) {
+                } else if(pathsEqual(&uniqueKmerPaths.steps[oldPath.first], oldPath.second,
+                    minimalPathRev.data(), minimalPathRev.size())) {
                     // If it's in there with a nonempty minimal path and it
                     // matches the one for our reverse complement, do nothing.
                 } else {
                     // If it's in there with a nonempty minimal path and it
                     // doesn't match the one we just made, empty its path to
                     // mark it as a duplicate.
-                    oldPath.clear();
+                    oldPath.second = 0;
                     
 #ifdef debug
                     #pragma omp critical(cerr)
@@ -633,21 +1354,22 @@ void EmbeddedGraph::pinchOnKmers(vg::Index& ourIndex, EmbeddedGraph& other,
             // Make a reference to the path used.
             auto& oldPath = (*kv).second;
             
-            if(oldPath.size() == 0) {
+            if(oldPath.second == 0) {
                 // If it's in there with an empty minimal path, it's already a
                 // dupe. Do nothing.
-            } else if(paths_equal(oldPath, minimalPath)) {
+            } else if(pathsEqual(&uniqueKmerPaths.steps[oldPath.first], oldPath.second,
+                minimalPath.data(), minimalPath.size())) {
                 // If it's in there with a nonempty minimal path and it matches
                 // the one we just made, do nothing.
             } else {
                 // If it's in there with a nonempty minimal path and it doesn't match
                 // the one we just made, empty its path to mark it as a duplicate.
-                oldPath.clear();
+                oldPath.second = 0;
                 
-                if(reverse_kv != uniqueKmerPaths.end()) {
+                if(reverse_kv != uniqueKmerPaths.paths.end()) {
                     // The reverse complement is also in, so we need to
                     // clear it too.
-                    (*reverse_kv).second.clear();
+                    (*reverse_kv).second.second = 0;
                 }
                 
 #ifdef debug
@@ -658,78 +1380,64 @@ void EmbeddedGraph::pinchOnKmers(vg::Index& ourIndex, EmbeddedGraph& other,
         }
         
         // The lock guard automatically unlocks
-    
-    };
-    
-    // Enumerate kmers in one graph with for_each_kmer_parallel
-    graph.for_each_kmer_parallel(kmerSize, edgeMax, [&](std::string& kmer,
-        std::list<vg::NodeTraversal>::iterator occurrence, int offset,
-        std::list<vg::NodeTraversal>& path, vg::VG& kmer_graph) {
-        
-        // We receive each kmer, starting at the given offset from the left of
-        // the given traversal, along the given path.
-        
-        // Observe the kmer for us
-        observeKmer(kmer, occurrence, offset, path, ourIndex, ourUniqueKmerPaths, ourUniqueKmerPathsMutex);
-        
-    }, true, false); // Accept duplicate kmers, but not kmers with negative offsets.
-    
-    // Do the same for the other graph
-    other.graph.for_each_kmer_parallel(kmerSize, edgeMax, [&](std::string& kmer,
-        std::list<vg::NodeTraversal>::iterator occurrence, int offset,
-        std::list<vg::NodeTraversal>& path, vg::VG& kmer_graph) {
-        
-        // Observe the kmer for them
-        observeKmer(kmer, occurrence, offset, path, theirIndex, theirUniqueKmerPaths, theirUniqueKmerPathsMutex);
-        
-    }, true, false); // Accept duplicate kmers, but not kmers with negative offsets.
+    });
+}
+
+void EmbeddedGraph::pinchOnUniqueKmers(UniqueKmerPaths& ourUniqueKmerPaths, EmbeddedGraph& other,
+    UniqueKmerPaths& theirUniqueKmerPaths, size_t kmerSize) {
     
     // How many shared unique kmers do we find?
     size_t sharedUniqueKmers = 0;
     
+    // Places to flip kmers and paths around in, reused for every kmer
+    std::string reverseKmer;
+    std::vector<PathStep> theirPath;
+    
     // Then find the paths for corresponding kmers and merge on them.
-    for(auto& kv : ourUniqueKmerPaths) {
+    for(auto& kv : ourUniqueKmerPaths.paths) {
         // For each kmer, path pair
-        if(kv.second.empty()) {
+        if(kv.second.second == 0) {
             // This was really duplicated
             continue;
         }
+        PathCursor ourCursor = getPathCursor(&ourUniqueKmerPaths.steps[kv.second.first], kv.second.second);
         
         // Look up the forward and reverse versions
-        auto theirMatch = theirUniqueKmerPaths.find(kv.first);
-        auto theirReverseMatch = theirUniqueKmerPaths.find(vg::reverse_complement(kv.first));
+        auto theirMatch = theirUniqueKmerPaths.paths.find(kv.first);
+        KmerWalker::reverseComplement(kv.first, reverseKmer);
+        auto theirReverseMatch = theirUniqueKmerPaths.paths.find(reverseKmer);
         
-        if(theirMatch != theirUniqueKmerPaths.end()) {
+        if(theirMatch != theirUniqueKmerPaths.paths.end()) {
             // If the other graph has it, find out where
-            auto& theirPath = (*theirMatch).second;
+            auto& theirRun = (*theirMatch).second;
             
-            if(theirPath.empty()) {
+            if(theirRun.second == 0) {
                 // This was really duplicated
                 continue;
             }
             
             // Merge on the paths
-            pinchOnPaths(kv.second, other, theirPath);
+            pinchOnPaths(ourCursor, other, getPathCursor(&theirUniqueKmerPaths.steps[theirRun.first], theirRun.second));
             
 #ifdef debug
             std::cerr << "Mutually unique kmer " << kv.first << " pinched on." << std::endl;
 #endif
             sharedUniqueKmers++;
-            
-        } else if(theirReverseMatch != theirUniqueKmerPaths.end()) {
+        
+        } else if(theirReverseMatch != theirUniqueKmerPaths.paths.end()) {
             // If the other graph has it reverse complemented, find out where
-            auto& theirReversePath = (*theirReverseMatch).second;
+            auto& theirReverseRun = (*theirReverseMatch).second;
             
-            if(theirReversePath.empty()) {
+            if(theirReverseRun.second == 0) {
                 // This was really duplicated
                 continue;
             }
             
             // Flip it to be forward relative to us.
-            auto theirPath = other.reverse_path(theirReversePath);
+            reversePath(&theirUniqueKmerPaths.steps[theirReverseRun.first], theirReverseRun.second, theirPath);
             
             // Merge on the paths
-            pinchOnPaths(kv.second, other, theirPath);
+            pinchOnPaths(ourCursor, other, getPathCursor(theirPath.data(), theirPath.size()));
             
 #ifdef debug
             std::cerr << "RC-mutually unique kmer " << kv.first << " pinched on." << std::endl;
@@ -747,8 +1455,322 @@ void EmbeddedGraph::pinchOnKmers(vg::Index& ourIndex, EmbeddedGraph& other,
         std::cerr << "WARNING: no kmer pinches performed!" << std::endl;
     }
 }
+
+bool PathKmerSighting::isSamePlace(const PathKmerSighting& other) const {
+    return nodeId == other.nodeId && offset == other.offset && isReverse == other.isReverse;
+}
+
+void EmbeddedGraph::forEachPathKmer(size_t kmerSize, const SequenceStore& threadSequences,
+    const std::function<void(const PathKmerSighting&)>& iteratee) {
+    
+    if(kmerSize == 0 || kmerSize > 32) {
+        // Kmers have to fit in a 64-bit code
+        throw std::runtime_error("Path kmers must be from 1 to 32 bases long");
+    }
+    
+    validatePaths();
+    
+    // Cut all the paths up into chunks to scan in parallel
+    std::vector<const std::string*> pathNames;
+    std::vector<std::pair<size_t, int64_t>> chunks;
+    for(auto& kv : pathCache) {
+        int64_t pathLength = kv.second.starts.back();
+        for(int64_t start = 0; start < pathLength; start += PATH_CHUNK_LENGTH) {
+            chunks.emplace_back(pathNames.size(), start);
+        }
+        pathNames.push_back(&kv.first);
+    }
+    
+    uint64_t mask = kmerSize == 32 ? ~(uint64_t) 0 : ((uint64_t) 1 << (2 * kmerSize)) - 1;
+    
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t i = 0; i < chunks.size(); i++) {
+        const std::string& pathName = *pathNames[chunks[i].first];
+        const CachedPath& path = pathCache.at(pathName);
+        
+        // Spell out the chunk, plus enough after it to finish the kmers that
+        // start in it.
+        int64_t chunkStart = chunks[i].second;
+        int64_t chunkEnd = std::min(chunkStart + PATH_CHUNK_LENGTH, path.starts.back());
+        int64_t spellEnd = std::min(chunkEnd + (int64_t) kmerSize - 1, path.starts.back());
+        std::string sequence = spellPath(pathName, chunkStart, spellEnd, threadSequences);
+        
+        // Roll the codes for the kmer and its reverse complement along it
+        uint64_t code = 0;
+        uint64_t reverseCode = 0;
+        int64_t lastInvalid = chunkStart - 1;
+        
+        // The steps the current kmer starts and ends in
+        size_t firstStep = findPathStep(pathName, chunkStart);
+        size_t lastStep = firstStep;
+        
+        PathKmerSighting seen;
+        seen.pathName = &pathName;
+        
+        for(int64_t pathBase = chunkStart; pathBase < spellEnd; pathBase++) {
+            int base = KmerWalker::encodeBase(sequence[pathBase - chunkStart]);
+            if(base < 0) {
+                // Kmers can't cover this base
+                lastInvalid = pathBase;
+                base = 0;
+            }
+            code = ((code << 2) | base) & mask;
+            reverseCode = (reverseCode >> 2) | ((uint64_t) (3 - base) << (2 * (kmerSize - 1)));
+            
+            int64_t kmerStart = pathBase - (int64_t) kmerSize + 1;
+            if(kmerStart < chunkStart || kmerStart <= lastInvalid || code == reverseCode) {
+                // Either the kmer isn't all here, or it's no good to us
+                continue;
+            }
+            
+            while(path.starts[firstStep + 1] <= kmerStart) {
+                firstStep++;
+            }
+            while(path.starts[lastStep + 1] <= pathBase) {
+                lastStep++;
+            }
+            
+            seen.code = std::min(code, reverseCode);
+            seen.pathBase = kmerStart;
+            seen.pathReversed = reverseCode < code;
+            
+            // Find the base the kept orientation starts at: the kmer's first
+            // base, or its last base read the other way.
+            size_t stepIndex = seen.pathReversed ? lastStep : firstStep;
+            const PathStep& step = path.steps[stepIndex];
+            int64_t intoStep = (seen.pathReversed ? pathBase : kmerStart) - path.starts[stepIndex];
+            seen.nodeId = step.nodeId;
+            seen.offset = step.offset + (step.isReverse ? -intoStep : intoStep);
+            seen.isReverse = (step.isReverse != seen.pathReversed);
+            
+            iteratee(seen);
+        }
+    }
+}
+
+void EmbeddedGraph::getPathKmerSteps(const PathKmerSighting& sighting, size_t kmerSize,
+    std::vector<PathStep>& steps) {
     
+    // Clip the steps of the path it was seen on down to just the kmer
+    const CachedPath& path = pathCache.at(*sighting.pathName);
+    int64_t kmerStart = sighting.pathBase;
+    int64_t kmerEnd = kmerStart + kmerSize;
+    steps.clear();
+    for(size_t i = findPathStep(*sighting.pathName, kmerStart); i < path.steps.size() && path.starts[i] < kmerEnd;
+        i++) {
+        
+        PathStep step = path.steps[i];
+        int64_t clipStart = std::max(kmerStart - path.starts[i], (int64_t) 0);
+        int64_t clipEnd = std::min(kmerEnd - path.starts[i], step.length);
+        step.offset += step.isReverse ? -clipStart : clipStart;
+        step.length = clipEnd - clipStart;
+        steps.push_back(step);
+    }
     
+    if(sighting.pathReversed) {
+        // The path reads the other orientation, so flip the steps around in
+        // place.
+        std::reverse(steps.begin(), steps.end());
+        for(auto& step : steps) {
+            step.offset += step.isReverse ? -(step.length - 1) : step.length - 1;
+            step.isReverse = !step.isReverse;
+        }
+    }
+}
+
+void EmbeddedGraph::collectUniquePathKmers(UniqueKmerPaths& uniqueKmerPaths, size_t kmerSize,
+    const SequenceStore& threadSequences) {
+    
+    // Where a kmer was first seen, and whether it was also seen somewhere
+    // else
+    typedef std::pair<PathKmerSighting, bool> PathKmer;
+    
+    // Note down a place a kmer was seen. Seeing it again at the same place,
+    // from another path over the same nodes, doesn't count.
+    auto observe = [](std::unordered_map<uint64_t, PathKmer>& kmers, const PathKmer& seen) {
+        auto found = kmers.find(seen.first.code);
+        if(found == kmers.end()) {
+            kmers.emplace(seen.first.code, seen);
+        } else if(seen.second || !found->second.first.isSamePlace(seen.first)) {
+            found->second.second = true;
+        }
+    };
+    
+    // Each thread tallies the kmers in its chunks on its own
+    std::vector<std::unordered_map<uint64_t, PathKmer>> threadKmers(omp_get_max_threads());
+    
+    forEachPathKmer(kmerSize, threadSequences, [&](const PathKmerSighting& seen) {
+        observe(threadKmers.at(omp_get_thread_num()), std::make_pair(seen, false));
+    });
+    
+    // Put all the tallies together
+    auto& allKmers = threadKmers[0];
+    for(size_t i = 1; i < threadKmers.size(); i++) {
+        for(auto& kv : threadKmers[i]) {
+            observe(allKmers, kv.second);
+        }
+        
+        // Free as we go
+        threadKmers[i].clear();
+    }
+    
+    // Now pull out the steps for each unique kmer
+    std::string kmer(kmerSize, 'N');
+    std::vector<PathStep> minimalPath;
+    for(auto& kv : allKmers) {
+        if(kv.second.second) {
+            continue;
+        }
+        
+        // Spell the kmer from its code
+        for(size_t i = 0; i < kmerSize; i++) {
+            kmer[i] = "ACGT"[(kv.first >> (2 * (kmerSize - 1 - i))) & 3];
+        }
+        
+        getPathKmerSteps(kv.second.first, kmerSize, minimalPath);
+        
+        uniqueKmerPaths.paths[kmer] = std::make_pair(uniqueKmerPaths.steps.size(), minimalPath.size());
+        uniqueKmerPaths.steps.insert(uniqueKmerPaths.steps.end(), minimalPath.begin(), minimalPath.end());
+    }
+    
+    std::cerr << "Found " << uniqueKmerPaths.paths.size() << " unique " << kmerSize << "-mers on paths in " <<
+        name << "." << std::endl;
+}
+
+void EmbeddedGraph::pinchOnPathKmers(EmbeddedGraph& other, size_t kmerSize,
+    const SequenceStore& threadSequences, size_t memoryBudget, const std::string& scratchDirectory) {
+    
+    validatePaths();
+    other.validatePaths();
+    
+    // Guess how much the kmer tables would take: a hash table entry for every
+    // base along every path, at worst.
+    size_t pathBases = 0;
+    for(auto& kv : pathCache) {
+        pathBases += kv.second.starts.back();
+    }
+    for(auto& kv : other.pathCache) {
+        pathBases += kv.second.starts.back();
+    }
+    size_t tableBytes = pathBases * (sizeof(std::pair<uint64_t, std::pair<PathKmerSighting, bool>>) +
+        2 * sizeof(void*));
+    
+    if(memoryBudget == 0 || tableBytes <= memoryBudget) {
+        // Find the unique kmers along each graph's paths
+        UniqueKmerPaths ourUniqueKmerPaths;
+        collectUniquePathKmers(ourUniqueKmerPaths, kmerSize, threadSequences);
+        UniqueKmerPaths theirUniqueKmerPaths;
+        other.collectUniquePathKmers(theirUniqueKmerPaths, kmerSize, threadSequences);
+        
+        // And pinch on the ones they share
+        pinchOnUniqueKmers(ourUniqueKmerPaths, other, theirUniqueKmerPaths, kmerSize);
+        return;
+    }
+    
+    // A sighting, and which graph it was in
+    struct JoinSighting {
+        PathKmerSighting seen;
+        bool theirs;
+        
+        // Sort by code, with our sightings first
+        bool operator<(const JoinSighting& other) const {
+            return seen.code < other.seen.code || (seen.code == other.seen.code && theirs < other.theirs);
+        }
+    };
+    
+    std::cerr << "Sorting " << kmerSize << "-mers on paths in " << name << " and " << other.name <<
+        " through scratch files in " << scratchDirectory << "..." << std::endl;
+    
+    ExternalSorter<JoinSighting> sorter(scratchDirectory);
+    
+    // Each thread fills up its own run, and sorts and writes it out when it
+    // has used its share of the budget.
+    size_t threadCount = omp_get_max_threads();
+    size_t runRecords = std::max(memoryBudget / threadCount / sizeof(JoinSighting), (size_t) 1);
+    std::vector<std::vector<JoinSighting>> runs(threadCount);
+    std::vector<std::string> errors(threadCount);
+    
+    for(bool theirs : {false, true}) {
+        EmbeddedGraph& graph = theirs ? other : *this;
+        graph.forEachPathKmer(kmerSize, threadSequences, [&](const PathKmerSighting& seen) {
+            size_t thread = omp_get_thread_num();
+            if(!errors[thread].empty()) {
+                // We already couldn't write out a run
+                return;
+            }
+            runs[thread].push_back({seen, theirs});
+            if(runs[thread].size() >= runRecords) {
+                try {
+                    sorter.addRun(runs[thread]);
+                } catch(std::exception& e) {
+                    errors[thread] = e.what();
+                    runs[thread].clear();
+                }
+            }
+        });
+    }
+    for(auto& error : errors) {
+        if(!error.empty()) {
+            throw std::runtime_error(error);
+        }
+    }
+    for(auto& run : runs) {
+        sorter.addRun(run);
+    }
+    
+    std::cerr << "Merging " << sorter.size() << " sightings from " << sorter.runCount() << " runs..." << std::endl;
+    
+    // How many shared unique kmers do we find?
+    size_t sharedUniqueKmers = 0;
+    
+    // The first sighting of the current code in each graph, how many there
+    // were, and whether they were all at the same place
+    PathKmerSighting firstSeen[2];
+    size_t seenCount[2] = {0, 0};
+    bool repeated[2] = {false, false};
+    
+    std::vector<PathStep> ourPath;
+    std::vector<PathStep> theirPath;
+    
+    // Pinch on the current code, if it is unique in both graphs
+    auto finishCode = [&]() {
+        if(seenCount[0] > 0 && seenCount[1] > 0 && !repeated[0] && !repeated[1]) {
+            getPathKmerSteps(firstSeen[0], kmerSize, ourPath);
+            other.getPathKmerSteps(firstSeen[1], kmerSize, theirPath);
+            pinchOnPaths(getPathCursor(ourPath.data(), ourPath.size()), other,
+                getPathCursor(theirPath.data(), theirPath.size()));
+            sharedUniqueKmers++;
+        }
+        seenCount[0] = seenCount[1] = 0;
+        repeated[0] = repeated[1] = false;
+    };
+    
+    uint64_t currentCode = 0;
+    sorter.forEachSorted([&](const JoinSighting& sighting) {
+        if(sighting.seen.code != currentCode) {
+            finishCode();
+            currentCode = sighting.seen.code;
+        }
+        
+        size_t graph = sighting.theirs;
+        if(seenCount[graph] == 0) {
+            firstSeen[graph] = sighting.seen;
+        } else if(!firstSeen[graph].isSamePlace(sighting.seen)) {
+            repeated[graph] = true;
+        }
+        seenCount[graph]++;
+    });
+    finishCode();
+    
+    // Report to the user what happened.
+    std::cerr << "Pinched on " << sharedUniqueKmers << " shared unique " << kmerSize << "-mers." << std::endl;
+    
+    if(sharedUniqueKmers == 0) {
+        std::cerr << "WARNING: no kmer pinches performed!" << std::endl;
+    }
+}
+
+
 }
 
 
@@ -3,18 +3,132 @@
 
 #include <iostream>
 #include <map>
+#include <set>
+#include <string>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 #include "ekg/vg/vg.hpp"
 #include "ekg/vg/index.hpp"
+#include "ekg/vg/xg/xg.hpp"
 
-// Hack around stupid name mangling issues
-extern "C" {
-    #include "benedictpaten/pinchesAndCacti/inc/stPinchGraphs.h"
-}
+#include "pathStep.hpp"
+#include "gfa.hpp"
+#include "checkpoint.hpp"
+#include "pinchGraph.hpp"
+#include "sequenceStore.hpp"
 
 namespace coregraph {
 
+/**
+ * One run of bases along a path, in pinch thread coordinates. The run is on the
+ * thread with the given name, and covers
+ * length bases of the thread starting at start, and is read in reverse (from
+ * its last base to its first) if isReverse is set.
+ */
+struct ThreadStep {
+    int64_t thread;
+    int64_t start;
+    int64_t length;
+    bool isReverse;
+};
+
+/**
+ * A cursor that walks along a path as runs of thread bases. Fills in the next
+ * run and returns true, or returns false when the path is done.
+ */
+typedef std::function<bool(ThreadStep&)> ThreadCursor;
+
+/**
+ * The paths taken by unique kmers through a graph, by kmer sequence. The steps
+ * of all the paths are kept together in one pool, and each kmer has the start
+ * and length of its run of steps there. A kmer that was found to be
+ * duplicated has an empty run. Its steps stay in the pool until the whole
+ * thing is freed.
+ */
+struct UniqueKmerPaths {
+    // Where each kmer's path is in steps, as a start and a count
+    std::map<std::string, std::pair<size_t, size_t>> paths;
+    
+    // The steps of all the paths
+    std::vector<PathStep> steps;
+};
+
+/**
+ * One place a kmer was seen along a path, in whichever orientation of the kmer
+ * has the lower 2-bit code. Holds no pointers to anything but path names that
+ * stay put, so it can be written out to scratch files and read back.
+ */
+struct PathKmerSighting {
+    // The 2-bit code of the kept orientation, with the last base in the low
+    // bits
+    uint64_t code;
+    // Its first base, as read in the kept orientation, as a node, offset along
+    // the node's forward strand, and strand
+    int64_t nodeId;
+    int64_t offset;
+    bool isReverse;
+    // Whether the path reads it as the reverse complement of the code
+    bool pathReversed;
+    // The path it was seen on, and where along the path it starts
+    const std::string* pathName;
+    int64_t pathBase;
+    
+    /**
+     * Return true if this sighting and the other are of the same bases of the
+     * same node, even if they were seen from different paths.
+     */
+    bool isSamePlace(const PathKmerSighting& other) const;
+};
+
+/**
+ * Return the (from) length of a Mapping, even if that Mapping has no edits
+ * (and is implicitly a full-length perfect match). Requires a way to get the
+ * lengths of nodes in the graph that the Mapping is to.
+ */
+int64_t mappingLength(const vg::Mapping& mapping, const std::function<int64_t(int64_t)>& getNodeLength);
+
+/**
+ * How to embed a graph in a pinch graph, worked out ahead of time. Each node
+ * gets its own thread, and each edge gets a 2-base staple thread welded to the
+ * sides of the nodes it joins. Making a plan only reads the graph, so plans
+ * for several graphs can be made at once, each on many threads; only applying
+ * them to the pinch graph has to be done one at a time. A plan points into
+ * the graph it was made from, and must not outlive it.
+ */
+struct EmbeddingPlan {
+    EmbeddingPlan() = default;
+    
+    // A plan may point into itself, so it can't be copied or moved.
+    EmbeddingPlan(const EmbeddingPlan& other) = delete;
+    EmbeddingPlan& operator=(const EmbeddingPlan& other) = delete;
+    
+    // A staple for an edge, by the index of each node it joins, with the base
+    // of each node's thread it is welded to, and whether the weld is forward,
+    // in pinch graph terms
+    struct Staple {
+        size_t node1;
+        int64_t offset1;
+        bool strand1;
+        size_t node2;
+        int64_t offset2;
+        bool strand2;
+    };
+    
+    // The nodes, in the order their threads are made, with where each one's
+    // sequence is and how long it is
+    std::vector<int64_t> nodeIds;
+    std::vector<const char*> nodeSequences;
+    std::vector<size_t> nodeLengths;
+    
+    // The sequences, for graphs that don't keep them somewhere that stays put
+    std::string ownedSequences;
+    
+    // The staples, in the order they are made
+    std::vector<Staple> staples;
+};
+
 /**
  * Represents a vg graph that has been embedded in a pinch graph, as a series
  * of pinched-together threads.
@@ -22,35 +136,213 @@ namespace coregraph {
 class EmbeddedGraph {
 public:
     /**
-     * Construct an embedding of the given graph in the given thread set. Needs
+     * Construct an embedding of the given graph in the given pinch graph. Needs
      * a place to deposit the sequences for the new threads it creates, and a
      * function that can produce unique novel sequence names. Optionally, a
      * string name can be given to the graph, although the passed string does
-     * not need to outlive the graph (as it is copied).
+     * not need to outlive the graph (as it is copied). If a plan made from the
+     * graph with planEmbedding() is given, it is used; otherwise one is made.
+     */
+    EmbeddedGraph(vg::VG& graph, PinchGraph& pinchGraph, SequenceStore& threadSequences, 
+        std::function<int64_t(void)> getId, const std::string& name="", const EmbeddingPlan* plan = nullptr);
+    
+    /**
+     * Construct an embedding of the graph in the given xg index, in the given
+     * pinch graph. Nodes, edges, and paths are all read straight out of the
+     * index's succinct structures, so no vg::VG ever needs to be loaded. Kmer
+     * merging is not available for graphs embedded this way.
      */
-    EmbeddedGraph(vg::VG& graph, stPinchThreadSet* threadSet, std::map<int64_t, std::string>& threadSequences, 
-        std::function<int64_t(void)> getId, const std::string& name="");
+    EmbeddedGraph(xg::XG& index, PinchGraph& pinchGraph, SequenceStore& threadSequences, 
+        std::function<int64_t(void)> getId, const std::string& name="", const EmbeddingPlan* plan = nullptr);
+    
+    /**
+     * Construct an embedding of a graph loaded from a GFA file, in the given
+     * pinch graph. Kmer merging is not available for graphs embedded this way.
+     */
+    EmbeddedGraph(GFAGraph& gfa, PinchGraph& pinchGraph, SequenceStore& threadSequences, 
+        std::function<int64_t(void)> getId, const std::string& name="", const EmbeddingPlan* plan = nullptr);
+    
+    /**
+     * Plan the embedding of a vg graph, filling in the given empty plan.
+     */
+    static void planEmbedding(vg::VG& graph, EmbeddingPlan& plan);
+    
+    /**
+     * Plan the embedding of the graph in an xg index, filling in the given
+     * empty plan. The nodes' sequences and edges are pulled out of the index
+     * in parallel.
+     */
+    static void planEmbedding(xg::XG& index, EmbeddingPlan& plan);
+    
+    /**
+     * Plan the embedding of a GFA graph, filling in the given empty plan. The
+     * sequences are left in the GFA file's memory mapping.
+     */
+    static void planEmbedding(GFAGraph& gfa, EmbeddingPlan& plan);
+    
+    /**
+     * Copy an embedding into a copy of the pinch graph it is embedded in,
+     * which must have all the same threads. The copy shares the other's
+     * source graph, and keeps its checked paths, so they aren't checked
+     * again.
+     */
+    EmbeddedGraph(const EmbeddedGraph& other, PinchGraph& pinchGraph);
+    
+    /**
+     * Load an embedding saved with save(), for threads that have already been
+     * remade in the given pinch graph. The graph's paths are loaded too, so it
+     * can be pinched on paths and have its paths projected, but it has no
+     * source graph until one is attached with attachGraph().
+     */
+    EmbeddedGraph(CheckpointReader& in, PinchGraph& pinchGraph);
+    
+    /**
+     * Save the graph's name, its embedding, and all its paths as steps, for
+     * loading back after the pinch graph is remade from a checkpoint.
+     */
+    void save(CheckpointWriter& out);
+    
+    /**
+     * Attach the vg graph that a graph loaded from a checkpoint came from, so
+     * that it can be merged on kmers. It must have the same nodes as the
+     * graph that was saved.
+     */
+    void attachGraph(vg::VG& graph);
+    
+    /**
+     * Stop depending on the graph, index, or GFA file this graph came from, so
+     * that it can be freed. The paths are checked and cached first, and node
+     * lengths come from the threads, so the graph can still be pinched on
+     * paths, saved, and have its paths projected afterward. It can't be
+     * merged on kmers unless a vg graph is attached again.
+     */
+    void releaseSource();
     
     /**
      * Trace out common paths between this embedded graph and the other graph
-     * embedded in the same stPinchThreadSet and pinch together.
+     * embedded in the same PinchGraph and pinch together.
+     *
+     * If pathsDone is given, paths named in it are skipped, and the paths
+     * that get pinched are added to it. That way a graph can be pinched
+     * against several others that are already pinched together, without
+     * tracing any path more than once.
+     *
+     * If threadSequences is given, each shared path is also checked to spell
+     * out the same sequence in both graphs before it is pinched.
      */
-    void pinchWith(EmbeddedGraph& other);
+    void pinchWith(EmbeddedGraph& other, std::set<std::string>* pathsDone = nullptr,
+        const SequenceStore* threadSequences = nullptr);
     
     /**
      * Merge this embedded graph with another on shared unique kmers. Takes two
      * indexes. kmerSize gives the length of kmers to look for/generate, and
-     * edgeMax gives the max number of choice points in a kmer's kpath.
+     * kmers that pass through edgeMax or more choice points are skipped,
+     * unless it is 0.
      */
     void pinchOnKmers(vg::Index& ourIndex, EmbeddedGraph& other, vg::Index& theirIndex,
         size_t kmerSize=1, size_t edgeMax=0);
     
+    /**
+     * Find the kmers in this graph that are unique according to its index,
+     * and fill in the given map with the path each takes through the graph.
+     * Kmers that turn out to be duplicated get empty paths. The result only
+     * depends on the graph, not the pinch graph, so it can be kept and used
+     * again with another embedding of the same graph.
+     */
+    void collectUniqueKmers(vg::Index& index, UniqueKmerPaths& uniqueKmerPaths,
+        size_t kmerSize=1, size_t edgeMax=0);
+    
+    /**
+     * Pinch this graph with another on the kmers that are unique in both,
+     * given the unique kmers found in each with collectUniqueKmers().
+     */
+    void pinchOnUniqueKmers(UniqueKmerPaths& ourUniqueKmerPaths, EmbeddedGraph& other,
+        UniqueKmerPaths& theirUniqueKmerPaths, size_t kmerSize);
+    
+    /**
+     * Find the kmers along this graph's paths that are unique among all the
+     * places the paths go, counting each kmer together with its reverse
+     * complement, and fill in the given map with the steps each takes. Each
+     * kmer is kept in whichever orientation spells out first alphabetically.
+     *
+     * Paths are spelled once, in chunks, from the given thread sequences, and
+     * each chunk's kmers are read off in one linear pass, so this takes time
+     * in proportion to the total path length. It needs no index, and works
+     * on graphs from any kind of input, but only sees kmers on paths. Kmers
+     * can be at most 32 bases; kmers with anything but ACGT in them, or that
+     * are their own reverse complements, are skipped.
+     */
+    void collectUniquePathKmers(UniqueKmerPaths& uniqueKmerPaths, size_t kmerSize,
+        const SequenceStore& threadSequences);
+    
+    /**
+     * Merge this embedded graph with another on the kmers that are unique
+     * along the paths of each, as found by collectUniquePathKmers().
+     *
+     * If a memory budget in bytes is given and the kmer tables for both
+     * graphs would not fit in it, the tables aren't built. Instead every
+     * sighting of every kmer in both graphs is sorted by code through scratch
+     * files in the given directory, and the sorted sightings are read back
+     * once, pinching on each code seen at just one place in each graph.
+     */
+    void pinchOnPathKmers(EmbeddedGraph& other, size_t kmerSize,
+        const SequenceStore& threadSequences, size_t memoryBudget = 0,
+        const std::string& scratchDirectory = ".");
+    
+    /**
+     * Merge this embedded graph with another along alignments of stretches of
+     * this graph's paths to the other graph, like vg map makes. Each alignment
+     * must be named for the path its sequence came from, as PATH if it starts
+     * at the start of the path, or as PATH:START-END with 0-based,
+     * end-exclusive path coordinates. Only bases that match are pinched;
+     * mismatches, insertions, and deletions are stepped over. The pinches for
+     * all the alignments are worked out in parallel, and then made in order.
+     *
+     * Throws std::runtime_error if an alignment isn't named for a path here,
+     * runs off the end of its path, or visits a node the other graph doesn't
+     * have. Returns the number of bases pinched.
+     */
+    size_t pinchOnAlignments(const std::vector<vg::Alignment>& alignments, size_t count, EmbeddedGraph& other);
+    
+    /**
+     * Call the given function with the name of each path in this graph, and a
+     * cursor that walks along the path through the threads the graph is
+     * embedded in. The cursors are only good during the call.
+     */
+    void forEachThreadPath(const std::function<void(const std::string&, ThreadCursor)>& iteratee);
+    
+    /**
+     * Check all the paths in one parallel pass, and cache their steps and
+     * where along the path each step starts. Also works out which nodes are
+     * on paths. Throws std::runtime_error if any path has a mapping that isn't
+     * a perfect match, or visits a node that isn't in the graph. Only does
+     * anything the first time it is called; everything that walks along
+     * named paths calls it, and then uses the cache.
+     */
+    void validatePaths();
+    
     /**
      * Compute whether this graph is covered by paths, or whether any nodes
      * exist that aren't on some path.
      */
     bool isCoveredByPaths();
     
+    /**
+     * Check that the named path spells out the same sequence in this graph and
+     * the other, given the sequences of the threads both are embedded in.
+     * Throws std::runtime_error at the first mismatch, or if the path lengths
+     * differ.
+     */
+    void checkPathSequence(const std::string& pathName, EmbeddedGraph& other,
+        const SequenceStore& threadSequences);
+    
+    /**
+     * Return true if pinchWith() has zipped up the named path with the path of
+     * the same name in another graph, so that both copies run through the same
+     * blocks.
+     */
+    bool isPathPinched(const std::string& pathName);
+    
     /**
      * Return the name of the graph.
      */
@@ -66,51 +358,164 @@ public:
 protected:
 
     /**
-     * Scan along a path, and ensure that it is all perfect mappings. Returns
-     * the total length. The passed path must be part of this graph, not another
-     * graph.
+     * Fill in the staples of a plan that has its nodes, given each edge as
+     * from node, from start, to node, and to end. The staples are worked out
+     * in parallel. Throws std::runtime_error if an edge touches a node that
+     * isn't there.
+     */
+    static void planStaples(const std::vector<std::tuple<int64_t, bool, int64_t, bool>>& edges,
+        EmbeddingPlan& plan);
+    
+    /**
+     * Make the threads and staples of a plan in the pinch graph, one at a
+     * time, and remember where each node went.
+     */
+    void applyPlan(const EmbeddingPlan& plan, SequenceStore& threadSequences, std::function<int64_t(void)>& getId);
+    
+    /**
+     * Get the length of a node in this graph.
      */
-    size_t scanPath(std::list<vg::Mapping>& path);
+    int64_t getNodeLength(int64_t nodeId);
+    
+    /**
+     * Get the names of all the paths in this graph.
+     */
+    std::set<std::string> getPathNames();
+    
+    /**
+     * Get a cursor that walks along the named path in this graph, from the
+     * cache made by validatePaths().
+     */
+    PathCursor getPathCursor(const std::string& pathName);
+    
+    /**
+     * Get a cursor that walks along the named path in whatever graph this
+     * graph came from, without using the cache.
+     */
+    PathCursor getSourcePathCursor(const std::string& pathName);
+    
+    /**
+     * Get a cursor that walks along the given run of steps in this graph. The
+     * steps must outlive the cursor.
+     */
+    static PathCursor getPathCursor(const PathStep* steps, size_t count);
+    
+    /**
+     * Find the index of the step in the named cached path that the given path
+     * base falls in, by binary search on where the steps start.
+     */
+    size_t findPathStep(const std::string& pathName, int64_t pathBase);
+    
+    /**
+     * Spell out the sequence of the given range of path bases along a cached
+     * path, from the sequences of the threads we are embedded in.
+     */
+    std::string spellPath(const std::string& pathName, int64_t start, int64_t end,
+        const SequenceStore& threadSequences);
+    
+    /**
+     * Call the given function with each sighting of each kmer along this
+     * graph's paths, spelling the paths in chunks from the given thread
+     * sequences and scanning the chunks in parallel. The function is called on
+     * several threads at once, and must not throw. Kmers can be at most 32
+     * bases; kmers with anything but ACGT in them, or that are their own
+     * reverse complements, are skipped.
+     */
+    void forEachPathKmer(size_t kmerSize, const SequenceStore& threadSequences,
+        const std::function<void(const PathKmerSighting&)>& iteratee);
+    
+    /**
+     * Fill in the steps covering just the bases of a kmer seen along one of
+     * this graph's paths, in the orientation its code spells, replacing the
+     * contents of the given vector.
+     */
+    void getPathKmerSteps(const PathKmerSighting& sighting, size_t kmerSize, std::vector<PathStep>& steps);
     
     /**
      * Pinch this graph witht he other graph along two corresponding paths.
      */
-    void pinchOnPaths(std::list<vg::Mapping>& path, EmbeddedGraph& other, 
-        std::list<vg::Mapping>& otherPath);
+    void pinchOnPaths(PathCursor path, EmbeddedGraph& other, PathCursor otherPath);
+    
+    /**
+     * Pinch this graph with the other graph along a path they share, which must
+     * have the same length in both. Uses the cached paths to cut the path into
+     * ranges that are zipped up in parallel.
+     */
+    void pinchOnSharedPath(const std::string& pathName, EmbeddedGraph& other);
+    
+    // A pinch to do between two threads, in pinch graph terms
+    struct PinchOp {
+        int64_t thread1;
+        int64_t thread2;
+        int64_t start1;
+        int64_t start2;
+        int64_t length;
+        bool strand;
+    };
     
     /**
-     * Turn a kmer that starts at a certain position along a kpath into a list
-     * of Mappings covering only the bases in the kmer.
+     * Work out the pinch that joins up the overlapping bases of a step in this
+     * graph and a step in the other graph. Each step starts at the given path
+     * base, and the overlap covers the given range of path bases.
      */
-    static std::list<vg::Mapping> makeMinimalPath(std::string& kmer,
-        std::list<vg::NodeTraversal>::iterator occurrence, int offset,
-        std::list<vg::NodeTraversal>& path);
-        
+    PinchOp findPinch(const PathStep& ourStep, int64_t ourPathBase, EmbeddedGraph& other,
+        const PathStep& theirStep, int64_t theirPathBase, int64_t overlapStart, int64_t overlapLength);
+    
     /**
-     * Reverse a path in this graph, to spell out the path of the reverse
-     * complement sequence.
+     * Reverse a run of steps, to spell out the path of the reverse complement
+     * sequence, replacing the contents of the given vector.
      */
-    std::list<vg::Mapping> reverse_path(std::list<vg::Mapping> path);
-        
+    static void reversePath(const PathStep* steps, size_t count, std::vector<PathStep>& reversed);
+    
     /**
-     * Return true if the two given paths, generated by makeMinimalPath(), are
+     * Return true if the two given runs of steps, as made for kmers, are
      * equal, and false otherwise.
      */
-    static bool paths_equal(std::list<vg::Mapping>& path1, std::list<vg::Mapping>& path2);
-
-    // The graph we came from (which keeps track of the path data)
-    vg::VG& graph;
-
-    // The thread set that the graph is embedded in.
-    stPinchThreadSet* threadSet;
+    static bool pathsEqual(const PathStep* steps1, size_t count1, const PathStep* steps2, size_t count2);
+    
+    // The graph we came from (which keeps track of the path data), if we
+    // came from a vg graph.
+    vg::VG* graph = nullptr;
+    
+    // The xg index we came from, if we came from an xg index.
+    xg::XG* index = nullptr;
     
-    // The embedding, mapping from xg node ID to thread, start base,
+    // The GFA graph we came from, if we came from a GFA file.
+    GFAGraph* gfa = nullptr;
+    
+    // The paths, if we were loaded from a checkpoint and have no source graph.
+    std::map<std::string, std::vector<PathStep>> savedPaths;
+    
+    // A path that has been checked by validatePaths(), with the path base at
+    // which each step starts. The starts have the path length on the end.
+    struct CachedPath {
+        std::vector<PathStep> steps;
+        std::vector<int64_t> starts;
+    };
+    
+    // The checked paths, by name, once validatePaths() has run
+    std::map<std::string, CachedPath> pathCache;
+    bool pathsValidated = false;
+    
+    // Whether every node is on a path, as worked out by validatePaths()
+    bool coveredByPaths = false;
+    
+    // The paths that pinchWith() has zipped up with another graph's
+    std::set<std::string> pinchedPaths;
+    
+    // The pinch graph that the graph is embedded in.
+    PinchGraph& pinchGraph;
+    
+    // The embedding, mapping from xg node ID to thread name, start base,
     // is reverse
-    std::map<int64_t, std::tuple<stPinchThread*, int64_t, bool>> embedding;
+    std::map<int64_t, std::tuple<int64_t, int64_t, bool>> embedding;
     
     // This is the name we carry around. We keep our own copy.
     std::string name;
     
+    // How many bases of a path to zip up or check at a time on each thread
+    const static int64_t PATH_CHUNK_LENGTH = 1 << 20;
+    
     // How many bytes can there be in the RocksDB estimate of a kmer size for us
     // to get all the occurrences and actually count them, to see if it's
     // unique?
@@ -0,0 +1,167 @@
+#ifndef COREGRAPH_EXTERNALSORTER_HPP
+#define COREGRAPH_EXTERNALSORTER_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "mappedFile.hpp"
+
+namespace coregraph {
+
+/**
+ * Sorts more fixed-size records than fit in memory. Records are handed over in
+ * batches, and each batch is sorted and written out to a scratch file as a
+ * run. Then the runs are mapped back in and merged, a record at a time, with a
+ * heap over the fronts of the runs. Records are written out as raw bytes, so
+ * they have to be trivially copyable, and anything they point to has to stay
+ * put until the sort is done.
+ */
+template<typename Record, typename Compare = std::less<Record>>
+class ExternalSorter {
+    static_assert(std::is_trivially_copyable<Record>::value, "Records must be trivially copyable");
+public:
+    
+    /**
+     * Make a sorter that writes its runs to scratch files in the given
+     * directory.
+     */
+    ExternalSorter(const std::string& scratchDirectory, Compare compare = Compare()):
+        scratchDirectory(scratchDirectory), compare(compare) {
+        // Nothing to do
+    }
+    
+    /**
+     * Remove all the runs.
+     */
+    ~ExternalSorter() {
+        for(auto& filename : runFiles) {
+            std::remove(filename.c_str());
+        }
+    }
+    
+    // We own the run files, so we can't be copied.
+    ExternalSorter(const ExternalSorter& other) = delete;
+    ExternalSorter& operator=(const ExternalSorter& other) = delete;
+    
+    /**
+     * Sort the given records and write them out as a run, leaving the vector
+     * empty. Safe to call from several threads at once.
+     */
+    void addRun(std::vector<Record>& records) {
+        if(records.empty()) {
+            return;
+        }
+        
+        std::sort(records.begin(), records.end(), compare);
+        
+        std::string filename = makeScratchFile(scratchDirectory);
+        std::ofstream out(filename, std::ios::binary);
+        out.write((const char*) records.data(), records.size() * sizeof(Record));
+        out.close();
+        if(!out.good()) {
+            std::remove(filename.c_str());
+            throw std::runtime_error("Could not write scratch file " + filename);
+        }
+        
+        {
+            std::lock_guard<std::mutex> guard(runLock);
+            runFiles.push_back(filename);
+            recordCount += records.size();
+        }
+        
+        records.clear();
+    }
+    
+    /**
+     * Call the given function with every record added so far, in sorted
+     * order.
+     */
+    void forEachSorted(const std::function<void(const Record&)>& iteratee) {
+        // Map in all the runs. Each is read front to back.
+        std::vector<std::unique_ptr<MappedFile>> runs;
+        for(auto& filename : runFiles) {
+            runs.emplace_back(new MappedFile(filename));
+        }
+        
+        // Get the record at a position in a run. Copy it out, since the
+        // mapping need not be aligned for it.
+        auto getRecord = [&](size_t run, size_t index) {
+            Record record;
+            memcpy(&record, runs[run]->data() + index * sizeof(Record), sizeof(Record));
+            return record;
+        };
+        
+        // Keep a heap of the next record from each run, with the run it came
+        // from, smallest on top.
+        typedef std::pair<Record, size_t> Front;
+        auto later = [&](const Front& a, const Front& b) {
+            return compare(b.first, a.first);
+        };
+        std::priority_queue<Front, std::vector<Front>, decltype(later)> fronts(later);
+        std::vector<size_t> nextIndex(runs.size(), 0);
+        
+        for(size_t i = 0; i < runs.size(); i++) {
+            if(runs[i]->size() > 0) {
+                fronts.emplace(getRecord(i, 0), i);
+                nextIndex[i] = 1;
+            }
+        }
+        
+        while(!fronts.empty()) {
+            Front front = fronts.top();
+            fronts.pop();
+            
+            iteratee(front.first);
+            
+            size_t run = front.second;
+            if(nextIndex[run] * sizeof(Record) < runs[run]->size()) {
+                // Bring up the next record from the same run
+                fronts.emplace(getRecord(run, nextIndex[run]), run);
+                nextIndex[run]++;
+            }
+        }
+    }
+    
+    /**
+     * Get the number of records added so far.
+     */
+    size_t size() const {
+        return recordCount;
+    }
+    
+    /**
+     * Get the number of runs written so far.
+     */
+    size_t runCount() const {
+        return runFiles.size();
+    }
+
+protected:
+    // Where to put the runs
+    std::string scratchDirectory;
+    
+    // How to order records
+    Compare compare;
+    
+    // The scratch files holding the runs, and how many records they hold
+    std::vector<std::string> runFiles;
+    size_t recordCount = 0;
+    
+    // A lock for adding runs
+    std::mutex runLock;
+};
+
+}
+
+#endif
@@ -0,0 +1,306 @@
+#include "gfa.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <omp.h>
+
+namespace coregraph {
+
+/**
+ * Cut the next tab-separated field off the front of a GFA line, and advance the
+ * cursor past it and its tab. Returns the start and past-the-end pointers of
+ * the field, which are equal if the line has run out.
+ */
+std::pair<const char*, const char*> nextGFAField(const char*& cursor, const char* lineEnd) {
+    const char* fieldStart = cursor;
+    const char* fieldEnd = (const char*) memchr(cursor, '\t', lineEnd - cursor);
+    if(fieldEnd == nullptr) {
+        // This is the last field on the line
+        fieldEnd = lineEnd;
+        cursor = lineEnd;
+    } else {
+        cursor = fieldEnd + 1;
+    }
+    return std::make_pair(fieldStart, fieldEnd);
+}
+
+/**
+ * Parse a GFA segment name as a node ID. The field isn't null-terminated, so
+ * we can't use the C library.
+ */
+int64_t parseGFAId(const char* start, const char* end) {
+    if(start == end) {
+        throw std::runtime_error("Empty GFA segment name");
+    }
+    int64_t id = 0;
+    for(const char* digit = start; digit != end; ++digit) {
+        if(*digit < '0' || *digit > '9') {
+            throw std::runtime_error("GFA segment name " + std::string(start, end) + " is not a number");
+        }
+        id = id * 10 + (*digit - '0');
+    }
+    return id;
+}
+
+/**
+ * Parse a GFA orientation field. Returns true for reverse and false for forward.
+ */
+bool parseGFAOrientation(const char* start, const char* end) {
+    if(end - start != 1 || (*start != '+' && *start != '-')) {
+        throw std::runtime_error("Bad GFA orientation " + std::string(start, end));
+    }
+    return *start == '-';
+}
+
+GFAGraph::GFAGraph(const std::string& filename): file(filename) {
+
+    const char* data = file.data();
+    size_t size = file.size();
+
+    // These are the records parsed out of one run of lines, before they are
+    // stitched together in file order.
+    struct Chunk {
+        std::vector<Segment> segments;
+        std::vector<Link> links;
+        // Paths are kept as names and node visits until we know node lengths.
+        std::vector<std::pair<std::string, std::vector<std::pair<int64_t, bool>>>> paths;
+        // If parsing failed, why. We can't throw out of an OpenMP loop.
+        std::string error;
+    };
+
+    // Split the file up into one run of whole lines per thread. Each run
+    // starts at the first line start at or after its even share of the file.
+    size_t chunkCount = std::max(1, omp_get_max_threads());
+    std::vector<size_t> chunkStarts{0};
+    for(size_t i = 1; i < chunkCount; i++) {
+        size_t start = std::max(size * i / chunkCount, chunkStarts.back());
+        if(start > 0 && start < size && data[start - 1] != '\n') {
+            // Move up to the start of the next line
+            const char* newline = (const char*) memchr(data + start, '\n', size - start);
+            start = newline == nullptr ? size : newline - data + 1;
+        }
+        chunkStarts.push_back(start);
+    }
+    chunkStarts.push_back(size);
+
+    std::vector<Chunk> chunks(chunkCount);
+
+    #pragma omp parallel for schedule(static, 1)
+    for(size_t i = 0; i < chunkCount; i++) {
+        Chunk& chunk = chunks[i];
+        const char* lineStart = data + chunkStarts[i];
+        const char* end = data + chunkStarts[i + 1];
+
+        try {
+            while(lineStart < end) {
+                // Find the end of the line and where the next one starts
+                const char* lineEnd = (const char*) memchr(lineStart, '\n', end - lineStart);
+                if(lineEnd == nullptr) {
+                    lineEnd = end;
+                }
+                const char* nextLine = lineEnd == end ? end : lineEnd + 1;
+                if(lineEnd > lineStart && *(lineEnd - 1) == '\r') {
+                    // Tolerate DOS line endings
+                    lineEnd--;
+                }
+
+                const char* cursor = lineStart;
+                auto type = nextGFAField(cursor, lineEnd);
+
+                if(type.second - type.first == 1 && *type.first == 'S') {
+                    // A segment: name and sequence
+                    auto name = nextGFAField(cursor, lineEnd);
+                    auto sequence = nextGFAField(cursor, lineEnd);
+                    if(sequence.first == sequence.second || (sequence.second - sequence.first == 1 && *sequence.first == '*')) {
+                        throw std::runtime_error("GFA segment " + std::string(name.first, name.second) + " has no sequence");
+                    }
+                    chunk.segments.push_back(Segment{parseGFAId(name.first, name.second),
+                        sequence.first, (size_t) (sequence.second - sequence.first)});
+                } else if(type.second - type.first == 1 && *type.first == 'L') {
+                    // A link: from, orientation, to, orientation, overlap
+                    auto from = nextGFAField(cursor, lineEnd);
+                    auto fromOrientation = nextGFAField(cursor, lineEnd);
+                    auto to = nextGFAField(cursor, lineEnd);
+                    auto toOrientation = nextGFAField(cursor, lineEnd);
+                    auto overlap = nextGFAField(cursor, lineEnd);
+                    std::string overlapString(overlap.first, overlap.second);
+                    if(!overlapString.empty() && overlapString != "*" && overlapString != "0M") {
+                        throw std::runtime_error("GFA link with overlap " + overlapString + " is not supported");
+                    }
+                    // Leaving a reverse node means leaving its start, and
+                    // entering a reverse node means entering its end.
+                    chunk.links.push_back(Link{parseGFAId(from.first, from.second),
+                        parseGFAOrientation(fromOrientation.first, fromOrientation.second),
+                        parseGFAId(to.first, to.second),
+                        parseGFAOrientation(toOrientation.first, toOrientation.second)});
+                } else if(type.second - type.first == 1 && *type.first == 'P') {
+                    // A path: name and comma-separated oriented segment names
+                    auto name = nextGFAField(cursor, lineEnd);
+                    auto visits = nextGFAField(cursor, lineEnd);
+                    chunk.paths.emplace_back(std::string(name.first, name.second),
+                        std::vector<std::pair<int64_t, bool>>());
+                    auto& pathVisits = chunk.paths.back().second;
+
+                    const char* visitStart = visits.first;
+                    while(visitStart < visits.second) {
+                        const char* visitEnd = (const char*) memchr(visitStart, ',', visits.second - visitStart);
+                        if(visitEnd == nullptr) {
+                            visitEnd = visits.second;
+                        }
+                        if(visitEnd - visitStart < 2) {
+                            throw std::runtime_error("Bad GFA path step " + std::string(visitStart, visitEnd));
+                        }
+                        // The orientation is the last character
+                        pathVisits.emplace_back(parseGFAId(visitStart, visitEnd - 1),
+                            parseGFAOrientation(visitEnd - 1, visitEnd));
+                        visitStart = visitEnd + 1;
+                    }
+                }
+                // Everything else (headers, comments, containments) is skipped.
+
+                lineStart = nextLine;
+            }
+        } catch(std::runtime_error& e) {
+            chunk.error = e.what();
+        }
+    }
+
+    // Stitch the chunks together in order.
+    size_t totalSegments = 0;
+    size_t totalLinks = 0;
+    for(auto& chunk : chunks) {
+        if(!chunk.error.empty()) {
+            throw std::runtime_error("Could not parse " + filename + ": " + chunk.error);
+        }
+        totalSegments += chunk.segments.size();
+        totalLinks += chunk.links.size();
+    }
+    segments.reserve(totalSegments);
+    segmentIndex.reserve(totalSegments);
+    links.reserve(totalLinks);
+
+    for(auto& chunk : chunks) {
+        for(auto& segment : chunk.segments) {
+            if(segmentIndex.count(segment.id)) {
+                throw std::runtime_error("Duplicate GFA segment " + std::to_string(segment.id) + " in " + filename);
+            }
+            segmentIndex[segment.id] = segments.size();
+            segments.push_back(segment);
+        }
+        links.insert(links.end(), chunk.links.begin(), chunk.links.end());
+
+        // Free as we go
+        chunk.segments.clear();
+        chunk.segments.shrink_to_fit();
+        chunk.links.clear();
+        chunk.links.shrink_to_fit();
+    }
+
+    for(auto& link : links) {
+        if(!segmentIndex.count(link.from) || !segmentIndex.count(link.to)) {
+            throw std::runtime_error("GFA link to missing segment in " + filename);
+        }
+    }
+
+    for(auto& chunk : chunks) {
+        for(auto& namedPath : chunk.paths) {
+            if(paths.count(namedPath.first)) {
+                throw std::runtime_error("Duplicate GFA path " + namedPath.first + " in " + filename);
+            }
+
+            // Now we can work out how long each step is
+            auto& steps = paths[namedPath.first];
+            steps.reserve(namedPath.second.size());
+            for(auto& visit : namedPath.second) {
+                auto found = segmentIndex.find(visit.first);
+                if(found == segmentIndex.end()) {
+                    throw std::runtime_error("GFA path " + namedPath.first + " visits missing segment " +
+                        std::to_string(visit.first));
+                }
+                int64_t length = segments[found->second].length;
+                // Reverse steps start from the last base of the node
+                steps.push_back(PathStep{visit.first, visit.second ? length - 1 : 0, visit.second, length});
+            }
+        }
+    }
+}
+
+void GFAGraph::forEachNode(const std::function<void(int64_t, const std::string&)>& iteratee) const {
+    std::string sequence;
+    for(auto& segment : segments) {
+        sequence.assign(segment.sequence, segment.length);
+        iteratee(segment.id, sequence);
+    }
+}
+
+void GFAGraph::forEachNodeData(const std::function<void(int64_t, const char*, size_t)>& iteratee) const {
+    for(auto& segment : segments) {
+        iteratee(segment.id, segment.sequence, segment.length);
+    }
+}
+
+void GFAGraph::forEachEdge(const std::function<void(const vg::Edge&)>& iteratee) const {
+    vg::Edge edge;
+    for(auto& link : links) {
+        edge.set_from(link.from);
+        edge.set_from_start(link.fromStart);
+        edge.set_to(link.to);
+        edge.set_to_end(link.toEnd);
+        iteratee(edge);
+    }
+}
+
+size_t GFAGraph::nodeCount() const {
+    return segments.size();
+}
+
+int64_t GFAGraph::getNodeLength(int64_t nodeId) const {
+    return segments[segmentIndex.at(nodeId)].length;
+}
+
+std::string GFAGraph::getNodeSequence(int64_t nodeId) const {
+    auto& segment = segments[segmentIndex.at(nodeId)];
+    return std::string(segment.sequence, segment.length);
+}
+
+std::vector<vg::Edge> GFAGraph::edgesOf(int64_t nodeId) {
+    if(linkIndex.empty() && !links.empty()) {
+        // Index all the links by both their ends
+        linkIndex.reserve(links.size() * 2);
+        for(size_t i = 0; i < links.size(); i++) {
+            linkIndex.emplace(links[i].from, i);
+            if(links[i].to != links[i].from) {
+                linkIndex.emplace(links[i].to, i);
+            }
+        }
+    }
+
+    std::vector<vg::Edge> edges;
+    auto range = linkIndex.equal_range(nodeId);
+    for(auto found = range.first; found != range.second; ++found) {
+        auto& link = links[found->second];
+        edges.emplace_back();
+        edges.back().set_from(link.from);
+        edges.back().set_from_start(link.fromStart);
+        edges.back().set_to(link.to);
+        edges.back().set_to_end(link.toEnd);
+    }
+    return edges;
+}
+
+std::set<std::string> GFAGraph::getPathNames() const {
+    std::set<std::string> pathNames;
+    for(auto& kv : paths) {
+        pathNames.insert(kv.first);
+    }
+    return pathNames;
+}
+
+const std::vector<PathStep>& GFAGraph::getPath(const std::string& pathName) const {
+    return paths.at(pathName);
+}
+
+}
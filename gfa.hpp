@@ -0,0 +1,123 @@
+#ifndef COREGRAPH_GFA_HPP
+#define COREGRAPH_GFA_HPP
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ekg/vg/vg.hpp"
+
+#include "mappedFile.hpp"
+#include "pathStep.hpp"
+
+namespace coregraph {
+
+/**
+ * A graph read from a GFA file. Only S (segment), L (link), and P (path)
+ * records are used; everything else is skipped. Segment names must be
+ * integers, since they become node IDs, and links may not have overlaps.
+ *
+ * Segment sequences are not copied out of the file; they point into its
+ * memory mapping, which lives as long as the GFAGraph does.
+ */
+class GFAGraph {
+public:
+    /**
+     * Load the given GFA file. The file is mapped into memory, split into
+     * runs of whole lines, and the runs are parsed in parallel. Throws
+     * std::runtime_error if the file is malformed.
+     */
+    GFAGraph(const std::string& filename);
+
+    /**
+     * Call the given function with the ID and sequence of each node, in file
+     * order.
+     */
+    void forEachNode(const std::function<void(int64_t, const std::string&)>& iteratee) const;
+
+    /**
+     * Call the given function with the ID of each node, and where its
+     * sequence is in the mapped file and how long it is, in file order. The
+     * sequences stay put as long as the GFAGraph does.
+     */
+    void forEachNodeData(const std::function<void(int64_t, const char*, size_t)>& iteratee) const;
+
+    /**
+     * Call the given function with each edge, in file order.
+     */
+    void forEachEdge(const std::function<void(const vg::Edge&)>& iteratee) const;
+
+    /**
+     * Get the number of nodes in the graph.
+     */
+    size_t nodeCount() const;
+
+    /**
+     * Get the length of the given node.
+     */
+    int64_t getNodeLength(int64_t nodeId) const;
+
+    /**
+     * Get the sequence of the given node.
+     */
+    std::string getNodeSequence(int64_t nodeId) const;
+
+    /**
+     * Get all the edges touching the given node. The first call builds an
+     * index of edges by node, so this is not safe to call from more than one
+     * thread at once.
+     */
+    std::vector<vg::Edge> edgesOf(int64_t nodeId);
+
+    /**
+     * Get the names of all the paths.
+     */
+    std::set<std::string> getPathNames() const;
+
+    /**
+     * Get the steps of the named path. Every step visits a whole node.
+     */
+    const std::vector<PathStep>& getPath(const std::string& pathName) const;
+
+protected:
+
+    // A node, with its sequence pointing into the mapped file
+    struct Segment {
+        int64_t id;
+        const char* sequence;
+        size_t length;
+    };
+
+    // An edge, in vg's terms
+    struct Link {
+        int64_t from;
+        bool fromStart;
+        int64_t to;
+        bool toEnd;
+    };
+
+    // The file we parsed. Our segment sequences point into it.
+    MappedFile file;
+
+    // All the segments, in file order
+    std::vector<Segment> segments;
+
+    // Where each node ID is in segments
+    std::unordered_map<int64_t, size_t> segmentIndex;
+
+    // All the links, in file order
+    std::vector<Link> links;
+
+    // The links touching each node, by index in links. Only built if needed.
+    std::unordered_multimap<int64_t, size_t> linkIndex;
+
+    // All the paths, by name
+    std::map<std::string, std::vector<PathStep>> paths;
+};
+
+}
+
+#endif
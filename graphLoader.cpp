@@ -0,0 +1,506 @@
+#include "graphLoader.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include <omp.h>
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/io/gzip_stream.h>
+#include <google/protobuf/io/coded_stream.h>
+
+namespace coregraph {
+
+// How many alignments to read for each thread before decoding them together
+static const size_t ALIGNMENT_BATCH_SIZE = 1024;
+
+void InputGraph::planEmbedding(EmbeddingPlan& plan) {
+    if(gfa) {
+        EmbeddedGraph::planEmbedding(*gfa, plan);
+    } else if(xg) {
+        EmbeddedGraph::planEmbedding(*xg, plan);
+    } else {
+        EmbeddedGraph::planEmbedding(*vg, plan);
+    }
+}
+
+EmbeddedGraph* InputGraph::embed(PinchGraph& pinchGraph, SequenceStore& threadSequences,
+    std::function<int64_t(void)> getId, const EmbeddingPlan* plan) {
+    
+    if(gfa) {
+        return new EmbeddedGraph(*gfa, pinchGraph, threadSequences, getId, filename, plan);
+    } else if(xg) {
+        return new EmbeddedGraph(*xg, pinchGraph, threadSequences, getId, filename, plan);
+    } else {
+        return new EmbeddedGraph(*vg, pinchGraph, threadSequences, getId, filename, plan);
+    }
+}
+
+void InputGraph::forEachNode(const std::function<void(int64_t, const std::string&)>& iteratee) {
+    if(gfa) {
+        gfa->forEachNode(iteratee);
+    } else if(xg) {
+        for(size_t rank = 1; rank <= xg->max_node_rank(); rank++) {
+            int64_t nodeId = xg->rank_to_id(rank);
+            iteratee(nodeId, xg->node_sequence(nodeId));
+        }
+    } else {
+        vg->for_each_node([&](vg::Node* node) {
+            iteratee(node->id(), node->sequence());
+        });
+    }
+}
+
+void InputGraph::forEachEdge(const std::function<void(const vg::Edge&)>& iteratee) {
+    if(gfa) {
+        gfa->forEachEdge(iteratee);
+    } else if(xg) {
+        for(size_t rank = 1; rank <= xg->max_node_rank(); rank++) {
+            int64_t nodeId = xg->rank_to_id(rank);
+            
+            // Self loops can come out more than once for their node, so we keep
+            // track of which ones we did by their from_start and to_end flags.
+            std::set<std::pair<bool, bool>> selfLoopsDone;
+            
+            for(auto& edge : xg->edges_of(nodeId)) {
+                if(edge.from() != nodeId) {
+                    // Every edge is reported for both of its nodes, so we only
+                    // take it when looking from its from node.
+                    continue;
+                }
+                
+                if(edge.to() == nodeId) {
+                    auto flags = std::make_pair(edge.from_start(), edge.to_end());
+                    if(selfLoopsDone.count(flags)) {
+                        continue;
+                    }
+                    selfLoopsDone.insert(flags);
+                }
+                
+                iteratee(edge);
+            }
+        }
+    } else {
+        vg->for_each_edge([&](vg::Edge* edge) {
+            iteratee(*edge);
+        });
+    }
+}
+
+std::set<std::string> InputGraph::getPathNames() {
+    std::set<std::string> pathNames;
+    
+    if(gfa) {
+        pathNames = gfa->getPathNames();
+    } else if(xg) {
+        for(size_t rank = 1; rank <= xg->max_path_rank(); rank++) {
+            pathNames.insert(xg->path_name(rank));
+        }
+    } else {
+        vg->paths.for_each([&](vg::Path& path) {
+            pathNames.insert(path.name());
+        });
+    }
+    
+    return pathNames;
+}
+
+void InputGraph::forEachPathStep(const std::string& pathName, const std::function<void(const PathStep&)>& iteratee) {
+    PathStep step;
+    
+    if(gfa) {
+        for(auto& gfaStep : gfa->getPath(pathName)) {
+            iteratee(gfaStep);
+        }
+    } else if(xg) {
+        // Walk along the path by position, a node at a time, since xg paths
+        // only ever visit whole nodes.
+        size_t pathLength = xg->path_length(pathName);
+        for(size_t pathBase = 0; pathBase < pathLength; pathBase += step.length) {
+            vg::Mapping mapping = xg->mapping_at_path_position(pathName, pathBase);
+            step.nodeId = mapping.position().node_id();
+            step.isReverse = mapping.is_reverse();
+            step.length = xg->node_length(step.nodeId);
+            // Reverse steps start from the last base of the node
+            step.offset = step.isReverse ? step.length - 1 : 0;
+            iteratee(step);
+        }
+    } else {
+        std::function<int64_t(int64_t)> nodeLength = [&](int64_t nodeId) {
+            return (int64_t) vg->get_node(nodeId)->sequence().size();
+        };
+        for(auto& mapping : vg->paths.get_path(pathName)) {
+            step.nodeId = mapping.position().node_id();
+            step.offset = mapping.position().offset();
+            step.isReverse = mapping.is_reverse();
+            step.length = mappingLength(mapping, nodeLength);
+            iteratee(step);
+        }
+    }
+}
+
+void InputGraph::forEachPathStepInRange(const std::string& pathName, size_t start, size_t end,
+    const std::function<void(const PathStep&)>& iteratee) {
+    
+    // Cut a step that starts at the given path base down to just the part in
+    // the range, and send it along if there's anything left.
+    auto clipStep = [&](PathStep step, size_t stepStart) {
+        size_t overlapStart = std::max(start, stepStart);
+        size_t overlapEnd = std::min(end, stepStart + step.length);
+        if(overlapStart >= overlapEnd) {
+            return;
+        }
+        int64_t skipped = overlapStart - stepStart;
+        step.offset += step.isReverse ? -skipped : skipped;
+        step.length = overlapEnd - overlapStart;
+        iteratee(step);
+    };
+    
+    if(xg) {
+        // We can jump right to the range
+        size_t pathLength = xg->path_length(pathName);
+        end = std::min(end, pathLength);
+        if(start >= end) {
+            return;
+        }
+        
+        // Find which step of the path covers the start of the range, and
+        // where that step starts, from the path's position index. Paths are
+        // numbered from 1.
+        xg::XGPath* path = xg->paths[xg->path_rank(pathName) - 1];
+        size_t stepStart = path->positions[path->offset_at_position(start)];
+        
+        // Then go a node at a time
+        PathStep step;
+        while(stepStart < end) {
+            vg::Mapping mapping = xg->mapping_at_path_position(pathName, stepStart);
+            step.nodeId = mapping.position().node_id();
+            step.isReverse = mapping.is_reverse();
+            step.length = xg->node_length(step.nodeId);
+            // Reverse steps start from the last base of the node
+            step.offset = step.isReverse ? step.length - 1 : 0;
+            clipStep(step, stepStart);
+            stepStart += step.length;
+        }
+    } else {
+        size_t stepStart = 0;
+        forEachPathStep(pathName, [&](const PathStep& step) {
+            clipStep(step, stepStart);
+            stepStart += step.length;
+        });
+    }
+}
+
+std::string InputGraph::getNodeSequence(int64_t nodeId) {
+    if(gfa) {
+        return gfa->getNodeSequence(nodeId);
+    } else if(xg) {
+        return xg->node_sequence(nodeId);
+    } else {
+        return vg->get_node(nodeId)->sequence();
+    }
+}
+
+std::vector<vg::Edge> InputGraph::edgesOf(int64_t nodeId) {
+    if(gfa) {
+        return gfa->edgesOf(nodeId);
+    } else if(xg) {
+        return xg->edges_of(nodeId);
+    } else {
+        std::vector<vg::Edge> edges;
+        for(auto edge : vg->edges_of(vg->get_node(nodeId))) {
+            edges.push_back(*edge);
+        }
+        return edges;
+    }
+}
+
+void InputGraph::restrictToRegion(const std::string& pathName, size_t start, size_t end, size_t context) {
+    if(!getPathNames().count(pathName)) {
+        throw std::runtime_error(filename + " has no path " + pathName);
+    }
+    
+    std::unique_ptr<vg::VG> region(new vg::VG());
+    
+    // Keep the part of the path in the region, and note the nodes it visits.
+    // We keep the nodes in order so the embedding comes out the same every
+    // time.
+    std::set<int64_t> nodes;
+    std::vector<int64_t> frontier;
+    int64_t rank = 0;
+    forEachPathStepInRange(pathName, start, end, [&](const PathStep& step) {
+        if(nodes.insert(step.nodeId).second) {
+            frontier.push_back(step.nodeId);
+        }
+        vg::Mapping mapping = makeMapping(step);
+        mapping.set_rank(++rank);
+        region->paths.append_mapping(pathName, mapping);
+    });
+    
+    if(nodes.empty()) {
+        throw std::runtime_error("Region " + pathName + ":" + std::to_string(start) + "-" +
+            std::to_string(end) + " is empty in " + filename);
+    }
+    
+    // Grow out along edges, one step at a time
+    for(size_t step = 0; step < context && !frontier.empty(); step++) {
+        std::vector<int64_t> nextFrontier;
+        for(auto nodeId : frontier) {
+            for(auto& edge : edgesOf(nodeId)) {
+                for(auto other : {edge.from(), edge.to()}) {
+                    if(nodes.insert(other).second) {
+                        nextFrontier.push_back(other);
+                    }
+                }
+            }
+        }
+        frontier.swap(nextFrontier);
+    }
+    
+    // Copy over the nodes, and the edges between them. Each edge is seen from
+    // both ends, so we keep track of the ones we did by their canonical from,
+    // from_start, to, to_end tuples.
+    for(auto nodeId : nodes) {
+        region->create_node(getNodeSequence(nodeId), nodeId);
+    }
+    std::set<std::tuple<int64_t, bool, int64_t, bool>> edgesDone;
+    for(auto nodeId : nodes) {
+        for(auto& edge : edgesOf(nodeId)) {
+            if(!nodes.count(edge.from()) || !nodes.count(edge.to())) {
+                // This edge leaves the region
+                continue;
+            }
+            auto forward = std::make_tuple(edge.from(), edge.from_start(), edge.to(), edge.to_end());
+            auto reverse = std::make_tuple(edge.to(), !edge.to_end(), edge.from(), !edge.from_start());
+            if(edgesDone.insert(std::min(forward, reverse)).second) {
+                region->add_edge(edge);
+            }
+        }
+    }
+    
+    std::cerr << "Restricted " << filename << " to " << nodes.size() << " nodes around " << pathName << ":" <<
+        start << "-" << end << std::endl;
+    
+    // Swap out the graph
+    vg = std::move(region);
+    xg.reset();
+    gfa.reset();
+}
+
+vg::Mapping makeMapping(const PathStep& step) {
+    vg::Mapping mapping;
+    mapping.mutable_position()->set_node_id(step.nodeId);
+    mapping.mutable_position()->set_offset(step.offset);
+    mapping.set_is_reverse(step.isReverse);
+    vg::Edit* edit = mapping.add_edit();
+    edit->set_from_length(step.length);
+    edit->set_to_length(step.length);
+    return mapping;
+}
+
+void parseRegion(const std::string& region, std::string& pathName, size_t& start, size_t& end) {
+    // Path names can have colons in them, so split at the last one
+    size_t colon = region.rfind(':');
+    size_t dash = region.find('-', colon == std::string::npos ? 0 : colon);
+    if(colon == std::string::npos || dash == std::string::npos || colon == 0 ||
+        dash == colon + 1 || dash + 1 == region.size()) {
+        throw std::runtime_error("Region " + region + " is not of the form PATH:START-END");
+    }
+    
+    pathName = region.substr(0, colon);
+    try {
+        start = std::stoull(region.substr(colon + 1, dash - colon - 1));
+        end = std::stoull(region.substr(dash + 1));
+    } catch(std::logic_error& e) {
+        throw std::runtime_error("Region " + region + " has bad coordinates");
+    }
+    
+    if(end <= start) {
+        throw std::runtime_error("Region " + region + " is empty");
+    }
+}
+
+bool isXG(const std::string& filename) {
+    return filename.size() >= 3 && filename.substr(filename.size() - 3) == ".xg";
+}
+
+bool isGFA(const std::string& filename) {
+    return filename.size() >= 4 && filename.substr(filename.size() - 4) == ".gfa";
+}
+
+/**
+ * Reads the encoded messages out of a vg-style stream: a gzipped series of
+ * groups, each of which is a varint count and then that many
+ * varint-length-prefixed messages. Decompressing has to be done in order, but
+ * the messages can then be decoded in any order.
+ */
+class MessageReader {
+public:
+    MessageReader(std::istream& in) {
+        rawIn = new ::google::protobuf::io::IstreamInputStream(&in);
+        gzipIn = new ::google::protobuf::io::GzipInputStream(rawIn);
+    }
+    
+    ~MessageReader() {
+        delete gzipIn;
+        delete rawIn;
+    }
+    
+    /**
+     * Pull the encoded bytes of the next message, or return false if there are
+     * no more. Throws std::runtime_error if the stream is corrupt.
+     */
+    bool readMessage(std::string& message) {
+        // Each read gets its own CodedInputStream, so we never hit the total
+        // byte limit.
+        ::google::protobuf::io::CodedInputStream codedIn(gzipIn);
+        while(groupRemaining == 0) {
+            if(done || !codedIn.ReadVarint64(&groupRemaining) || groupRemaining == 0) {
+                done = true;
+                return false;
+            }
+        }
+        
+        uint32_t messageBytes = 0;
+        if(!codedIn.ReadVarint32(&messageBytes) || messageBytes > MAX_MESSAGE_BYTES ||
+            !codedIn.ReadString(&message, messageBytes)) {
+            throw std::runtime_error("Corrupt vg chunk stream");
+        }
+        groupRemaining--;
+        return true;
+    }
+
+protected:
+    // Don't let one message be bigger than this
+    static const uint32_t MAX_MESSAGE_BYTES = 1000000000;
+    
+    ::google::protobuf::io::ZeroCopyInputStream* rawIn;
+    ::google::protobuf::io::GzipInputStream* gzipIn;
+    
+    // How many messages are left in the current group?
+    uint64_t groupRemaining = 0;
+    // Have we hit the end of the stream?
+    bool done = false;
+};
+
+std::unique_ptr<vg::VG> loadVGParallel(std::istream& in) {
+    MessageReader reader(in);
+    
+    // Read this many messages at a time before decoding them all together
+    size_t batchSize = 4 * omp_get_max_threads();
+    
+    // Messages read and decoded, and how far we've handed them out
+    std::vector<std::string> encoded(batchSize);
+    std::vector<vg::Graph> decoded(batchSize);
+    size_t decodedCount = 0;
+    size_t nextDecoded = 0;
+    
+    std::function<bool(vg::Graph&)> getNextGraph = [&](vg::Graph& graph) {
+        if(nextDecoded == decodedCount) {
+            // Read another batch
+            decodedCount = 0;
+            nextDecoded = 0;
+            while(decodedCount < batchSize && reader.readMessage(encoded[decodedCount])) {
+                decodedCount++;
+            }
+            
+            if(decodedCount == 0) {
+                // Nothing is left
+                return false;
+            }
+            
+            // Decode it in parallel
+            bool allParsed = true;
+            #pragma omp parallel for schedule(dynamic, 1)
+            for(size_t i = 0; i < decodedCount; i++) {
+                decoded[i].Clear();
+                if(!decoded[i].ParseFromString(encoded[i])) {
+                    #pragma omp critical (allParsed)
+                    allParsed = false;
+                }
+            }
+            
+            if(!allParsed) {
+                throw std::runtime_error("Could not decode vg chunk");
+            }
+        }
+        
+        // Hand out the next decoded graph, in stream order
+        graph.Swap(&decoded[nextDecoded++]);
+        return true;
+    };
+    
+    return std::unique_ptr<vg::VG>(new vg::VG(getNextGraph));
+}
+
+void forEachAlignmentBatch(std::istream& in,
+    const std::function<void(const std::vector<vg::Alignment>&, size_t)>& iteratee) {
+    
+    MessageReader reader(in);
+    
+    // Alignments are small, so take a lot of them at a time
+    size_t batchSize = ALIGNMENT_BATCH_SIZE * omp_get_max_threads();
+    
+    std::vector<std::string> encoded(batchSize);
+    std::vector<vg::Alignment> decoded(batchSize);
+    
+    while(true) {
+        size_t count = 0;
+        while(count < batchSize && reader.readMessage(encoded[count])) {
+            count++;
+        }
+        if(count == 0) {
+            // Nothing is left
+            return;
+        }
+        
+        // Decode it in parallel
+        bool allParsed = true;
+        #pragma omp parallel for schedule(dynamic, 64)
+        for(size_t i = 0; i < count; i++) {
+            decoded[i].Clear();
+            if(!decoded[i].ParseFromString(encoded[i])) {
+                #pragma omp critical (allParsed)
+                allParsed = false;
+            }
+        }
+        
+        if(!allParsed) {
+            throw std::runtime_error("Could not decode alignment");
+        }
+        
+        iteratee(decoded, count);
+    }
+}
+
+std::unique_ptr<InputGraph> loadInputGraph(const std::string& filename) {
+    std::unique_ptr<InputGraph> input(new InputGraph());
+    input->filename = filename;
+    
+    if(isGFA(filename)) {
+        // GFA files are mapped, not streamed
+        input->gfa.reset(new GFAGraph(filename));
+        return input;
+    }
+    
+    // Open the file
+    std::ifstream stream(filename);
+    if(!stream.good()) {
+        throw std::runtime_error("Could not read " + filename);
+    }
+    
+    if(isXG(filename)) {
+        input->xg.reset(new xg::XG());
+        input->xg->load(stream);
+    } else {
+        input->vg = loadVGParallel(stream);
+    }
+    
+    return input;
+}
+
+}
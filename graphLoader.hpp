@@ -0,0 +1,154 @@
+#ifndef COREGRAPH_GRAPHLOADER_HPP
+#define COREGRAPH_GRAPHLOADER_HPP
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ekg/vg/vg.hpp"
+#include "ekg/vg/xg/xg.hpp"
+
+#include "embeddedGraph.hpp"
+#include "gfa.hpp"
+#include "pathStep.hpp"
+#include "pinchGraph.hpp"
+
+namespace coregraph {
+
+/**
+ * One of the graphs we are merging, loaded from whatever format it came in.
+ * Exactly one of the graph pointers is filled in.
+ */
+struct InputGraph {
+    // The file it came from
+    std::string filename;
+    
+    // The graph, if it came from a vg file
+    std::unique_ptr<vg::VG> vg;
+    
+    // The index, if it came from an xg file
+    std::unique_ptr<xg::XG> xg;
+    
+    // The graph, if it came from a GFA file
+    std::unique_ptr<GFAGraph> gfa;
+    
+    /**
+     * Plan the graph's embedding, with EmbeddedGraph::planEmbedding(). Only
+     * reads the graph, so it is safe to do while another graph is being
+     * planned or embedded. The plan must not outlive this InputGraph.
+     */
+    void planEmbedding(EmbeddingPlan& plan);
+    
+    /**
+     * Embed the graph in the given pinch graph, as EmbeddedGraph's constructors
+     * do, using the given plan if there is one. The caller owns the result,
+     * which must not outlive this InputGraph.
+     */
+    EmbeddedGraph* embed(PinchGraph& pinchGraph, SequenceStore& threadSequences,
+        std::function<int64_t(void)> getId, const EmbeddingPlan* plan = nullptr);
+    
+    /**
+     * Call the given function with the ID and sequence of each node.
+     */
+    void forEachNode(const std::function<void(int64_t, const std::string&)>& iteratee);
+    
+    /**
+     * Call the given function with each edge, once.
+     */
+    void forEachEdge(const std::function<void(const vg::Edge&)>& iteratee);
+    
+    /**
+     * Get the names of all the paths.
+     */
+    std::set<std::string> getPathNames();
+    
+    /**
+     * Call the given function with each step along the named path, in order.
+     */
+    void forEachPathStep(const std::string& pathName, const std::function<void(const PathStep&)>& iteratee);
+    
+    /**
+     * Call the given function with each step along the named path that
+     * overlaps the given 0-based, end-exclusive range of path bases, cut down
+     * to just the part in the range. For xg indexes, only the part of the path
+     * in the range is looked at.
+     */
+    void forEachPathStepInRange(const std::string& pathName, size_t start, size_t end,
+        const std::function<void(const PathStep&)>& iteratee);
+    
+    /**
+     * Get the sequence of the given node.
+     */
+    std::string getNodeSequence(int64_t nodeId);
+    
+    /**
+     * Get all the edges touching the given node.
+     */
+    std::vector<vg::Edge> edgesOf(int64_t nodeId);
+    
+    /**
+     * Replace the graph with just the part around a region of one of its
+     * paths, as a vg graph. Takes the nodes the path visits in the given
+     * 0-based, end-exclusive range of path bases, and then everything within
+     * the given number of edges of them. The only path kept is the given one,
+     * trimmed to exactly the range, so that it lines up with the same region
+     * of the same path in another graph. Throws std::runtime_error if the
+     * path doesn't exist or the region is empty.
+     */
+    void restrictToRegion(const std::string& pathName, size_t start, size_t end, size_t context);
+};
+
+/**
+ * Make a perfect-match Mapping for a path step.
+ */
+vg::Mapping makeMapping(const PathStep& step);
+
+/**
+ * Parse a region of the form PATH:START-END, with 0-based, end-exclusive
+ * coordinates. Throws std::runtime_error if it is malformed.
+ */
+void parseRegion(const std::string& region, std::string& pathName, size_t& start, size_t& end);
+
+/**
+ * Return true if the given file name is for an xg index, and false if it is
+ * for a vg graph.
+ */
+bool isXG(const std::string& filename);
+
+/**
+ * Return true if the given file name is for a GFA file.
+ */
+bool isGFA(const std::string& filename);
+
+/**
+ * Load a vg graph from a stream of vg chunks. The chunks are read off the
+ * stream in batches, and each batch is decoded in parallel before being added
+ * to the graph in stream order.
+ */
+std::unique_ptr<vg::VG> loadVGParallel(std::istream& in);
+
+/**
+ * Read a GAM stream of alignments in batches. Each batch is decoded in
+ * parallel, and then the given function is called with it and the number of
+ * alignments in it, which may be fewer than the vector holds. Throws
+ * std::runtime_error if the stream is corrupt.
+ */
+void forEachAlignmentBatch(std::istream& in,
+    const std::function<void(const std::vector<vg::Alignment>&, size_t)>& iteratee);
+
+/**
+ * Load an input graph from the given file, picking the format by the file's
+ * extension. Throws std::runtime_error if the file can't be read.
+ *
+ * This touches nothing but the new graph, so it is safe to run on a
+ * background thread (with std::async) while another graph is being embedded.
+ */
+std::unique_ptr<InputGraph> loadInputGraph(const std::string& filename);
+
+}
+
+#endif
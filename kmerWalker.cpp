@@ -0,0 +1,342 @@
+#include "kmerWalker.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <omp.h>
+
+namespace coregraph {
+
+KmerWalker::KmerWalker(vg::VG& graph, size_t kmerSize, size_t edgeMax): kmerSize(kmerSize),
+    edgeMax(edgeMax) {
+    
+    if(kmerSize == 0) {
+        throw std::runtime_error("Cannot walk kmers of size 0");
+    }
+    
+    // Keep only as many bases of the code as fit
+    codeMask = kmerSize >= 32 ? ~(uint64_t) 0 : ((uint64_t) 1 << (2 * kmerSize)) - 1;
+    
+    // Number the nodes
+    std::unordered_map<int64_t, size_t> nodeIndex;
+    graph.for_each_node([&](vg::Node* node) {
+        nodeIndex[node->id()] = nodeIds.size();
+        nodeIds.push_back(node->id());
+        nodeSequences.push_back(&node->sequence());
+    });
+    
+    // Work out where each edge goes when leaving each of its sides. An edge
+    // leaves its from node's end (or start, if from_start is set) and enters
+    // its to node's start (or end, if to_end is set). Entering a node at its
+    // end means reading it backward.
+    std::vector<std::pair<size_t, std::pair<size_t, bool>>> edges;
+    graph.for_each_edge([&](vg::Edge* edge) {
+        size_t from = nodeIndex.at(edge->from());
+        size_t to = nodeIndex.at(edge->to());
+        size_t fromSide = 2 * from + (edge->from_start() ? 0 : 1);
+        size_t toSide = 2 * to + (edge->to_end() ? 1 : 0);
+        edges.emplace_back(fromSide, std::make_pair(to, edge->to_end()));
+        if(toSide != fromSide) {
+            // Going the other way, we enter the from node at the side the
+            // edge leaves it by. A self loop between the same side twice only
+            // goes one place.
+            edges.emplace_back(toSide, std::make_pair(from, !edge->from_start()));
+        }
+    });
+    
+    // Lay the edges out by side
+    sideEdges.assign(2 * nodeIds.size() + 1, 0);
+    for(auto& edge : edges) {
+        sideEdges[edge.first + 1]++;
+    }
+    for(size_t i = 1; i < sideEdges.size(); i++) {
+        sideEdges[i] += sideEdges[i - 1];
+    }
+    sideTargets.resize(edges.size());
+    std::vector<size_t> filled(sideEdges.begin(), sideEdges.end() - 1);
+    for(auto& edge : edges) {
+        sideTargets[filled[edge.first]++] = edge.second;
+    }
+    
+    if(edgeMax != 0 && edgeMax < kmerSize) {
+        // A kmer can pass at most kmerSize - 1 choice points, so otherwise
+        // the limit never gets in the way.
+        computeReach();
+    }
+}
+
+void KmerWalker::forEachKmerParallel(const std::function<void(const KmerAnchor&, const Walk&)>& iteratee) const {
+    
+    // Each thread keeps its own walk. A walk never has more than one node per
+    // base of the kmer, so it never needs to grow past this.
+    std::vector<Walk> walks(omp_get_max_threads());
+    for(auto& walk : walks) {
+        walk.reserve(kmerSize + 1);
+    }
+    
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(size_t start = 0; start < nodeIds.size(); start++) {
+        int64_t startLength = nodeLength(start);
+        if(startLength == 0 || (!masked.empty() && masked[start])) {
+            // No kmers start here that we would keep
+            continue;
+        }
+        
+        Walk& walk = walks.at(omp_get_thread_num());
+        walk.clear();
+        
+        // Every kmer starting on this node is done by this far along the walk
+        int64_t walkEnd = startLength + kmerSize - 1;
+        
+        extendWalk(walk, start, false, 0, iteratee);
+        
+        while(!walk.empty()) {
+            WalkNode& last = walk.back();
+            
+            // Leaving a side with more than one edge is a choice point
+            size_t side = 2 * last.node + (last.backward ? 0 : 1);
+            size_t edgesEnd = sideEdges[side + 1];
+            size_t choicePoints = last.choicePoints + (edgesEnd - sideEdges[side] > 1 ? 1 : 0);
+            int64_t walkPosition = last.walkStart + nodeLength(last.node);
+            
+            // Either there's nowhere left to go from here, or no kmer we
+            // could find by going on would be kept.
+            bool done = last.nextEdge == edgesEnd || walkPosition >= walkEnd ||
+                last.lastInvalid >= startLength - 1 || (edgeMax != 0 && choicePoints >= edgeMax);
+            if(!done && !reach.empty()) {
+                // Or the walk can't get far enough to finish any kmer we
+                // haven't already found.
+                int64_t firstStart = std::max(last.lastInvalid + 1, (int64_t) 0);
+                int64_t needed = std::max(firstStart + (int64_t) kmerSize - walkPosition, (int64_t) 1);
+                done = getReach(last.node, last.backward, edgeMax - 1 - last.choicePoints) < needed;
+            }
+            if(done) {
+                walk.pop_back();
+                continue;
+            }
+            
+            auto& target = sideTargets[last.nextEdge++];
+            if(nodeLength(target.first) == 0) {
+                // Walks stop at empty nodes
+                continue;
+            }
+            extendWalk(walk, target.first, target.second, choicePoints, iteratee);
+        }
+    }
+}
+
+void KmerWalker::spellKmer(const KmerAnchor& anchor, const Walk& walk, std::string& kmer) const {
+    kmer.resize(kmerSize);
+    
+    if(kmerSize <= 32) {
+        // The whole kmer is in the code
+        for(size_t i = 0; i < kmerSize; i++) {
+            kmer[i] = "ACGT"[(anchor.code >> (2 * (kmerSize - 1 - i))) & 3];
+        }
+        return;
+    }
+    
+    // Otherwise read it off the nodes
+    size_t filled = 0;
+    int64_t offset = anchor.offset;
+    for(size_t i = 0; i < anchor.nodeCount && filled < kmerSize; i++) {
+        for(; offset < nodeLength(walk[i].node) && filled < kmerSize; offset++) {
+            kmer[filled++] = "ACGT"[baseCode(walk[i].node, walk[i].backward, offset)];
+        }
+        offset = 0;
+    }
+}
+
+void KmerWalker::getSteps(const KmerAnchor& anchor, const Walk& walk, std::vector<PathStep>& steps) const {
+    steps.clear();
+    
+    // How many bases of the kmer are yet to be accounted for?
+    int64_t remaining = kmerSize;
+    
+    // Only the first node is entered partway along
+    int64_t offset = anchor.offset;
+    
+    for(size_t i = 0; i < anchor.nodeCount && remaining > 0; i++) {
+        int64_t length = nodeLength(walk[i].node);
+        
+        PathStep step;
+        step.nodeId = nodeIds[walk[i].node];
+        step.isReverse = walk[i].backward;
+        // Reverse steps count their first base from the start of the
+        // underlying node.
+        step.offset = step.isReverse ? length - offset - 1 : offset;
+        step.length = std::min(remaining, length - offset);
+        remaining -= step.length;
+        offset = 0;
+        
+        steps.push_back(step);
+    }
+}
+
+void KmerWalker::reverseComplement(const std::string& kmer, std::string& reverse) {
+    reverse.resize(kmer.size());
+    for(size_t i = 0; i < kmer.size(); i++) {
+        int code = encodeBase(kmer[kmer.size() - 1 - i]);
+        reverse[i] = code < 0 ? 'N' : "TGCA"[code];
+    }
+}
+
+int KmerWalker::encodeBase(char base) {
+    switch(base) {
+    case 'A':
+    case 'a':
+        return 0;
+    case 'C':
+    case 'c':
+        return 1;
+    case 'G':
+    case 'g':
+        return 2;
+    case 'T':
+    case 't':
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+size_t KmerWalker::getMaskedBases() const {
+    return maskedBases;
+}
+
+int64_t KmerWalker::nodeLength(size_t node) const {
+    return nodeSequences[node]->size();
+}
+
+int KmerWalker::baseCode(size_t node, bool backward, int64_t offset) const {
+    const std::string& sequence = *nodeSequences[node];
+    if(!backward) {
+        return encodeBase(sequence[offset]);
+    }
+    // Read the other strand, complemented
+    int code = encodeBase(sequence[sequence.size() - 1 - offset]);
+    return code < 0 ? code : 3 - code;
+}
+
+void KmerWalker::computeReach() {
+    size_t traversals = 2 * nodeIds.size();
+    reach.assign(edgeMax * traversals, 0);
+    
+    // Work up from walks that can't pass any more choice points. Each level
+    // depends on itself, so we go over it again until nothing changes. Every
+    // node has at least one base and reach stops at the kmer size, so that
+    // can't take more than kmerSize + 1 passes.
+    std::vector<uint32_t> next(traversals);
+    for(size_t choicePoints = 0; choicePoints < edgeMax; choicePoints++) {
+        uint32_t* level = &reach[choicePoints * traversals];
+        const uint32_t* below = choicePoints > 0 ? level - traversals : nullptr;
+        
+        bool changed = true;
+        while(changed) {
+            changed = false;
+            
+            #pragma omp parallel for reduction(||:changed)
+            for(size_t traversal = 0; traversal < traversals; traversal++) {
+                // Leaving a node forward goes out its end, and backward goes
+                // out its start.
+                size_t side = traversal ^ 1;
+                bool isChoice = sideEdges[side + 1] - sideEdges[side] > 1;
+                
+                uint32_t best = 0;
+                if(!isChoice || choicePoints > 0) {
+                    // Going through a choice point uses one up
+                    const uint32_t* after = isChoice ? below : level;
+                    for(size_t edge = sideEdges[side]; edge < sideEdges[side + 1]; edge++) {
+                        auto& target = sideTargets[edge];
+                        int64_t length = nodeLength(target.first);
+                        if(length == 0) {
+                            // Walks stop at empty nodes
+                            continue;
+                        }
+                        int64_t far = length + after[2 * target.first + (target.second ? 1 : 0)];
+                        best = std::max(best, (uint32_t) std::min(far, (int64_t) kmerSize));
+                    }
+                }
+                
+                next[traversal] = best;
+                if(best != level[traversal]) {
+                    changed = true;
+                }
+            }
+            
+            std::copy(next.begin(), next.end(), level);
+        }
+    }
+    
+    // Mask the nodes too short to hold a kmer that can't reach far enough
+    // past their ends to finish even the first kmer starting on them.
+    masked.assign(nodeIds.size(), false);
+    for(size_t node = 0; node < nodeIds.size(); node++) {
+        int64_t length = nodeLength(node);
+        if(length > 0 && length < (int64_t) kmerSize && getReach(node, false, edgeMax - 1) < (int64_t) kmerSize - length) {
+            masked[node] = true;
+            maskedBases += length;
+        }
+    }
+}
+
+int64_t KmerWalker::getReach(size_t node, bool backward, size_t choicePoints) const {
+    return reach[choicePoints * 2 * nodeIds.size() + 2 * node + (backward ? 1 : 0)];
+}
+
+void KmerWalker::extendWalk(Walk& walk, size_t node, bool backward, size_t choicePoints,
+    const std::function<void(const KmerAnchor&, const Walk&)>& iteratee) const {
+    
+    WalkNode added;
+    added.node = node;
+    added.backward = backward;
+    added.nextEdge = sideEdges[2 * node + (backward ? 0 : 1)];
+    added.choicePoints = choicePoints;
+    if(walk.empty()) {
+        added.walkStart = 0;
+        added.code = 0;
+        added.lastInvalid = -1;
+    } else {
+        // Pick up where the last node left off
+        WalkNode& last = walk.back();
+        added.walkStart = last.walkStart + nodeLength(last.node);
+        added.code = last.code;
+        added.lastInvalid = last.lastInvalid;
+    }
+    walk.push_back(added);
+    WalkNode& current = walk.back();
+    
+    // Kmers starting on the first node are all done by here
+    int64_t startLength = nodeLength(walk.front().node);
+    int64_t walkEnd = startLength + kmerSize - 1;
+    
+    KmerAnchor anchor;
+    anchor.nodeId = nodeIds[walk.front().node];
+    anchor.nodeCount = walk.size();
+    anchor.choicePoints = choicePoints;
+    
+    int64_t length = nodeLength(node);
+    for(int64_t i = 0; i < length && current.walkStart + i < walkEnd; i++) {
+        int64_t position = current.walkStart + i;
+        
+        int code = baseCode(node, backward, i);
+        if(code < 0) {
+            // Kmers can't cover this base
+            current.lastInvalid = position;
+            code = 0;
+        }
+        current.code = ((current.code << 2) | code) & codeMask;
+        
+        // Report the kmer ending here, if it has all its bases and they are
+        // all good
+        int64_t kmerStart = position - (int64_t) kmerSize + 1;
+        if(kmerStart > current.lastInvalid && kmerStart >= 0) {
+            anchor.offset = kmerStart;
+            anchor.code = current.code;
+            iteratee(anchor, walk);
+        }
+    }
+}
+
+}
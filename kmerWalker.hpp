@@ -0,0 +1,187 @@
+#ifndef COREGRAPH_KMERWALKER_HPP
+#define COREGRAPH_KMERWALKER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ekg/vg/vg.hpp"
+
+#include "pathStep.hpp"
+
+namespace coregraph {
+
+/**
+ * One kmer found by a KmerWalker. The kmer starts on the forward strand of a
+ * node and runs along the first nodeCount nodes of the walk it was found on.
+ */
+struct KmerAnchor {
+    // The node the kmer starts on
+    int64_t nodeId;
+    // The first base of the kmer on that node
+    int64_t offset;
+    // How many nodes of the walk the kmer visits
+    size_t nodeCount;
+    // How many choice points the kmer passes through
+    size_t choicePoints;
+    // The last 32 bases of the kmer (or all of them, if it is shorter), 2 bits
+    // a base with A=0, C=1, G=2, T=3, and the last base in the low bits
+    uint64_t code;
+};
+
+/**
+ * Enumerates the kmers in a vg graph without building kpaths. The graph's
+ * adjacency is copied into flat arrays once, and then each node's kmers are
+ * found by a depth-first walk out from it that keeps the nodes it is on in a
+ * stack no deeper than the kmer size, and rolls a 2-bit code along the bases
+ * as it goes. Finding a kmer allocates nothing.
+ *
+ * Every kmer that starts on the forward strand of a node is found once for
+ * each distinct walk it takes, which is what vg's for_each_kmer_parallel()
+ * does when told to keep duplicates and drop negative offsets. Kmers with
+ * anything but ACGT in them are skipped, as are kmers that pass through
+ * edgeMax or more choice points (places where a walk could have gone more
+ * than one way), unless edgeMax is 0. Walks stop at empty nodes.
+ *
+ * So that dense clusters of bubbles don't cost walks that are only thrown
+ * away, when edgeMax limits anything the walker first works out, by dynamic
+ * programming over the edges, how far a walk can get past each node without
+ * running out of choice points. Nodes that no kept kmer could start on are
+ * masked and never walked from, and walks stop as soon as they can't get far
+ * enough to finish another kmer.
+ */
+class KmerWalker {
+public:
+    
+    // One node on the walk out from a start node
+    struct WalkNode {
+        // Which node, by index in our arrays, and in which orientation
+        size_t node;
+        bool backward;
+        // Where along the walk the node's first base is
+        int64_t walkStart;
+        // The next edge to try leaving by
+        size_t nextEdge;
+        // How many choice points the walk passed to get here
+        size_t choicePoints;
+        // The rolling code as of the node's last base
+        uint64_t code;
+        // Where along the walk the last base that isn't ACGT is, as of the
+        // node's last base, or -1 if there isn't one
+        int64_t lastInvalid;
+    };
+    
+    // A walk in progress. Kmers found on it are only good until the
+    // callback they were passed to returns.
+    typedef std::vector<WalkNode> Walk;
+    
+    /**
+     * Index the given graph to walk its kmers of the given size. The graph
+     * must not change while the walker is in use.
+     */
+    KmerWalker(vg::VG& graph, size_t kmerSize, size_t edgeMax);
+    
+    /**
+     * Call the given function with each kmer and the walk it was found on, on
+     * several threads at once. The function must not throw.
+     */
+    void forEachKmerParallel(const std::function<void(const KmerAnchor&, const Walk&)>& iteratee) const;
+    
+    /**
+     * Spell out a kmer found on the given walk, in upper case, replacing the
+     * contents of the given string.
+     */
+    void spellKmer(const KmerAnchor& anchor, const Walk& walk, std::string& kmer) const;
+    
+    /**
+     * Fill in the steps covering only the bases of a kmer found on the given
+     * walk, replacing the contents of the given vector.
+     */
+    void getSteps(const KmerAnchor& anchor, const Walk& walk, std::vector<PathStep>& steps) const;
+    
+    /**
+     * Spell out the reverse complement of a kmer, replacing the contents of
+     * the given string. Bases that aren't ACGT come out as N.
+     */
+    static void reverseComplement(const std::string& kmer, std::string& reverse);
+    
+    /**
+     * Get the 2-bit code for a base, or -1 if it isn't ACGT.
+     */
+    static int encodeBase(char base);
+    
+    /**
+     * Get the number of bases in nodes that were masked because no kmer that
+     * starts on them could be kept.
+     */
+    size_t getMaskedBases() const;
+
+protected:
+    
+    /**
+     * Get the length of the node with the given index.
+     */
+    int64_t nodeLength(size_t node) const;
+    
+    /**
+     * Get the 2-bit code for the base at the given offset along a node, read
+     * in the given orientation, or -1 if it isn't ACGT.
+     */
+    int baseCode(size_t node, bool backward, int64_t offset) const;
+    
+    /**
+     * Fill in reach, and mask the nodes that no kmer can be kept from.
+     */
+    void computeReach();
+    
+    /**
+     * Get how many bases a walk can go on for past the end of a node, read in
+     * the given orientation, passing at most the given number of further
+     * choice points. Stops counting at the kmer size.
+     */
+    int64_t getReach(size_t node, bool backward, size_t choicePoints) const;
+    
+    /**
+     * Put a node on the end of the walk, having come to it through the given
+     * number of choice points, and roll the code along its bases, calling the
+     * iteratee with each kmer that ends on it.
+     */
+    void extendWalk(Walk& walk, size_t node, bool backward, size_t choicePoints,
+        const std::function<void(const KmerAnchor&, const Walk&)>& iteratee) const;
+    
+    // The size of kmers to find
+    size_t kmerSize;
+    
+    // How many choice points make a kmer too branchy to keep, or 0 for no
+    // limit
+    size_t edgeMax;
+    
+    // A mask for the bits of the rolling code that are kept
+    uint64_t codeMask;
+    
+    // The ID and sequence of each node, by index
+    std::vector<int64_t> nodeIds;
+    std::vector<const std::string*> nodeSequences;
+    
+    // Where the edges leaving each node side start in sideTargets, with the
+    // number of edges on the end. Side 2 * i is the start of node i, and side
+    // 2 * i + 1 is its end.
+    std::vector<size_t> sideEdges;
+    
+    // The node (by index) and orientation that each edge leads into
+    std::vector<std::pair<size_t, bool>> sideTargets;
+    
+    // The reach table, by number of further choice points allowed, and then
+    // by node index and orientation (2 * i + backward). Empty if edgeMax
+    // doesn't limit anything.
+    std::vector<uint32_t> reach;
+    
+    // Which nodes are masked, and how many bases they have in all
+    std::vector<bool> masked;
+    size_t maskedBases = 0;
+};
+
+}
+
+#endif
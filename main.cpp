@@ -2,227 +2,104 @@
 
 #include <iostream>
 #include <fstream>
+#include <future>
+#include <memory>
 #include <getopt.h>
 
 #include "ekg/vg/vg.hpp"
 #include "ekg/vg/index.hpp"
 
 #include "embeddedGraph.hpp"
-
-// Hack around stupid name mangling issues
-extern "C" {
-    #include "benedictpaten/pinchesAndCacti/inc/stPinchGraphs.h"
-}
-
-/**
- * Get the leader for a pinch segment: either the first segment in its block, or
- * the segment itself if it has no block.
- */
-stPinchSegment* getLeader(stPinchSegment* segment) {
-    // See if the segment is in a block
-    auto block = stPinchSegment_getBlock(segment);
-    
-    // Get the leader segment: first in the block, or this segment if no block
-    auto leader = block ? stPinchBlock_getFirst(block) : segment;
-    
-    return leader;
-}
-
-/*
- * Return false if a segment is not in a block or is forward in its block, and
- * true otherwise. Converts from pinch graph orientations to vg orientations.
- */
-bool getOrientation(stPinchSegment* segment) {
-
-    auto block = stPinchSegment_getBlock(segment);
-    
-    return block ? !stPinchSegment_getBlockOrientation(segment) : false;
-
-}
-
-/**
- * Create a VG grpah from a pinch thread set.
- */
-vg::VG pinchToVG(stPinchThreadSet* threadSet, std::map<int64_t, std::string>& threadSequences) {
-    // Make an empty graph
-    vg::VG graph;
-    
-    // Remember what nodes have been created for what segments. Only the first
-    // segment in a block (the "leader") gets a node. Segments without blocks
-    // are also themselves leaders and get nodes.
-    std::map<stPinchSegment*, vg::Node*> nodeForLeader;
-    
-    std::cerr << "Making pinch graph into vg graph with " << threadSequences.size() << " relevant threads" << std::endl;
-    
-    // This is the cleverest way to loop over Benedict's iterators.
-    auto segmentIterator = stPinchThreadSet_getSegmentIt(threadSet);
-    while(auto segment = stPinchThreadSetSegmentIt_getNext(&segmentIterator)) {
-        // For every segment, we need to make a VG node for it or its block (if
-        // it has one).
-        
-#ifdef debug
-        std::cerr << "Found segment " << segment << std::endl;
-#endif
-        
-        // See if the segment is in a block
-        auto block = stPinchSegment_getBlock(segment);
-        
-        // Get the leader segment: first in the block, or this segment if no block
-        auto leader = getLeader(segment);
-        
-        if(nodeForLeader.count(leader)) {
-            // A node has already been made for this block.
-            continue;
-        }
-        
-        // Otherwise, we need the sequence
-        std::string sequence;
-        
-        if(block) {
-            // Get the sequence by scanning through the block for the first sequence
-            // that isn't all Ns, if any.
-            auto segmentIterator = stPinchBlock_getSegmentIterator(block);
-            while(auto sequenceSegment = stPinchBlockIt_getNext(&segmentIterator)) {
-                if(!threadSequences.count(stPinchSegment_getName(sequenceSegment))) {
-                    // This segment is part of a staple. Pass it up
-                    continue;
-                }
-                
-                // Go get the sequence of the thread, and clip out the part relevant to this segment.
-                sequence = threadSequences.at(stPinchSegment_getName(sequenceSegment)).substr(
-                    stPinchSegment_getStart(sequenceSegment), stPinchSegment_getLength(sequenceSegment));
-                    
-                // If necessary, flip the segment around
-                if(getOrientation(sequenceSegment)) {
-                    sequence = vg::reverse_complement(sequence);
-                }
-                
-                if(std::count(sequence.begin(), sequence.end(), 'N') +
-                    std::count(sequence.begin(), sequence.end(), 'n') < sequence.size()) {\
-                    
-                    // The sequence has some non-N characters
-                    // If it's not all Ns, break
-                    break;
-                }
-                
-                // Otherwise try the next segment
-            }
-        } else {
-            // Just pull the sequence from the lone segment
-            sequence = threadSequences.at(stPinchSegment_getName(segment)).substr(
-                stPinchSegment_getStart(segment), stPinchSegment_getLength(segment));
-                
-            // It doesn't need to flip, since it can't be backwards in a block
-        }
-        
-            
-        // Make a node in the graph to represent the block
-        vg::Node* node = graph.create_node(sequence);
-        
-        // Remember it
-        nodeForLeader[leader] = node;
-#ifdef debug
-        std::cerr << "Made node: " << pb2json(*node) << std::endl;
-#endif
-            
-    }
-    
-    // Now go through the segments again and wire them up.
-    segmentIterator = stPinchThreadSet_getSegmentIt(threadSet);
-    while(auto segment = stPinchThreadSetSegmentIt_getNext(&segmentIterator)) {
-        // See if the segment is in a block
-        auto block = stPinchSegment_getBlock(segment);
-        
-        // Get the leader segment: first in the block, or this segment if no block
-        auto leader = getLeader(segment);
-        
-        // We know we have a node already
-        auto node = nodeForLeader.at(leader);
-        
-        // What orientation is this node in for the purposes of this edge
-        // TODO: ought to always be false if the segment isn't in a block. Is this true?
-        auto orientation = getOrientation(segment);
-#ifdef debug
-        std::cerr << "Revisited segment: " << segment << " for node " << node->id() <<
-            " in orientation " << (orientation ? "reverse" : "forward") << std::endl;
-#endif
-        
-        // Look at the segment 5' of here. We know it's not a staple and
-        // thus has a vg node.
-        auto prevSegment = stPinchSegment_get5Prime(segment);
-        
-        if(prevSegment) {
-            // Get the node IDs and orientations
-            auto prevNode = nodeForLeader.at(getLeader(prevSegment));
-            auto prevOrientation = getOrientation(prevSegment);
-#ifdef debug
-            std::cerr << "Found prev node " << prevNode->id() << " in orientation " << 
-                (prevOrientation ? "reverse" : "forward") << std::endl;
-#endif
-            
-            // Make an edge
-            vg::Edge prevEdge;
-            prevEdge.set_from(prevNode->id());
-            prevEdge.set_from_start(prevOrientation);
-            prevEdge.set_to(node->id());
-            prevEdge.set_to_end(orientation);
-            
-            // Add it in. vg::VG deduplicates for us
-            graph.add_edge(prevEdge);
-#ifdef debug
-            std::cerr << "Made edge: " << pb2json(prevEdge) << std::endl;
-#endif
-        }
-        
-        // Now do the same thing for the 3' side
-        auto nextSegment = stPinchSegment_get3Prime(segment);
-        
-        if(nextSegment) {
-            // Get the node IDs and orientations
-            auto nextNode = nodeForLeader.at(getLeader(nextSegment));
-            auto nextOrientation = getOrientation(nextSegment);
-#ifdef debug
-            std::cerr << "Found next node " << nextNode->id() << " in orientation " << 
-                (nextOrientation ? "reverse" : "forward") << std::endl;
-#endif
-            
-            // Make an edge
-            vg::Edge nextEdge;
-            nextEdge.set_from(node->id());
-            nextEdge.set_from_start(orientation);
-            nextEdge.set_to(nextNode->id());
-            nextEdge.set_to_end(nextOrientation);
-            
-            // Add it in. vg::VG deduplicates for us
-            graph.add_edge(nextEdge);
-#ifdef debug
-            std::cerr << "Made edge: " << pb2json(nextEdge) << std::endl;
-#endif
-        }
-    }
-    
-    // Spit out the graph.
-    return graph;
-
-}
+#include "coreGraph.hpp"
+#include "graphLoader.hpp"
+#include "shard.hpp"
+#include "checkpoint.hpp"
+#include "pinchGraph.hpp"
 
 void help_main(char** argv) {
-    std::cerr << "usage: " << argv[0] << " [options] VGFILE VGFILE" << std::endl
+    std::cerr << "usage: " << argv[0] << " [options] GRAPH GRAPH" << std::endl
+        << "       " << argv[0] << " [options] -a CHECKPOINT GRAPH" << std::endl
+        << "       " << argv[0] << " [options] -b LIST REFERENCE" << std::endl
         << "Compute the core graph from two graphs, and print it to standard "
         << "output in vg format." << std::endl
+        << "Each graph may be a vg file, an xg index (ending in .xg), which "
+        << "is read without loading the whole graph, or a GFA file (ending in "
+        << ".gfa) with numeric segment names." << std::endl
         << "The core graph is constructed by merging the two graphs together "
         << "along paths with the same name in both graphs. These paths must be "
-        << "of the same length (which is checked) and spell out identical "
-        << "sequences (which is not yet checked) for this tool to work "
-        << "correctly." << std::endl << std::endl
-        << "If -k is specified, the provided graphs must be indexed."
+        << "of the same length and spell out identical sequences (both of "
+        << "which are checked) for this tool to work correctly." << std::endl << std::endl
+        << "If -k is specified without -p, the provided graphs must be vg files and must be indexed."
         << std::endl
         << "options:" << std::endl
         << "    -h, --help          print this help message" << std::endl
         << "    -k, --kmer-size N   join graphs on mutually unique kmers of size N" << std::endl
         << "    -e, --edge-max N    exclude k-paths which have N or more choice points" << std::endl
-        << "    -o, --kmers-only    merge only on kmers, not on shared paths" << std::endl
-        << "    -t, --threads N     number of threads to use" << std::endl;
+        << "    -p, --path-kmers    with -k, find kmers along paths instead of through the whole" << std::endl
+        << "                        graphs; needs no indexes and works with any input (N <= 32)" << std::endl
+        << "    -G, --gam FILE      also merge along the alignments in FILE, of stretches of the" << std::endl
+        << "                        first graph's paths to the second graph, each named for its" << std::endl
+        << "                        path as PATH or PATH:START-END" << std::endl
+        << "    -o, --kmers-only    merge only on kmers and alignments, not on shared paths" << std::endl
+        << "    -g, --gfa           write the core graph as GFA instead of vg" << std::endl
+        << "    -x, --xg FILE       also write an xg index of the core graph to FILE" << std::endl
+        << "    -X, --xg-only       with -x, don't write the core graph to standard output" << std::endl
+        << "    -m, --max-node-size N  chop output nodes to be no longer than N" << std::endl
+        << "    -s, --sort-ids      number output nodes in topologically sorted order" << std::endl
+        << "    -t, --threads N     number of threads to use" << std::endl
+        << "    -P, --native-pinch  use the built-in flat-array pinch engine instead of sonLib's;" << std::endl
+        << "                        makes the same core graph" << std::endl
+        << "    -R, --region P:S-E  only merge the parts of the graphs around bases S (inclusive)" << std::endl
+        << "                        to E (exclusive) of path P, counted from 0" << std::endl
+        << "    -c, --context N     with -R, also take everything within N edges [1]" << std::endl
+        << "    -C, --checkpoint FILE  save progress to FILE after each phase" << std::endl
+        << "    -r, --resume        resume from the checkpoint given with -C, if it exists," << std::endl
+        << "                        skipping the phases it covers (use the same options)" << std::endl
+        << "    -a, --add FILE      add GRAPH to the core graph saved in checkpoint FILE," << std::endl
+        << "                        merging on shared paths only (use -C to save the result)" << std::endl
+        << "    -B, --memory-budget N  keep at most about N MB of thread sequences in memory," << std::endl
+        << "                        and with -p, join kmers on disk if their tables need more" << std::endl
+        << "    -T, --scratch-dir DIR  put scratch files for -B in DIR [.]" << std::endl
+        << "batch options:" << std::endl
+        << "    -b, --batch FILE    merge REFERENCE with each graph listed in FILE, one per" << std::endl
+        << "                        line, loading and indexing REFERENCE only once" << std::endl
+        << "    -O, --batch-prefix P  write the core graph for the Nth graph to P.N.vg [core]" << std::endl
+        << "sharding options:" << std::endl
+        << "    -S, --shards N      split the merge into up to N independent shards, each" << std::endl
+        << "                        merged by a separate corg process (not with -k)" << std::endl
+        << "    -j, --shard-jobs N  run N shard processes at once [1]" << std::endl
+        << "    -M, --shard-memory N  limit each shard process to N MB of memory" << std::endl
+        << "    -d, --shard-dir DIR keep shard files in DIR [corg-shards]" << std::endl;
+}
+
+/**
+ * Join up trivial boundaries in the pinch graph, and write out the core graph
+ * it makes, with the paths of all the given embedded graphs, to the given
+ * stream. If an xg stream is given, also write an xg index of the core graph
+ * there. Either stream may be null to skip it.
+ */
+void writeCore(coregraph::PinchGraph& pinchGraph, coregraph::SequenceStore& threadSequences,
+    const std::vector<coregraph::EmbeddedGraph*>& graphs, const coregraph::CoreGraphOptions& coreOptions,
+    bool gfaOutput, std::ostream* out, std::ostream* xgOut = nullptr) {
+    
+    // Fix trivial joins so we don't produce more vg nodes than we really need to.
+    pinchGraph.joinTrivialBoundaries();
+    
+    if(out != nullptr && gfaOutput) {
+        // Stream the core graph straight out as GFA
+        coregraph::pinchToGFA(pinchGraph, threadSequences, *out, coreOptions, graphs);
+    } else if(out != nullptr) {
+        // Make another vg graph from the pinch graph
+        vg::VG core = coregraph::pinchToVG(pinchGraph, threadSequences, coreOptions, graphs);
+        
+        // Spit it out, encoding and compressing in parallel
+        coregraph::writeVGParallel(core, *out);
+    }
+    
+    if(xgOut != nullptr) {
+        // Index the core graph as it is made, without reading it back in
+        coregraph::pinchToXG(pinchGraph, threadSequences, *xgOut, coreOptions, graphs);
+    }
 }
 
 int main(int argc, char** argv) {
@@ -236,24 +113,96 @@ int main(int argc, char** argv) {
     size_t kmerSize = 0;
     size_t edgeMax = 0;
     
+    // Should we find kmers by scanning paths instead of the whole graphs?
+    bool pathKmers = false;
+    
+    // What alignments of the first graph's paths to the second graph should
+    // we merge on, if any?
+    std::string gamFile;
+    
     // Should we only merge on kmers and skip paths?
     bool kmersOnly = false;
     
+    // Should we write GFA instead of vg?
+    bool gfaOutput = false;
+    
+    // Where should we write an xg index of the core graph, if anywhere, and
+    // should that be the only output?
+    std::string xgFile;
+    bool xgOnly = false;
+    
+    // Should we use our own pinch engine instead of sonLib's?
+    bool nativePinch = false;
+    
+    // How should the output nodes be chopped and numbered?
+    coregraph::CoreGraphOptions coreOptions;
+    
+    // Should we only merge a region around part of a path?
+    std::string regionPath;
+    size_t regionStart = 0;
+    size_t regionEnd = 0;
+    size_t regionContext = 1;
+    
+    // Where should we save progress, and should we pick up from there?
+    std::string checkpointFile;
+    bool resume = false;
+    
+    // How much memory should thread sequences and kmer tables use before
+    // spilling to disk, if there is a limit, and where should they spill?
+    size_t memoryBudget = 0;
+    std::string scratchDirectory = ".";
+    
+    // What saved core graph should we add a graph to, if any?
+    std::string addCheckpoint;
+    
+    // What list of graphs should we merge with one reference, if any, and
+    // where should the results go?
+    std::string batchList;
+    std::string batchPrefix = "core";
+    
+    // How many shards should we split the merge into, if any, and how should
+    // we run them?
+    size_t shardCount = 0;
+    size_t shardJobs = 1;
+    size_t shardMemory = 0;
+    std::string shardDirectory = "corg-shards";
+    
     optind = 1; // Start at first real argument
     bool optionsRemaining = true;
     while(optionsRemaining) {
         static struct option longOptions[] = {
             {"kmer-size", required_argument, 0, 'k'},
             {"edge-max", required_argument, 0, 'e'},
+            {"path-kmers", no_argument, 0, 'p'},
+            {"gam", required_argument, 0, 'G'},
             {"kmers-only", no_argument, 0, 'o'},
+            {"gfa", no_argument, 0, 'g'},
+            {"xg", required_argument, 0, 'x'},
+            {"xg-only", no_argument, 0, 'X'},
+            {"max-node-size", required_argument, 0, 'm'},
+            {"sort-ids", no_argument, 0, 's'},
             {"threads", required_argument, 0, 't'},
+            {"native-pinch", no_argument, 0, 'P'},
+            {"region", required_argument, 0, 'R'},
+            {"context", required_argument, 0, 'c'},
+            {"checkpoint", required_argument, 0, 'C'},
+            {"resume", no_argument, 0, 'r'},
+            {"add", required_argument, 0, 'a'},
+            {"memory-budget", required_argument, 0, 'B'},
+            {"scratch-dir", required_argument, 0, 'T'},
+            {"batch", required_argument, 0, 'b'},
+            {"batch-prefix", required_argument, 0, 'O'},
+            {"shards", required_argument, 0, 'S'},
+            {"shard-jobs", required_argument, 0, 'j'},
+            {"shard-memory", required_argument, 0, 'M'},
+            {"shard-dir", required_argument, 0, 'd'},
             {"help", no_argument, 0, 'h'},
             {0, 0, 0, 0}
         };
 
         int optionIndex = 0;
-
-        switch(getopt_long(argc, argv, "k:e:t:h", longOptions, &optionIndex)) {
+        
+        switch(getopt_long(argc, argv, "k:e:pG:ogx:Xm:st:PR:c:C:ra:B:T:b:O:S:j:M:d:h", longOptions, &optionIndex)) {
         // Option value is in global optarg
         case -1:
             optionsRemaining = false;
@@ -264,12 +213,75 @@ int main(int argc, char** argv) {
         case 'e': // Set the edge max parameter for kmer enumeration
             edgeMax = atol(optarg);
             break;
+        case 'p': // Find kmers along paths
+            pathKmers = true;
+            break;
+        case 'G': // Merge on alignments
+            gamFile = optarg;
+            break;
         case 'o': // Only merge on kmers
             kmersOnly = true;
             break;
+        case 'g': // Write GFA
+            gfaOutput = true;
+            break;
+        case 'x': // Write an xg index
+            xgFile = optarg;
+            break;
+        case 'X': // Only write the xg index
+            xgOnly = true;
+            break;
+        case 'm': // Chop output nodes
+            coreOptions.maxNodeLength = atol(optarg);
+            break;
+        case 's': // Sort output node IDs
+            coreOptions.sortIds = true;
+            break;
         case 't': // Set the openmp threads
             omp_set_num_threads(atoi(optarg));
             break;
+        case 'P': // Use the native pinch engine
+            nativePinch = true;
+            break;
+        case 'R': // Restrict to a region
+            coregraph::parseRegion(optarg, regionPath, regionStart, regionEnd);
+            break;
+        case 'c': // Set region context
+            regionContext = atol(optarg);
+            break;
+        case 'C': // Save checkpoints
+            checkpointFile = optarg;
+            break;
+        case 'r': // Resume from a checkpoint
+            resume = true;
+            break;
+        case 'a': // Add to a saved core graph
+            addCheckpoint = optarg;
+            break;
+        case 'B': // Limit memory, in MB
+            memoryBudget = atol(optarg) * 1024 * 1024;
+            break;
+        case 'T': // Put scratch files here
+            scratchDirectory = optarg;
+            break;
+        case 'b': // Merge against a list of graphs
+            batchList = optarg;
+            break;
+        case 'O': // Name batch outputs
+            batchPrefix = optarg;
+            break;
+        case 'S': // Split into shards
+            shardCount = atol(optarg);
+            break;
+        case 'j': // Run this many shards at once
+            shardJobs = atol(optarg);
+            break;
+        case 'M': // Limit shard memory, in MB
+            shardMemory = atol(optarg) * 1024 * 1024;
+            break;
+        case 'd': // Put shard files here
+            shardDirectory = optarg;
+            break;
         case 'h': // When the user asks for help
         case '?': // When we get options we can't parse
             help_main(argv);
@@ -282,27 +294,349 @@ int main(int argc, char** argv) {
         }
     }
     
-    if(argc - optind < 2) {
-        // We don't have two positional arguments
+    if(argc - optind < (addCheckpoint.empty() && batchList.empty() ? 2 : 1)) {
+        // We don't have enough positional arguments
         // Print the help
         help_main(argv);
         return 1;
     }
     
-    if(kmersOnly && kmerSize == 0) {
-        // We need a kmer size to use kmers
+    if(kmersOnly && kmerSize == 0 && gamFile.empty()) {
+        // We need a kmer size or alignments to merge on something
         throw std::runtime_error("Can't merge only on kmers with no kmer size");
     }
     
+    if(!gamFile.empty() && (!addCheckpoint.empty() || !batchList.empty() || shardCount)) {
+        // Alignments are of one particular pair of graphs.
+        throw std::runtime_error("Can't merge on alignments when adding to a checkpoint, in batch mode, or in shards");
+    }
+    
+    if(pathKmers && (kmerSize == 0 || kmerSize > 32)) {
+        // Path kmers are kept as 64-bit codes
+        throw std::runtime_error("Can't find kmers along paths without a kmer size of at most 32");
+    }
+    
+    if(xgOnly && xgFile.empty()) {
+        // We need somewhere to put the index
+        throw std::runtime_error("Can't write only an xg index with no xg file");
+    }
+    
+    if(!xgFile.empty() && (!batchList.empty() || shardCount)) {
+        // Batches make many core graphs, and shards are only stitched
+        // together as a stream.
+        throw std::runtime_error("Can't write an xg index in batch or sharded mode");
+    }
+    
+    // Open the xg file now, so we find out it can't be written before doing
+    // all the work.
+    std::ofstream xgStream;
+    if(!xgFile.empty()) {
+        xgStream.open(xgFile);
+        if(!xgStream.good()) {
+            throw std::runtime_error("Could not write " + xgFile);
+        }
+    }
+    std::ostream* coreOut = xgOnly ? nullptr : &std::cout;
+    std::ostream* xgOut = xgFile.empty() ? nullptr : &xgStream;
+    
+    if(!addCheckpoint.empty()) {
+        // Add one more graph to a saved core graph. Only the new graph is
+        // loaded and embedded, and only its paths are traced.
+        if(kmerSize || shardCount || resume) {
+            // The graphs in the checkpoint have no kmer indexes or source
+            // graphs to enumerate kmers from.
+            throw std::runtime_error("Can't add to a saved core graph with kmers, shards, or resuming");
+        }
+        
+        std::string newFile = argv[optind++];
+        
+        int64_t nextId;
+        coregraph::CheckpointPhase phase;
+        bool pathsPinched;
+        coregraph::SequenceStore threadSequences(memoryBudget, scratchDirectory);
+        std::vector<std::unique_ptr<coregraph::EmbeddedGraph>> graphs;
+        std::unique_ptr<coregraph::PinchGraph> pinchGraph = coregraph::makePinchGraph(nativePinch);
+        coregraph::loadCheckpoint(addCheckpoint, *pinchGraph, phase, pathsPinched, nextId, threadSequences, graphs);
+        if(phase < coregraph::CHECKPOINT_PATHS) {
+            throw std::runtime_error("Checkpoint " + addCheckpoint + " is from a merge that never got pinched");
+        }
+        if(!pathsPinched) {
+            // We only pinch each new path against one saved graph, which
+            // only works if the saved graphs' copies are already pinched
+            // together.
+            throw std::runtime_error("Checkpoint " + addCheckpoint + " is from a merge that never got pinched on " +
+                "paths (-o), so graphs can't be added to it");
+        }
+        
+        std::function<int64_t(void)> getId = [&]() {
+            return nextId++;
+        };
+        
+        std::unique_ptr<coregraph::InputGraph> input = coregraph::loadInputGraph(newFile);
+        if(!regionPath.empty()) {
+            input->restrictToRegion(regionPath, regionStart, regionEnd, regionContext);
+        }
+        graphs.emplace_back(input->embed(*pinchGraph, threadSequences, getId));
+        auto& added = graphs.back();
+        
+        if(!added->isCoveredByPaths()) {
+            std::cerr << "WARNING: " << added->getName() << " contains nodes with no paths!" << std::endl;
+        }
+        
+        // The graphs already there are pinched together on their shared
+        // paths, so each of the new graph's paths only needs to be pinched
+        // against the first graph that has it.
+        std::cerr << "Pinching " << added->getName() << " against " << graphs.size() - 1 << " saved graphs..." << std::endl;
+        std::set<std::string> pathsDone;
+        for(size_t i = 0; i + 1 < graphs.size(); i++) {
+            added->pinchWith(*graphs[i], &pathsDone, &threadSequences);
+        }
+        if(pathsDone.empty()) {
+            std::cerr << "WARNING: No shared paths exist to merge on!" << std::endl;
+        }
+        
+        // We don't need the input graph any more
+        added->releaseSource();
+        input.reset();
+        
+        std::vector<coregraph::EmbeddedGraph*> allGraphs;
+        for(auto& graph : graphs) {
+            allGraphs.push_back(graph.get());
+        }
+        
+        if(!checkpointFile.empty()) {
+            // Save the bigger core graph for next time
+            coregraph::saveCheckpoint(checkpointFile, coregraph::CHECKPOINT_PATHS, true, nextId, *pinchGraph,
+                threadSequences, allGraphs);
+        }
+        
+        writeCore(*pinchGraph, threadSequences, allGraphs, coreOptions, gfaOutput, coreOut, xgOut);
+        
+        // The embedded graphs refer to the pinch graph, so they have to go
+        // first.
+        graphs.clear();
+        pinchGraph.reset();
+        return 0;
+    }
+    
+    if(!batchList.empty()) {
+        // Merge one reference with a whole list of graphs. The reference is
+        // loaded once, and its unique kmers are found once. With the native
+        // pinch engine, it is embedded once too, and each graph is merged
+        // into a copy of that; otherwise its embedding is redone for each
+        // graph.
+        if(shardCount || !addCheckpoint.empty() || !checkpointFile.empty()) {
+            throw std::runtime_error("Can't run a batch with shards or checkpoints");
+        }
+        
+        std::string referenceFile = argv[optind++];
+        
+        std::ifstream listStream(batchList);
+        if(!listStream.good()) {
+            std::cerr << "Could not read " << batchList << std::endl;
+            exit(1);
+        }
+        std::vector<std::string> queryFiles;
+        std::string line;
+        while(std::getline(listStream, line)) {
+            if(!line.empty()) {
+                queryFiles.push_back(line);
+            }
+        }
+        
+        for(auto& queryFile : queryFiles) {
+            if(kmerSize && !pathKmers && (coregraph::isXG(queryFile) || coregraph::isGFA(queryFile))) {
+                throw std::runtime_error("Can't merge on kmers with xg or GFA inputs");
+            }
+        }
+        if(kmerSize && !pathKmers && (coregraph::isXG(referenceFile) || coregraph::isGFA(referenceFile))) {
+            throw std::runtime_error("Can't merge on kmers with xg or GFA inputs");
+        }
+        if(!regionPath.empty() && kmerSize && !pathKmers) {
+            // Kmer indexes cover the whole graphs, not the cut-down ones
+            throw std::runtime_error("Can't merge a region on kmers without -p");
+        }
+        
+        // A graph loaded for the batch, with its embedding planned
+        typedef std::pair<std::unique_ptr<coregraph::InputGraph>, std::unique_ptr<coregraph::EmbeddingPlan>>
+            PlannedInput;
+        
+        // Load a graph, cut it down to the region if we have one, and plan
+        // its embedding.
+        auto loadBatchInput = [&](const std::string& filename) {
+            PlannedInput planned;
+            planned.first = coregraph::loadInputGraph(filename);
+            if(!regionPath.empty()) {
+                planned.first->restrictToRegion(regionPath, regionStart, regionEnd, regionContext);
+            }
+            planned.second.reset(new coregraph::EmbeddingPlan());
+            planned.first->planEmbedding(*planned.second);
+            return planned;
+        };
+        
+        // The reference's embedding is only planned once, and then redone
+        // from the plan for each graph.
+        PlannedInput reference = loadBatchInput(referenceFile);
+        
+        // Open the reference index once, and remember its unique kmers once
+        // we have found them.
+        vg::Index* referenceIndex = nullptr;
+        if(kmerSize && !pathKmers) {
+            std::string referenceIndexName = referenceFile + ".index";
+            referenceIndex = new vg::Index();
+            referenceIndex->open_read_only(referenceIndexName);
+        }
+        coregraph::UniqueKmerPaths referenceKmers;
+        bool haveReferenceKmers = false;
+        
+        // The reference's thread sequences stay put between graphs. It is
+        // always embedded first, so its threads always get the same names.
+        coregraph::SequenceStore threadSequences(memoryBudget, scratchDirectory);
+        
+        // A native pinch graph is just arrays, so copying one with the
+        // reference already embedded, and its paths already checked, is
+        // cheaper than embedding it again.
+        std::unique_ptr<coregraph::NativePinchGraph> referencePinchGraph;
+        std::unique_ptr<coregraph::EmbeddedGraph> referenceSnapshot;
+        int64_t referenceNextId = 1;
+        if(nativePinch) {
+            std::function<int64_t(void)> getId = [&]() {
+                return referenceNextId++;
+            };
+            referencePinchGraph.reset(new coregraph::NativePinchGraph());
+            referenceSnapshot.reset(reference.first->embed(*referencePinchGraph, threadSequences, getId,
+                reference.second.get()));
+            referenceSnapshot->validatePaths();
+            // The plan won't be used again
+            reference.second.reset();
+        }
+        
+        // Load the next graph while we merge this one
+        std::future<PlannedInput> nextQuery;
+        if(!queryFiles.empty()) {
+            nextQuery = std::async(std::launch::async, loadBatchInput, queryFiles[0]);
+        }
+        
+        for(size_t i = 0; i < queryFiles.size(); i++) {
+            std::cerr << "Merging " << referenceFile << " with " << queryFiles[i] << " (" << i + 1 << " of " <<
+                queryFiles.size() << ")" << std::endl;
+            
+            int64_t nextId = 1;
+            std::function<int64_t(void)> getId = [&]() {
+                return nextId++;
+            };
+            std::unique_ptr<coregraph::PinchGraph> pinchGraph;
+            std::unique_ptr<coregraph::EmbeddedGraph> referenceEmbedding;
+            if(referenceSnapshot) {
+                pinchGraph.reset(new coregraph::NativePinchGraph(*referencePinchGraph));
+                referenceEmbedding.reset(new coregraph::EmbeddedGraph(*referenceSnapshot, *pinchGraph));
+                nextId = referenceNextId;
+            } else {
+                pinchGraph = coregraph::makePinchGraph(nativePinch);
+                referenceEmbedding.reset(reference.first->embed(*pinchGraph, threadSequences, getId,
+                    reference.second.get()));
+            }
+            int64_t firstQueryThread = nextId;
+            
+            PlannedInput query = nextQuery.get();
+            if(i + 1 < queryFiles.size()) {
+                nextQuery = std::async(std::launch::async, loadBatchInput, queryFiles[i + 1]);
+            }
+            std::unique_ptr<coregraph::EmbeddedGraph> queryEmbedding(query.first->embed(*pinchGraph, threadSequences,
+                getId, query.second.get()));
+            // The query's plan is done with as soon as it is applied
+            query.second.reset();
+            
+            if(!kmersOnly) {
+                if(!queryEmbedding->isCoveredByPaths()) {
+                    std::cerr << "WARNING: " << queryEmbedding->getName() << " contains nodes with no paths!" << std::endl;
+                }
+                referenceEmbedding->pinchWith(*queryEmbedding, nullptr, &threadSequences);
+            }
+            
+            if(kmerSize > 0 && pathKmers && memoryBudget) {
+                // Keeping the reference's kmer table around could blow the
+                // budget, so join each pair afresh, on disk if need be.
+                std::cerr << "Pinching graphs on shared " << kmerSize << "-mers..." << std::endl;
+                referenceEmbedding->pinchOnPathKmers(*queryEmbedding, kmerSize, threadSequences, memoryBudget,
+                    scratchDirectory);
+            } else if(kmerSize > 0) {
+                if(!haveReferenceKmers) {
+                    if(pathKmers) {
+                        referenceEmbedding->collectUniquePathKmers(referenceKmers, kmerSize, threadSequences);
+                    } else {
+                        referenceEmbedding->collectUniqueKmers(*referenceIndex, referenceKmers, kmerSize, edgeMax);
+                    }
+                    haveReferenceKmers = true;
+                }
+                
+                coregraph::UniqueKmerPaths queryKmers;
+                if(pathKmers) {
+                    queryEmbedding->collectUniquePathKmers(queryKmers, kmerSize, threadSequences);
+                } else {
+                    std::string queryIndexName = queryFiles[i] + ".index";
+                    vg::Index queryIndex;
+                    queryIndex.open_read_only(queryIndexName);
+                    queryEmbedding->collectUniqueKmers(queryIndex, queryKmers, kmerSize, edgeMax);
+                }
+                
+                std::cerr << "Pinching graphs on shared " << kmerSize << "-mers..." << std::endl;
+                referenceEmbedding->pinchOnUniqueKmers(referenceKmers, *queryEmbedding, queryKmers, kmerSize);
+            }
+            
+            // We don't need the query graph any more. The reference has to
+            // stay for the next query.
+            queryEmbedding->releaseSource();
+            query.first.reset();
+            
+            std::string outputFile = batchPrefix + "." + std::to_string(i + 1) + (gfaOutput ? ".gfa" : ".vg");
+            std::ofstream output(outputFile);
+            if(!output.good()) {
+                throw std::runtime_error("Could not write " + outputFile);
+            }
+            writeCore(*pinchGraph, threadSequences, {referenceEmbedding.get(), queryEmbedding.get()},
+                coreOptions, gfaOutput, &output);
+            std::cerr << "Wrote core graph for " << queryFiles[i] << " to " << outputFile << std::endl;
+            
+            // Throw out everything but the reference's sequences
+            queryEmbedding.reset();
+            referenceEmbedding.reset();
+            pinchGraph.reset();
+            threadSequences.eraseFrom(firstQueryThread);
+        }
+        
+        if(referenceIndex != nullptr) {
+            delete referenceIndex;
+        }
+        
+        // The snapshot refers to its pinch graph, so it has to go first
+        referenceSnapshot.reset();
+        referencePinchGraph.reset();
+        
+        return 0;
+    }
+    
     // Pull out the VG file names
     std::string vgFile1 = argv[optind++];
     std::string vgFile2 = argv[optind++];
     
+    if(kmerSize && !pathKmers && (coregraph::isXG(vgFile1) || coregraph::isXG(vgFile2) || coregraph::isGFA(vgFile1) ||
+        coregraph::isGFA(vgFile2))) {
+        // We can only enumerate kmers in vg graphs
+        throw std::runtime_error("Can't merge on kmers with xg or GFA inputs");
+    }
+    
+    if(!regionPath.empty() && ((kmerSize && !pathKmers) || shardCount)) {
+        // Kmer indexes cover the whole graphs, and regions are already small
+        throw std::runtime_error("Can't merge a region on kmers or in shards");
+    }
+    
     // Guess index names (TODO: add options)
     std::string indexDir1 = vgFile1 + ".index";
     std::string indexDir2 = vgFile2 + ".index";
     
-    // Open the files
+    // Make sure we can open the files before we start loading anything. The
+    // actual loading opens them again.
     std::ifstream vgStream1(vgFile1);
     if(!vgStream1.good()) {
         std::cerr << "Could not read " << vgFile1 << std::endl;
@@ -315,13 +649,72 @@ int main(int argc, char** argv) {
         exit(1);
     }
     
+    if(shardCount > 0) {
+        // Split the inputs up and merge each piece in its own process, so no
+        // one process needs to hold the whole pinch graph.
+        if(kmerSize) {
+            // Kmers could join things that aren't on shared paths
+            throw std::runtime_error("Can't merge on kmers in sharded mode");
+        }
+        if(!checkpointFile.empty() || resume) {
+            // Each shard is its own merge, and we don't pass checkpoints on
+            throw std::runtime_error("Can't checkpoint or resume in sharded mode");
+        }
+        
+        std::vector<coregraph::Shard> shards;
+        {
+            std::future<std::unique_ptr<coregraph::InputGraph>> input2Future =
+                std::async(std::launch::async, coregraph::loadInputGraph, vgFile2);
+            std::unique_ptr<coregraph::InputGraph> input1 = coregraph::loadInputGraph(vgFile1);
+            std::unique_ptr<coregraph::InputGraph> input2 = input2Future.get();
+            
+            std::cerr << "Splitting graphs into up to " << shardCount << " shards..." << std::endl;
+            shards = coregraph::splitIntoShards(*input1, *input2, shardCount, shardDirectory, gfaOutput);
+            
+            // The inputs go away here, before the shards run
+        }
+        
+        // Pass along the options that affect the merge, and split the threads
+        // among the jobs.
+        std::vector<std::string> shardArguments;
+        if(gfaOutput) {
+            shardArguments.push_back("-g");
+        }
+        if(coreOptions.maxNodeLength) {
+            shardArguments.push_back("-m");
+            shardArguments.push_back(std::to_string(coreOptions.maxNodeLength));
+        }
+        if(coreOptions.sortIds) {
+            shardArguments.push_back("-s");
+        }
+        if(nativePinch) {
+            shardArguments.push_back("-P");
+        }
+        if(memoryBudget) {
+            shardArguments.push_back("-B");
+            shardArguments.push_back(std::to_string(memoryBudget / 1024 / 1024));
+            shardArguments.push_back("-T");
+            shardArguments.push_back(scratchDirectory);
+        }
+        shardArguments.push_back("-t");
+        shardArguments.push_back(std::to_string(std::max(1, omp_get_max_threads() / (int) std::max(shardJobs, (size_t) 1))));
+        
+        coregraph::runShards(argv[0], shards, shardArguments, shardJobs, shardMemory);
+        
+        std::cerr << "Stitching " << shards.size() << " shards together..." << std::endl;
+        coregraph::stitchShards(shards, gfaOutput, std::cout);
+        
+        return 0;
+    }
+    
     // We may have indexes. We need to use pointers because destructing an index
     // that was never opened segfaults. TODO: fix vg
     vg::Index* index1 = nullptr;
     vg::Index* index2 = nullptr;
     
-    if(kmerSize) {
-        // Only go looking for indexes if we want to merge on kmers.
+    if(kmerSize && !pathKmers) {
+        // Only go looking for indexes if we want to merge on kmers found
+        // through the whole graphs.
         index1 = new vg::Index();
         index1->open_read_only(indexDir1);
         index2 = new vg::Index();
@@ -329,11 +722,16 @@ int main(int argc, char** argv) {
     }
     
     
-    // Load up the first VG file
-    vg::VG vg1(vgStream1);
-    // And the second
-    vg::VG vg2(vgStream2);
-    
+    // Load a graph, and cut it down to the region if we have one.
+    std::function<std::unique_ptr<coregraph::InputGraph>(const std::string&)> loadInput =
+        [&](const std::string& filename) {
+        
+        std::unique_ptr<coregraph::InputGraph> input = coregraph::loadInputGraph(filename);
+        if(!regionPath.empty()) {
+            input->restrictToRegion(regionPath, regionStart, regionEnd, regionContext);
+        }
+        return input;
+    };
     
     // Make a way to track IDs
     int64_t nextId = 1;
@@ -341,52 +739,159 @@ int main(int argc, char** argv) {
         return nextId++;
     };
     
-    // Make a thread set
-    auto threadSet = stPinchThreadSet_construct();
-    
     // Make a place to keep track of the thread sequences.
     // This will only contain sequences for threads that aren't staples.
     // TODO: should this be by pointer instead?
-    std::map<int64_t, std::string> threadSequences;
+    coregraph::SequenceStore threadSequences(memoryBudget, scratchDirectory);
+    
+    // Make a pinch graph to embed the graphs in. It has to outlive the
+    // embeddings, which refer to it.
+    std::unique_ptr<coregraph::PinchGraph> pinchGraph = coregraph::makePinchGraph(nativePinch);
+    std::unique_ptr<coregraph::InputGraph> input1;
+    std::unique_ptr<coregraph::InputGraph> input2;
+    std::unique_ptr<coregraph::EmbeddedGraph> embedding1;
+    std::unique_ptr<coregraph::EmbeddedGraph> embedding2;
+    
+    // How far along are we, and have we pinched on paths?
+    coregraph::CheckpointPhase phase = coregraph::CHECKPOINT_NONE;
+    bool pathsPinched = false;
+    
+    // Save our progress, if we are checkpointing
+    auto checkpoint = [&](coregraph::CheckpointPhase reached) {
+        phase = reached;
+        if(!checkpointFile.empty()) {
+            coregraph::saveCheckpoint(checkpointFile, phase, pathsPinched, nextId, *pinchGraph, threadSequences,
+                {embedding1.get(), embedding2.get()});
+        }
+    };
+    
+    if(resume && !checkpointFile.empty() && std::ifstream(checkpointFile).good()) {
+        // Pick up where we left off
+        std::vector<std::unique_ptr<coregraph::EmbeddedGraph>> restored;
+        coregraph::loadCheckpoint(checkpointFile, *pinchGraph, phase, pathsPinched, nextId, threadSequences,
+            restored);
+        if(restored.size() != 2) {
+            throw std::runtime_error("Checkpoint " + checkpointFile + " does not have two graphs");
+        }
+        if(phase >= coregraph::CHECKPOINT_PATHS && pathsPinched == kmersOnly) {
+            // We would skip or redo pinching on paths
+            throw std::runtime_error("Checkpoint " + checkpointFile + " was " + (pathsPinched ? "" : "not ") +
+                "pinched on paths, so resume it " + (pathsPinched ? "without" : "with") + " -o");
+        }
+        embedding1 = std::move(restored[0]);
+        embedding2 = std::move(restored[1]);
+        std::cerr << "Resuming after phase " << phase << " of " << coregraph::CHECKPOINT_KMERS << std::endl;
+        
+        if(kmerSize > 0 && !pathKmers && phase < coregraph::CHECKPOINT_KMERS) {
+            // We need the actual graphs to find kmers in. Path kmers come
+            // from the saved paths.
+            std::future<std::unique_ptr<coregraph::InputGraph>> input2Future =
+                std::async(std::launch::async, loadInput, vgFile2);
+            input1 = loadInput(vgFile1);
+            input2 = input2Future.get();
+            embedding1->attachGraph(*input1->vg);
+            embedding2->attachGraph(*input2->vg);
+        }
+    } else {
+        // Start loading the second graph, and planning its embedding, in the
+        // background, so that happens while the first one is being loaded,
+        // planned, and embedded. Plans only read their graphs; only applying
+        // them to the pinch graph has to be done one graph at a time.
+        coregraph::EmbeddingPlan plan2;
+        std::future<void> input2Future = std::async(std::launch::async, [&]() {
+            input2 = loadInput(vgFile2);
+            input2->planEmbedding(plan2);
+        });
+        
+        {
+            // Load up the first graph here, and plan its embedding.
+            input1 = loadInput(vgFile1);
+            coregraph::EmbeddingPlan plan1;
+            input1->planEmbedding(plan1);
+            
+            // Add in the first graph to the pinch graph, while the second is
+            // loading
+            embedding1.reset(input1->embed(*pinchGraph, threadSequences, getId, &plan1));
+        }
+        
+        // Wait for the second graph's plan, and add it in too
+        input2Future.get();
+        embedding2.reset(input2->embed(*pinchGraph, threadSequences, getId, &plan2));
+        
+        checkpoint(coregraph::CHECKPOINT_EMBEDDED);
+    }
     
-    // Add in each vg graph to the thread set
-    coregraph::EmbeddedGraph embedding1(vg1, threadSet, threadSequences, getId, vgFile1);
-    coregraph::EmbeddedGraph embedding2(vg2, threadSet, threadSequences, getId, vgFile2);
+    if(!gamFile.empty() && phase < coregraph::CHECKPOINT_PATHS) {
+        // Pinch along the alignments as they stream in
+        std::ifstream gamStream(gamFile);
+        if(!gamStream.good()) {
+            throw std::runtime_error("Could not read " + gamFile);
+        }
+        std::cerr << "Pinching graphs on alignments in " << gamFile << "..." << std::endl;
+        size_t alignmentCount = 0;
+        size_t pinchedBases = 0;
+        coregraph::forEachAlignmentBatch(gamStream, [&](const std::vector<vg::Alignment>& alignments, size_t count) {
+            pinchedBases += embedding1->pinchOnAlignments(alignments, count, *embedding2);
+            alignmentCount += count;
+        });
+        std::cerr << "Pinched on " << pinchedBases << " bp matched by " << alignmentCount << " alignments." <<
+            std::endl;
+    }
     
-    if(!kmersOnly) {
+    if(!kmersOnly && phase < coregraph::CHECKPOINT_PATHS) {
         // We want to merge on shared paths in addition to kmers
     
         // Complain if any of the graphs is not completely covered by paths
-        if(!embedding1.isCoveredByPaths()) {
-            std::cerr << "WARNING: " << embedding1.getName() << " contains nodes with no paths!" << std::endl;
+        if(!embedding1->isCoveredByPaths()) {
+            std::cerr << "WARNING: " << embedding1->getName() << " contains nodes with no paths!" << std::endl;
         }
-        if(!embedding2.isCoveredByPaths()) {
-            std::cerr << "WARNING: " << embedding2.getName() << " contains nodes with no paths!" << std::endl;
+        if(!embedding2->isCoveredByPaths()) {
+            std::cerr << "WARNING: " << embedding2->getName() << " contains nodes with no paths!" << std::endl;
         }
         
         // Trace the paths and merge the embedded graphs.
         std::cerr << "Pinching graphs on shared paths..." << std::endl;
-        embedding1.pinchWith(embedding2);
+        embedding1->pinchWith(*embedding2, nullptr, &threadSequences);
+        pathsPinched = true;
+        
+        checkpoint(coregraph::CHECKPOINT_PATHS);
     }
     
-    if(kmerSize > 0) {
+    if(kmerSize > 0 && phase < coregraph::CHECKPOINT_KMERS) {
         // Merge on kmers that are unique in both graphs.
         std::cerr << "Pinching graphs on shared " << kmerSize << "-mers..." << std::endl;
-        embedding1.pinchOnKmers(*index1, embedding2, *index2, kmerSize, edgeMax);
+        if(pathKmers) {
+            // Kmers off the paths would be missed
+            if(!embedding1->isCoveredByPaths() || !embedding2->isCoveredByPaths()) {
+                std::cerr << "WARNING: kmers on nodes with no paths will not be found!" << std::endl;
+            }
+            embedding1->pinchOnPathKmers(*embedding2, kmerSize, threadSequences, memoryBudget, scratchDirectory);
+        } else {
+            embedding1->pinchOnKmers(*index1, *embedding2, *index2, kmerSize, edgeMax);
+        }
+        
+        checkpoint(coregraph::CHECKPOINT_KMERS);
     }
     
-    // Fix trivial joins so we don't produce more vg nodes than we really need to.
-    stPinchThreadSet_joinTrivialBoundaries(threadSet);
-    
-    // Make another vg graph from the thread set
-    vg::VG core = pinchToVG(threadSet, threadSequences);
+    // The core graph only needs the pinch graph, the thread sequences, and the
+    // cached paths, so free the input graphs and indexes before building it.
+    embedding1->releaseSource();
+    embedding2->releaseSource();
+    input1.reset();
+    input2.reset();
+    if(index1 != nullptr) {
+        delete index1;
+        delete index2;
+    }
     
-    // Spit it out to standard output
-    core.serialize_to_ostream(std::cout);
+    writeCore(*pinchGraph, threadSequences, {embedding1.get(), embedding2.get()}, coreOptions, gfaOutput,
+        coreOut, xgOut);
     
-    // Tear everything down. TODO: can we somehow run this destruction function
-    // after all our other, potentially depending locals are destructed?
-    stPinchThreadSet_destruct(threadSet);
+    // Tear everything down. The embeddings refer to the pinch graph, so they
+    // go first.
+    embedding1.reset();
+    embedding2.reset();
+    pinchGraph.reset();
     
     return 0;
 }
@@ -0,0 +1,69 @@
+#include "mappedFile.hpp"
+
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace coregraph {
+
+MappedFile::MappedFile(const std::string& filename, bool sequential) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd == -1) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+    
+    struct stat fileStats;
+    if(fstat(fd, &fileStats) == -1) {
+        close(fd);
+        throw std::runtime_error("Could not stat " + filename);
+    }
+    length = fileStats.st_size;
+    
+    if(length > 0) {
+        // You can't map an empty file, so only map when there's something there.
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Could not map " + filename);
+        }
+        // Say how we're going to read it
+        madvise(mapped, length, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+        start = (const char*) mapped;
+    }
+    
+    // The mapping stays valid after the file is closed.
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if(start != nullptr) {
+        munmap((void*) start, length);
+    }
+}
+
+const char* MappedFile::data() const {
+    return start;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
+
+std::string makeScratchFile(const std::string& directory) {
+    std::string pattern = directory + "/corg-scratch-XXXXXX";
+    std::vector<char> filename(pattern.begin(), pattern.end());
+    filename.push_back('\0');
+    int fd = mkstemp(filename.data());
+    if(fd == -1) {
+        throw std::runtime_error("Could not make a scratch file in " + directory);
+    }
+    close(fd);
+    return std::string(filename.data());
+}
+
+}
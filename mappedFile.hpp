@@ -0,0 +1,54 @@
+#ifndef COREGRAPH_MAPPEDFILE_HPP
+#define COREGRAPH_MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace coregraph {
+
+/**
+ * A read-only memory mapping of a whole file. The mapping is torn down when
+ * the object is destroyed.
+ */
+class MappedFile {
+public:
+    /**
+     * Map the given file. Throws std::runtime_error if the file can't be
+     * opened or mapped. If sequential is set, the OS is told the file will be
+     * read front to back; otherwise it is told to expect reads anywhere.
+     */
+    MappedFile(const std::string& filename, bool sequential = true);
+    
+    ~MappedFile();
+    
+    // We own the mapping, so we can't be copied.
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+    
+    /**
+     * Get the start of the mapped data.
+     */
+    const char* data() const;
+    
+    /**
+     * Get the number of mapped bytes.
+     */
+    size_t size() const;
+    
+protected:
+    // Where the file is mapped, or nullptr for an empty file
+    const char* start = nullptr;
+    // How long it is
+    size_t length = 0;
+};
+
+/**
+ * Make a new, empty scratch file with a unique name in the given directory,
+ * and return its name. The caller is responsible for removing it. Throws
+ * std::runtime_error if the file can't be made.
+ */
+std::string makeScratchFile(const std::string& directory);
+
+}
+
+#endif
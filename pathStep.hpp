@@ -0,0 +1,32 @@
+#ifndef COREGRAPH_PATHSTEP_HPP
+#define COREGRAPH_PATHSTEP_HPP
+
+#include <cstdint>
+#include <functional>
+
+namespace coregraph {
+
+/**
+ * A perfect-match visit to a run of bases on a node, as seen along a path.
+ */
+struct PathStep {
+    // The node visited
+    int64_t nodeId;
+    // The first base visited, counted along the node's forward strand. Reverse
+    // steps start at their highest base and go left from there.
+    int64_t offset;
+    // True if the node is read on its reverse strand
+    bool isReverse;
+    // How many bases are visited
+    int64_t length;
+};
+
+/**
+ * A source of PathSteps walking along a path. Fills in the next step and
+ * returns true, or returns false when the path has run out.
+ */
+typedef std::function<bool(PathStep&)> PathCursor;
+
+}
+
+#endif
@@ -0,0 +1,780 @@
+#include "pinchGraph.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <omp.h>
+
+namespace coregraph {
+
+const size_t FlatPinchGraph::NO_BLOCK;
+const size_t NativePinchGraph::MIN_COMPACT_PINCHES;
+
+size_t FlatPinchGraph::threadCount() const {
+    return threadNames.size();
+}
+
+size_t FlatPinchGraph::blockCount() const {
+    return blockSegments.empty() ? 0 : blockSegments.size() - 1;
+}
+
+size_t FlatPinchGraph::findThread(int64_t name) const {
+    auto found = std::lower_bound(threadNames.begin(), threadNames.end(), name);
+    if(found == threadNames.end() || *found != name) {
+        throw std::runtime_error("No pinch thread named " + std::to_string(name));
+    }
+    return found - threadNames.begin();
+}
+
+size_t FlatPinchGraph::findSegment(size_t thread, int64_t position) const {
+    // Find the last segment on the thread starting at or before the position
+    auto first = segmentStarts.begin() + threadSegments[thread];
+    auto last = segmentStarts.begin() + threadSegments[thread + 1];
+    return std::upper_bound(first, last, position) - segmentStarts.begin() - 1;
+}
+
+int64_t FlatPinchGraph::getSegmentName(size_t segment) const {
+    return threadNames[segmentThreads[segment]];
+}
+
+size_t FlatPinchGraph::getLeader(size_t segment) const {
+    size_t block = segmentBlocks[segment];
+    return block == NO_BLOCK ? segment : blockMembers[blockSegments[block]];
+}
+
+bool FlatPinchGraph::getOrientation(size_t segment) const {
+    return segmentBlocks[segment] == NO_BLOCK ? false : !segmentOrientations[segment];
+}
+
+/**
+ * A union-find over numbered items that also tracks whether each item faces
+ * the same way as or the opposite way from the root of its set.
+ */
+struct OrientedUnionFind {
+    std::vector<size_t> parent;
+    // Whether each item is flipped relative to its parent
+    std::vector<bool> flipped;
+    std::vector<size_t> size;
+    // Whether each root's set has been joined to itself the other way
+    std::vector<bool> twisted;
+    
+    OrientedUnionFind(size_t count): parent(count), flipped(count, false), size(count, 1), twisted(count, false) {
+        for(size_t i = 0; i < count; i++) {
+            parent[i] = i;
+        }
+    }
+    
+    /**
+     * Find the root of an item's set, and whether the item is flipped
+     * relative to it.
+     */
+    std::pair<size_t, bool> find(size_t item) {
+        // Find the root
+        size_t root = item;
+        bool rootFlipped = false;
+        while(parent[root] != root) {
+            rootFlipped = rootFlipped != flipped[root];
+            root = parent[root];
+        }
+        
+        // Point everything on the way straight at it
+        bool itemFlipped = rootFlipped;
+        while(parent[item] != root) {
+            size_t next = parent[item];
+            bool nextFlipped = rootFlipped != flipped[item];
+            parent[item] = root;
+            flipped[item] = rootFlipped;
+            item = next;
+            rootFlipped = nextFlipped;
+        }
+        
+        return std::make_pair(root, itemFlipped);
+    }
+    
+    /**
+     * Join the sets of two items, with the second flipped relative to the
+     * first if flip is set. If they are already together, nothing changes,
+     * except that the set is marked as twisted if they were joined the other
+     * way.
+     */
+    void join(size_t item1, size_t item2, bool flip) {
+        auto found1 = find(item1);
+        auto found2 = find(item2);
+        if(found1.first == found2.first) {
+            if(found1.second != found2.second != flip) {
+                twisted[found1.first] = true;
+            }
+            return;
+        }
+        
+        // Hang the smaller set off the bigger one
+        bool rootFlip = found1.second != found2.second != flip;
+        if(size[found1.first] < size[found2.first]) {
+            std::swap(found1, found2);
+        }
+        parent[found2.first] = found1.first;
+        flipped[found2.first] = rootFlip;
+        size[found1.first] += size[found2.first];
+        twisted[found1.first] = twisted[found1.first] || twisted[found2.first];
+    }
+};
+
+/**
+ * Make blocks out of the sets of segments in a union-find, for a
+ * FlatPinchGraph with its threads and segments already filled in. Sets of just
+ * one segment don't make blocks. Blocks are numbered in the order of their
+ * first segments, which lead them, and their segments are listed in order.
+ */
+void makeBlocks(FlatPinchGraph& flat, OrientedUnionFind& sets) {
+    size_t segmentCount = flat.segmentStarts.size();
+    flat.segmentBlocks.assign(segmentCount, FlatPinchGraph::NO_BLOCK);
+    flat.segmentOrientations.assign(segmentCount, true);
+    
+    // Number the blocks by their roots, and count their segments
+    std::vector<size_t> blockOfRoot(segmentCount, FlatPinchGraph::NO_BLOCK);
+    std::vector<bool> rootFlipped(segmentCount, false);
+    std::vector<size_t> blockSizes;
+    for(size_t i = 0; i < segmentCount; i++) {
+        auto found = sets.find(i);
+        if(sets.size[found.first] < 2) {
+            continue;
+        }
+        if(blockOfRoot[found.first] == FlatPinchGraph::NO_BLOCK) {
+            // This is the leader. Everything faces the way it is relative to
+            // the leader.
+            blockOfRoot[found.first] = blockSizes.size();
+            rootFlipped[found.first] = found.second;
+            blockSizes.push_back(0);
+        }
+        size_t block = blockOfRoot[found.first];
+        flat.segmentBlocks[i] = block;
+        flat.segmentOrientations[i] = (found.second == rootFlipped[found.first]);
+        blockSizes[block]++;
+    }
+    
+    // Lay out the members of each block, in segment order
+    flat.blockSegments.assign(blockSizes.size() + 1, 0);
+    for(size_t i = 0; i < blockSizes.size(); i++) {
+        flat.blockSegments[i + 1] = flat.blockSegments[i] + blockSizes[i];
+    }
+    flat.blockMembers.resize(flat.blockSegments.back());
+    std::vector<size_t> filled(flat.blockSegments.begin(), flat.blockSegments.end() - 1);
+    for(size_t i = 0; i < segmentCount; i++) {
+        if(flat.segmentBlocks[i] != FlatPinchGraph::NO_BLOCK) {
+            flat.blockMembers[filled[flat.segmentBlocks[i]]++] = i;
+        }
+    }
+}
+
+SonLibPinchGraph::SonLibPinchGraph(): threadSet(stPinchThreadSet_construct()) {
+    // Nothing to do
+}
+
+SonLibPinchGraph::~SonLibPinchGraph() {
+    stPinchThreadSet_destruct(threadSet);
+}
+
+stPinchThread* SonLibPinchGraph::getThread(int64_t name) {
+    stPinchThread* thread = stPinchThreadSet_getThread(threadSet, name);
+    if(thread == nullptr) {
+        throw std::runtime_error("No pinch thread named " + std::to_string(name));
+    }
+    return thread;
+}
+
+void SonLibPinchGraph::addThread(int64_t name, int64_t start, int64_t length) {
+    stPinchThreadSet_addThread(threadSet, name, start, length);
+}
+
+bool SonLibPinchGraph::hasThread(int64_t name) {
+    return stPinchThreadSet_getThread(threadSet, name) != nullptr;
+}
+
+int64_t SonLibPinchGraph::getThreadLength(int64_t name) {
+    return stPinchThread_getLength(getThread(name));
+}
+
+void SonLibPinchGraph::pinch(int64_t name1, int64_t name2, int64_t start1, int64_t start2, int64_t length,
+    bool strand) {
+    stPinchThread_pinch(getThread(name1), getThread(name2), start1, start2, length, strand);
+}
+
+void SonLibPinchGraph::joinTrivialBoundaries() {
+    stPinchThreadSet_joinTrivialBoundaries(threadSet);
+}
+
+void SonLibPinchGraph::flatten(FlatPinchGraph& flat) {
+    flat = FlatPinchGraph();
+    
+    // Put the threads in name order
+    std::vector<stPinchThread*> threads;
+    auto threadIterator = stPinchThreadSet_getIt(threadSet);
+    while(auto thread = stPinchThreadSetIt_getNext(&threadIterator)) {
+        threads.push_back(thread);
+    }
+    std::sort(threads.begin(), threads.end(), [](stPinchThread* a, stPinchThread* b) {
+        return stPinchThread_getName(a) < stPinchThread_getName(b);
+    });
+    
+    // Number the segments along each thread in turn
+    std::unordered_map<stPinchSegment*, size_t> segmentIndex;
+    for(size_t i = 0; i < threads.size(); i++) {
+        flat.threadNames.push_back(stPinchThread_getName(threads[i]));
+        flat.threadStarts.push_back(stPinchThread_getStart(threads[i]));
+        flat.threadLengths.push_back(stPinchThread_getLength(threads[i]));
+        flat.threadSegments.push_back(flat.segmentStarts.size());
+        
+        for(auto segment = stPinchThread_getFirst(threads[i]); segment != nullptr;
+            segment = stPinchSegment_get3Prime(segment)) {
+            
+            segmentIndex[segment] = flat.segmentStarts.size();
+            flat.segmentThreads.push_back(i);
+            flat.segmentStarts.push_back(stPinchSegment_getStart(segment));
+            flat.segmentLengths.push_back(stPinchSegment_getLength(segment));
+        }
+    }
+    flat.threadSegments.push_back(flat.segmentStarts.size());
+    
+    // Tie each block's segments together the way they face. Then lay the
+    // blocks out the same way the native engine does, so both engines pick
+    // the same leaders, and so the same core graph, whatever order sonLib
+    // keeps its blocks and their segments in.
+    OrientedUnionFind sets(flat.segmentStarts.size());
+    auto blockIterator = stPinchThreadSet_getBlockIt(threadSet);
+    while(auto block = stPinchThreadSetBlockIt_getNext(&blockIterator)) {
+        auto first = stPinchBlock_getFirst(block);
+        size_t firstIndex = segmentIndex.at(first);
+        bool firstOrientation = stPinchSegment_getBlockOrientation(first);
+        auto segmentIterator = stPinchBlock_getSegmentIterator(block);
+        while(auto segment = stPinchBlockIt_getNext(&segmentIterator)) {
+            if(segment != first) {
+                sets.join(firstIndex, segmentIndex.at(segment),
+                    stPinchSegment_getBlockOrientation(segment) != firstOrientation);
+            }
+        }
+    }
+    
+    makeBlocks(flat, sets);
+}
+
+/**
+ * Index intervals, sorted by start, for findCovering(). The sorted array is
+ * read as an implicit balanced binary tree, as in Heng Li's cgranges, and
+ * each entry gets the greatest end in its subtree. Takes the ends of the
+ * intervals, and fills in maxEnds alongside. Returns the level of the root,
+ * or -1 if there are no intervals.
+ */
+int indexIntervals(const int64_t* ends, int64_t* maxEnds, size_t count) {
+    if(count == 0) {
+        return -1;
+    }
+    
+    // Leaves are at the even indexes
+    size_t lastIndex = 0;
+    int64_t last = 0;
+    for(size_t i = 0; i < count; i += 2) {
+        lastIndex = i;
+        last = maxEnds[i] = ends[i];
+    }
+    
+    // Each level up takes in the two subtrees below it. The last node at each
+    // level may be missing its right subtree, so we carry the greatest end
+    // along the right edge of the tree in last.
+    int level;
+    for(level = 1; ((size_t) 1 << level) <= count; level++) {
+        size_t half = (size_t) 1 << (level - 1);
+        for(size_t i = (half << 1) - 1; i < count; i += half << 2) {
+            int64_t leftEnd = maxEnds[i - half];
+            int64_t rightEnd = i + half < count ? maxEnds[i + half] : last;
+            maxEnds[i] = std::max(ends[i], std::max(leftEnd, rightEnd));
+        }
+        lastIndex = (lastIndex >> level & 1) ? lastIndex - half : lastIndex + half;
+        if(lastIndex < count && maxEnds[lastIndex] > last) {
+            last = maxEnds[lastIndex];
+        }
+    }
+    return level - 1;
+}
+
+/**
+ * Find the intervals indexed by indexIntervals() that have the given point
+ * strictly inside them: starting before it, and ending after it. Adds their
+ * indexes to the given vector. Subtrees that all end at or before the point
+ * are never visited, so this takes time in proportion to the number of
+ * intervals found, plus the log of the number there are.
+ */
+void findCovering(const int64_t* starts, const int64_t* ends, const int64_t* maxEnds, size_t count,
+    int rootLevel, int64_t point, std::vector<size_t>& found) {
+    
+    if(count == 0) {
+        return;
+    }
+    
+    // A tree node still to look at, and whether its left subtree is done
+    struct Frame {
+        int level;
+        size_t index;
+        bool leftDone;
+    };
+    Frame stack[64];
+    size_t depth = 0;
+    stack[depth++] = Frame{rootLevel, ((size_t) 1 << rootLevel) - 1, false};
+    
+    while(depth > 0) {
+        Frame frame = stack[--depth];
+        if(frame.level <= 3) {
+            // Small subtrees are quicker to just scan
+            size_t first = frame.index >> frame.level << frame.level;
+            size_t last = std::min(first + ((size_t) 1 << (frame.level + 1)) - 1, count);
+            for(size_t i = first; i < last && starts[i] < point; i++) {
+                if(point < ends[i]) {
+                    found.push_back(i);
+                }
+            }
+        } else if(!frame.leftDone) {
+            // Come back for this node and its right subtree, after the left
+            // one, if anything there could reach the point.
+            size_t left = frame.index - ((size_t) 1 << (frame.level - 1));
+            frame.leftDone = true;
+            stack[depth++] = frame;
+            if(left >= count || maxEnds[left] > point) {
+                stack[depth++] = Frame{frame.level - 1, left, false};
+            }
+        } else if(frame.index < count && starts[frame.index] < point) {
+            // Everything to the right starts later, so only bother if this
+            // one starts before the point.
+            if(point < ends[frame.index]) {
+                found.push_back(frame.index);
+            }
+            stack[depth++] = Frame{frame.level - 1, frame.index + ((size_t) 1 << (frame.level - 1)), false};
+        }
+    }
+}
+
+size_t NativePinchGraph::getThread(int64_t name) {
+    auto found = threadIndex.find(name);
+    if(found == threadIndex.end()) {
+        throw std::runtime_error("No pinch thread named " + std::to_string(name));
+    }
+    return found->second;
+}
+
+void NativePinchGraph::addThread(int64_t name, int64_t start, int64_t length) {
+    if(threadIndex.count(name)) {
+        throw std::runtime_error("Duplicate pinch thread " + std::to_string(name));
+    }
+    forgetFlattened();
+    threadIndex[name] = threads.size();
+    threads.push_back(Thread{name, start, length});
+}
+
+bool NativePinchGraph::hasThread(int64_t name) {
+    return threadIndex.count(name);
+}
+
+int64_t NativePinchGraph::getThreadLength(int64_t name) {
+    return threads[getThread(name)].length;
+}
+
+void NativePinchGraph::pinch(int64_t name1, int64_t name2, int64_t start1, int64_t start2, int64_t length,
+    bool strand) {
+    
+    if(length <= 0) {
+        // Nothing to pinch
+        return;
+    }
+    
+    size_t thread1 = getThread(name1);
+    size_t thread2 = getThread(name2);
+    start1 -= threads[thread1].start;
+    start2 -= threads[thread2].start;
+    if(start1 < 0 || start1 + length > threads[thread1].length ||
+        start2 < 0 || start2 + length > threads[thread2].length) {
+        throw std::runtime_error("Pinch runs off the end of thread " + std::to_string(name1) + " or " +
+            std::to_string(name2));
+    }
+    
+    // Just remember it until we need to know what it did
+    forgetFlattened();
+    pinches.push_back(Pinch{thread1, thread2, start1, start2, length, strand});
+    
+    if(pinches.size() >= compactAt) {
+        // Work out what they did so far, and keep that instead. Wait until
+        // there are twice as many left before doing it again, so it only
+        // costs a constant factor.
+        FlatPinchGraph cut;
+        std::vector<size_t> twisted;
+        cutAndBlock(cut, &twisted);
+        compact(cut, twisted);
+        compactAt = std::max(MIN_COMPACT_PINCHES, pinches.size() * 2);
+    }
+}
+
+void NativePinchGraph::joinTrivialBoundaries() {
+    if(!joined) {
+        forgetFlattened();
+        joined = true;
+    }
+}
+
+void NativePinchGraph::flatten(FlatPinchGraph& flat) {
+    if(!haveFlattened) {
+        FlatPinchGraph cut;
+        std::vector<size_t> twisted;
+        cutAndBlock(cut, &twisted);
+        compact(cut, twisted);
+        if(joined) {
+            joinTrivial(cut, flattened);
+        } else {
+            flattened = std::move(cut);
+        }
+        haveFlattened = true;
+    }
+    flat = flattened;
+}
+
+void NativePinchGraph::compact(const FlatPinchGraph& cut, const std::vector<size_t>& twisted) {
+    // A pinch of a run onto itself cuts the thread without blocking anything,
+    // so a breakpoint between two unblocked segments needs one of those to
+    // keep it. Any other breakpoint is the end of a blocked segment.
+    auto cutOnly = [&](size_t segment) {
+        return cut.segmentBlocks[segment] == FlatPinchGraph::NO_BLOCK && segment > 0 &&
+            cut.segmentThreads[segment - 1] == cut.segmentThreads[segment] &&
+            cut.segmentBlocks[segment - 1] == FlatPinchGraph::NO_BLOCK;
+    };
+    size_t compactedCount = cut.segmentStarts.size() - cut.blockCount() + twisted.size();
+    for(size_t segment = 0; segment < cut.segmentStarts.size(); segment++) {
+        if(cut.segmentBlocks[segment] == FlatPinchGraph::NO_BLOCK && !cutOnly(segment)) {
+            compactedCount--;
+        }
+    }
+    if(compactedCount >= pinches.size()) {
+        // The pinches we have are already as few
+        return;
+    }
+    
+    // Pinch each block's leader to each of its other segments. With the
+    // breakpoints between unblocked segments, these cut the threads in all
+    // the same places, and make the same blocks. A twisted block also needs
+    // its leader pinched to itself the other way, so that later breakpoints
+    // in it get mirrored the way the old pinches would have mirrored them.
+    std::vector<Pinch> compacted;
+    compacted.reserve(compactedCount);
+    for(size_t segment : twisted) {
+        size_t thread = threadIndex.at(cut.threadNames[cut.segmentThreads[segment]]);
+        int64_t start = cut.segmentStarts[segment] - threads[thread].start;
+        compacted.push_back(Pinch{thread, thread, start, start, cut.segmentLengths[segment], false});
+    }
+    for(size_t segment = 0; segment < cut.segmentStarts.size(); segment++) {
+        if(cutOnly(segment)) {
+            size_t thread = threadIndex.at(cut.threadNames[cut.segmentThreads[segment]]);
+            int64_t start = cut.segmentStarts[segment] - threads[thread].start;
+            compacted.push_back(Pinch{thread, thread, start, start, cut.segmentLengths[segment], true});
+        }
+    }
+    for(size_t block = 0; block < cut.blockCount(); block++) {
+        size_t leader = cut.blockMembers[cut.blockSegments[block]];
+        size_t leaderThread = threadIndex.at(cut.threadNames[cut.segmentThreads[leader]]);
+        for(size_t i = cut.blockSegments[block] + 1; i < cut.blockSegments[block + 1]; i++) {
+            size_t member = cut.blockMembers[i];
+            size_t memberThread = threadIndex.at(cut.threadNames[cut.segmentThreads[member]]);
+            compacted.push_back(Pinch{leaderThread, memberThread,
+                cut.segmentStarts[leader] - threads[leaderThread].start,
+                cut.segmentStarts[member] - threads[memberThread].start, cut.segmentLengths[leader],
+                cut.segmentOrientations[leader] == cut.segmentOrientations[member]});
+        }
+    }
+    pinches = std::move(compacted);
+}
+
+void NativePinchGraph::forgetFlattened() {
+    if(haveFlattened) {
+        flattened = FlatPinchGraph();
+        haveFlattened = false;
+    }
+}
+
+void NativePinchGraph::cutAndBlock(FlatPinchGraph& flat, std::vector<size_t>* twisted) {
+    flat = FlatPinchGraph();
+    
+    // Put the threads in name order
+    std::vector<size_t> order(threads.size());
+    for(size_t i = 0; i < threads.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return threads[a].name < threads[b].name;
+    });
+    std::vector<size_t> rank(threads.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        rank[order[i]] = i;
+    }
+    
+    // Lay out each thread's sides of the pinches in one flat array, in order
+    // of where they start on the thread. A side is a pinch number times 2,
+    // plus 1 for the second thread's side.
+    auto sideThread = [&](size_t side) {
+        return rank[side % 2 ? pinches[side / 2].thread2 : pinches[side / 2].thread1];
+    };
+    auto sideStart = [&](size_t side) {
+        return side % 2 ? pinches[side / 2].start2 : pinches[side / 2].start1;
+    };
+    std::vector<size_t> sidesStart(threads.size() + 1, 0);
+    for(size_t side = 0; side < pinches.size() * 2; side++) {
+        sidesStart[sideThread(side) + 1]++;
+    }
+    for(size_t i = 0; i < threads.size(); i++) {
+        sidesStart[i + 1] += sidesStart[i];
+    }
+    std::vector<size_t> sides(pinches.size() * 2);
+    std::vector<size_t> sidesFilled(sidesStart.begin(), sidesStart.end() - 1);
+    for(size_t side = 0; side < pinches.size() * 2; side++) {
+        sides[sidesFilled[sideThread(side)]++] = side;
+    }
+    
+    // Sort each thread's sides, and index them as intervals, so we can find
+    // the pinches covering any position without looking at the ones that
+    // don't.
+    std::vector<int64_t> intervalStarts(sides.size());
+    std::vector<int64_t> intervalEnds(sides.size());
+    std::vector<int64_t> intervalMaxEnds(sides.size());
+    std::vector<int> treeLevels(threads.size());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t i = 0; i < threads.size(); i++) {
+        std::sort(sides.begin() + sidesStart[i], sides.begin() + sidesStart[i + 1], [&](size_t a, size_t b) {
+            return sideStart(a) < sideStart(b);
+        });
+        for(size_t j = sidesStart[i]; j < sidesStart[i + 1]; j++) {
+            intervalStarts[j] = sideStart(sides[j]);
+            intervalEnds[j] = intervalStarts[j] + pinches[sides[j] / 2].length;
+        }
+        treeLevels[i] = indexIntervals(&intervalEnds[sidesStart[i]], &intervalMaxEnds[sidesStart[i]],
+            sidesStart[i + 1] - sidesStart[i]);
+    }
+    
+    // Every thread breaks at its ends and at the ends of every pinch on it.
+    // Each breakpoint inside a pinch then breaks the other side of the pinch
+    // too, so we chase breakpoints across pinches, a round of hops at a time,
+    // until no new ones turn up. A breakpoint is usually reached from every
+    // pinch on the block it ends up bounding, so we check for ones we already
+    // have in a bit per position, and only sort each thread's breakpoints
+    // once at the end.
+    typedef std::pair<size_t, int64_t> Breakpoint;
+    std::vector<std::vector<bool>> isBreakpoint(threads.size());
+    std::vector<std::vector<int64_t>> breakpoints(threads.size());
+    for(size_t i = 0; i < threads.size(); i++) {
+        isBreakpoint[i].resize(threads[order[i]].length + 1);
+    }
+    
+    // Keep the given breakpoints that we don't have yet, and fill in toChase
+    // with them.
+    std::vector<Breakpoint> toChase;
+    auto addBreakpoints = [&](const std::vector<Breakpoint>& found) {
+        toChase.clear();
+        for(auto& breakpoint : found) {
+            if(!isBreakpoint[breakpoint.first][breakpoint.second]) {
+                isBreakpoint[breakpoint.first][breakpoint.second] = true;
+                breakpoints[breakpoint.first].push_back(breakpoint.second);
+                toChase.push_back(breakpoint);
+            }
+        }
+    };
+    
+    std::vector<Breakpoint> found;
+    for(size_t i = 0; i < threads.size(); i++) {
+        found.emplace_back(i, 0);
+        found.emplace_back(i, threads[order[i]].length);
+    }
+    for(size_t side = 0; side < pinches.size() * 2; side++) {
+        found.emplace_back(sideThread(side), sideStart(side));
+        found.emplace_back(sideThread(side), sideStart(side) + pinches[side / 2].length);
+    }
+    addBreakpoints(found);
+    
+    std::vector<std::vector<Breakpoint>> threadFound(omp_get_max_threads());
+    std::vector<std::vector<size_t>> threadCovering(omp_get_max_threads());
+    while(!toChase.empty()) {
+        #pragma omp parallel for schedule(dynamic, 1024)
+        for(size_t i = 0; i < toChase.size(); i++) {
+            size_t thread = toChase[i].first;
+            int64_t position = toChase[i].second;
+            std::vector<size_t>& covering = threadCovering[omp_get_thread_num()];
+            
+            // Find the pinches with the breakpoint strictly inside them
+            size_t base = sidesStart[thread];
+            covering.clear();
+            findCovering(&intervalStarts[base], &intervalEnds[base], &intervalMaxEnds[base],
+                sidesStart[thread + 1] - base, treeLevels[thread], position, covering);
+            
+            for(size_t index : covering) {
+                // Find the same place on the other side of the pinch
+                size_t side = sides[base + index];
+                const Pinch& pinch = pinches[side / 2];
+                size_t otherSide = side ^ 1;
+                int64_t offset = position - intervalStarts[base + index];
+                size_t otherThread = sideThread(otherSide);
+                int64_t otherPosition = sideStart(otherSide) + (pinch.strand ? offset : pinch.length - offset);
+                if(!isBreakpoint[otherThread][otherPosition]) {
+                    threadFound[omp_get_thread_num()].emplace_back(otherThread, otherPosition);
+                }
+            }
+        }
+        
+        found.clear();
+        for(auto& fromThread : threadFound) {
+            found.insert(found.end(), fromThread.begin(), fromThread.end());
+            fromThread.clear();
+        }
+        addBreakpoints(found);
+    }
+    
+    // Cut the threads into segments between the breakpoints
+    for(size_t i = 0; i < threads.size(); i++) {
+        const Thread& thread = threads[order[i]];
+        flat.threadNames.push_back(thread.name);
+        flat.threadStarts.push_back(thread.start);
+        flat.threadLengths.push_back(thread.length);
+        flat.threadSegments.push_back(flat.segmentStarts.size());
+        
+        std::vector<int64_t>& sortedBreakpoints = breakpoints[i];
+        std::sort(sortedBreakpoints.begin(), sortedBreakpoints.end());
+        for(size_t j = 0; j + 1 < sortedBreakpoints.size(); j++) {
+            flat.segmentThreads.push_back(i);
+            flat.segmentStarts.push_back(thread.start + sortedBreakpoints[j]);
+            flat.segmentLengths.push_back(sortedBreakpoints[j + 1] - sortedBreakpoints[j]);
+        }
+    }
+    flat.threadSegments.push_back(flat.segmentStarts.size());
+    
+    // Every pinch now lines up segment for segment, so join up the segments
+    // on each side.
+    OrientedUnionFind sets(flat.segmentStarts.size());
+    for(auto& pinch : pinches) {
+        size_t thread1 = rank[pinch.thread1];
+        size_t thread2 = rank[pinch.thread2];
+        size_t segment1 = flat.findSegment(thread1, threads[pinch.thread1].start + pinch.start1);
+        // Going the other way, we start from the segment at the far end
+        size_t segment2 = flat.findSegment(thread2, threads[pinch.thread2].start + pinch.start2 +
+            (pinch.strand ? 0 : pinch.length - 1));
+        int64_t end1 = threads[pinch.thread1].start + pinch.start1 + pinch.length;
+        while(segment1 < flat.threadSegments[thread1 + 1] && flat.segmentStarts[segment1] < end1) {
+            sets.join(segment1, segment2, !pinch.strand);
+            segment1++;
+            if(pinch.strand) {
+                segment2++;
+            } else {
+                segment2--;
+            }
+        }
+    }
+    
+    if(twisted != nullptr) {
+        // Report the first segment of each twisted set
+        twisted->clear();
+        std::vector<bool> reported(flat.segmentStarts.size(), false);
+        for(size_t segment = 0; segment < flat.segmentStarts.size(); segment++) {
+            size_t root = sets.find(segment).first;
+            if(sets.twisted[root] && !reported[root]) {
+                twisted->push_back(segment);
+                reported[root] = true;
+            }
+        }
+    }
+    
+    makeBlocks(flat, sets);
+}
+
+void NativePinchGraph::joinTrivial(const FlatPinchGraph& cut, FlatPinchGraph& joined) {
+    size_t segmentCount = cut.segmentStarts.size();
+    
+    // Work out which segments join on to the segment after them. A boundary
+    // is trivial if there is no block on either side, or if the blocks on
+    // each side are different, the same size, and every segment in the first
+    // one runs straight into a segment of the second one, the same way.
+    std::vector<bool> joinsNext(segmentCount, false);
+    for(size_t segment = 0; segment + 1 < segmentCount; segment++) {
+        size_t next = segment + 1;
+        if(cut.segmentThreads[next] != cut.segmentThreads[segment]) {
+            // This is the end of a thread
+            continue;
+        }
+        size_t block = cut.segmentBlocks[segment];
+        size_t nextBlock = cut.segmentBlocks[next];
+        if(block == FlatPinchGraph::NO_BLOCK || nextBlock == FlatPinchGraph::NO_BLOCK) {
+            joinsNext[segment] = (block == nextBlock);
+            continue;
+        }
+        if(block == nextBlock || cut.blockSegments[block + 1] - cut.blockSegments[block] !=
+            cut.blockSegments[nextBlock + 1] - cut.blockSegments[nextBlock]) {
+            continue;
+        }
+        
+        // Does the next segment face the same way in its block as this one?
+        bool sameWay = (cut.segmentOrientations[segment] == cut.segmentOrientations[next]);
+        bool trivial = true;
+        for(size_t i = cut.blockSegments[block]; i < cut.blockSegments[block + 1] && trivial; i++) {
+            size_t member = cut.blockMembers[i];
+            // Members facing the same way as this segment go 3' into the next
+            // block, and ones facing the other way go 5'.
+            bool goes3Prime = (cut.segmentOrientations[member] == cut.segmentOrientations[segment]);
+            size_t neighbor;
+            if(goes3Prime) {
+                neighbor = member + 1;
+                trivial = (neighbor < segmentCount && cut.segmentThreads[neighbor] == cut.segmentThreads[member]);
+            } else {
+                neighbor = member - 1;
+                trivial = (member > 0 && cut.segmentThreads[neighbor] == cut.segmentThreads[member]);
+            }
+            trivial = trivial && cut.segmentBlocks[neighbor] == nextBlock &&
+                (cut.segmentOrientations[neighbor] == cut.segmentOrientations[member]) == sameWay;
+        }
+        joinsNext[segment] = trivial;
+    }
+    
+    // Make the joined segments, and remember which one each cut segment went
+    // into.
+    joined = FlatPinchGraph();
+    joined.threadNames = cut.threadNames;
+    joined.threadStarts = cut.threadStarts;
+    joined.threadLengths = cut.threadLengths;
+    std::vector<size_t> joinedSegment(segmentCount);
+    for(size_t thread = 0; thread < cut.threadCount(); thread++) {
+        joined.threadSegments.push_back(joined.segmentStarts.size());
+        for(size_t segment = cut.threadSegments[thread]; segment < cut.threadSegments[thread + 1]; segment++) {
+            if(segment == cut.threadSegments[thread] || !joinsNext[segment - 1]) {
+                // Start a new segment
+                joined.segmentThreads.push_back(thread);
+                joined.segmentStarts.push_back(cut.segmentStarts[segment]);
+                joined.segmentLengths.push_back(0);
+            }
+            joined.segmentLengths.back() += cut.segmentLengths[segment];
+            joinedSegment[segment] = joined.segmentStarts.size() - 1;
+        }
+    }
+    joined.threadSegments.push_back(joined.segmentStarts.size());
+    
+    // A joined segment faces its block the way its pieces faced theirs, so
+    // tie each block's joined segments together the way its pieces were.
+    OrientedUnionFind sets(joined.segmentStarts.size());
+    for(size_t block = 0; block < cut.blockCount(); block++) {
+        size_t leader = cut.blockMembers[cut.blockSegments[block]];
+        for(size_t i = cut.blockSegments[block] + 1; i < cut.blockSegments[block + 1]; i++) {
+            size_t member = cut.blockMembers[i];
+            sets.join(joinedSegment[leader], joinedSegment[member],
+                cut.segmentOrientations[member] != cut.segmentOrientations[leader]);
+        }
+    }
+    
+    makeBlocks(joined, sets);
+}
+
+std::unique_ptr<PinchGraph> makePinchGraph(bool native) {
+    if(native) {
+        return std::unique_ptr<PinchGraph>(new NativePinchGraph());
+    } else {
+        return std::unique_ptr<PinchGraph>(new SonLibPinchGraph());
+    }
+}
+
+}
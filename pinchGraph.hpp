@@ -0,0 +1,271 @@
+#ifndef COREGRAPH_PINCHGRAPH_HPP
+#define COREGRAPH_PINCHGRAPH_HPP
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Hack around stupid name mangling issues
+extern "C" {
+    #include "benedictpaten/pinchesAndCacti/inc/stPinchGraphs.h"
+}
+
+namespace coregraph {
+
+/**
+ * A pinch graph flattened out into arrays, for reading. Threads, segments, and
+ * blocks are all numbered from 0. Threads are in name order, and each thread's
+ * segments are numbered consecutively from its 5' end to its 3' end, so
+ * walking a thread is walking along an array.
+ */
+struct FlatPinchGraph {
+    // Marks a segment that isn't in any block
+    static const size_t NO_BLOCK = (size_t) -1;
+    
+    // The name, start, and length of each thread
+    std::vector<int64_t> threadNames;
+    std::vector<int64_t> threadStarts;
+    std::vector<int64_t> threadLengths;
+    // Where each thread's segments start, with the number of segments on the
+    // end
+    std::vector<size_t> threadSegments;
+    
+    // The thread, start, and length of each segment
+    std::vector<size_t> segmentThreads;
+    std::vector<int64_t> segmentStarts;
+    std::vector<int64_t> segmentLengths;
+    // The block each segment is in, or NO_BLOCK
+    std::vector<size_t> segmentBlocks;
+    // Whether each segment faces the same way as its block's leader. Segments
+    // not in blocks are forward.
+    std::vector<bool> segmentOrientations;
+    
+    // Where each block's segments start in blockMembers, with the number of
+    // members on the end. Each block's segments are listed in order, so its
+    // leader is its lowest-numbered segment, and blocks are numbered in order
+    // of their leaders. Both engines lay blocks out this way, so they make the
+    // same core graph.
+    std::vector<size_t> blockSegments;
+    std::vector<size_t> blockMembers;
+    
+    /**
+     * Get the number of threads.
+     */
+    size_t threadCount() const;
+    
+    /**
+     * Get the number of blocks.
+     */
+    size_t blockCount() const;
+    
+    /**
+     * Find the thread with the given name. Throws std::runtime_error if there
+     * isn't one.
+     */
+    size_t findThread(int64_t name) const;
+    
+    /**
+     * Find the segment of the given thread that covers the given position.
+     */
+    size_t findSegment(size_t thread, int64_t position) const;
+    
+    /**
+     * Get the name of the thread a segment is on.
+     */
+    int64_t getSegmentName(size_t segment) const;
+    
+    /**
+     * Get the leader for a segment: either the first segment in its block, or
+     * the segment itself if it has no block.
+     */
+    size_t getLeader(size_t segment) const;
+    
+    /**
+     * Return false if a segment is not in a block or is forward in its block,
+     * and true otherwise. Converts from pinch graph orientations to vg
+     * orientations.
+     */
+    bool getOrientation(size_t segment) const;
+};
+
+/**
+ * A set of named threads that can be pinched together. Graphs are embedded in
+ * one of these, and the core graph is read out of it.
+ */
+class PinchGraph {
+public:
+    virtual ~PinchGraph() = default;
+    
+    /**
+     * Add a thread with the given name, covering the given number of positions
+     * starting at the given one.
+     */
+    virtual void addThread(int64_t name, int64_t start, int64_t length) = 0;
+    
+    /**
+     * Return true if a thread with the given name exists, and false otherwise.
+     */
+    virtual bool hasThread(int64_t name) = 0;
+    
+    /**
+     * Get the length of the named thread. Safe to call from several threads at
+     * once, as long as nothing is being changed.
+     */
+    virtual int64_t getThreadLength(int64_t name) = 0;
+    
+    /**
+     * Pinch together the given runs of positions on two threads. If strand is
+     * true, the first position of one goes with the first position of the
+     * other; otherwise the runs are pinched in opposite orientations.
+     */
+    virtual void pinch(int64_t name1, int64_t name2, int64_t start1, int64_t start2, int64_t length,
+        bool strand) = 0;
+    
+    /**
+     * Join up adjacent segments wherever the boundary between them doesn't
+     * separate anything.
+     */
+    virtual void joinTrivialBoundaries() = 0;
+    
+    /**
+     * Fill in the given FlatPinchGraph with the threads, segments, and blocks.
+     */
+    virtual void flatten(FlatPinchGraph& flat) = 0;
+};
+
+/**
+ * A pinch graph kept in a sonLib stPinchThreadSet.
+ */
+class SonLibPinchGraph : public PinchGraph {
+public:
+    SonLibPinchGraph();
+    ~SonLibPinchGraph();
+    
+    void addThread(int64_t name, int64_t start, int64_t length);
+    bool hasThread(int64_t name);
+    int64_t getThreadLength(int64_t name);
+    void pinch(int64_t name1, int64_t name2, int64_t start1, int64_t start2, int64_t length, bool strand);
+    void joinTrivialBoundaries();
+    void flatten(FlatPinchGraph& flat);
+
+protected:
+    /**
+     * Get the named thread. Throws std::runtime_error if it doesn't exist.
+     */
+    stPinchThread* getThread(int64_t name);
+    
+    // The sonLib thread set we wrap
+    stPinchThreadSet* threadSet;
+};
+
+/**
+ * A pinch graph that works in flat arrays instead of linked segments and
+ * blocks. Pinches are only recorded as they come in. When the graph is
+ * flattened, the breakpoints each pinch implies are spread along all the
+ * pinches into sorted per-thread arrays, the segments between them are put
+ * into blocks with a union-find over segment numbers, and trivial boundaries
+ * are joined if that was asked for.
+ *
+ * The flattened graph is kept until the graph changes again, so flattening
+ * it more than once in a row only costs a copy. Whenever the blocks are
+ * worked out, the recorded pinches are swapped for one pinch from each
+ * block's first segment to each of its others, if that is fewer. That also
+ * happens on its own when the recorded pinches pile up, so pinching on lots
+ * of repeated kmers doesn't keep them all.
+ *
+ * Blocks come out the same as sonLib's, and are laid out the same way when
+ * flattened.
+ */
+class NativePinchGraph : public PinchGraph {
+public:
+    void addThread(int64_t name, int64_t start, int64_t length);
+    bool hasThread(int64_t name);
+    int64_t getThreadLength(int64_t name);
+    void pinch(int64_t name1, int64_t name2, int64_t start1, int64_t start2, int64_t length, bool strand);
+    void joinTrivialBoundaries();
+    void flatten(FlatPinchGraph& flat);
+
+protected:
+    // A thread, by name and range of positions
+    struct Thread {
+        int64_t name;
+        int64_t start;
+        int64_t length;
+    };
+    
+    // A recorded pinch, by thread number, with the starts measured from the
+    // starts of the threads
+    struct Pinch {
+        size_t thread1;
+        size_t thread2;
+        int64_t start1;
+        int64_t start2;
+        int64_t length;
+        bool strand;
+    };
+    
+    /**
+     * Get the number of the named thread. Throws std::runtime_error if it
+     * doesn't exist.
+     */
+    size_t getThread(int64_t name);
+    
+    /**
+     * Cut the threads at every breakpoint the pinches imply, and put the
+     * segments into blocks, without joining trivial boundaries. If twisted
+     * is set, fill it in with the first segment of each block, or unblocked
+     * segment, that the pinches also tie to itself the other way.
+     */
+    void cutAndBlock(FlatPinchGraph& flat, std::vector<size_t>* twisted = nullptr);
+    
+    /**
+     * Replace the recorded pinches with ones that make the given graph, and
+     * the given twisted segments, as made by cutAndBlock() from them, if
+     * that takes fewer pinches.
+     */
+    void compact(const FlatPinchGraph& cut, const std::vector<size_t>& twisted);
+    
+    /**
+     * Throw away the flattened graph, because the graph has changed.
+     */
+    void forgetFlattened();
+    
+    /**
+     * Make a copy of the given graph with all its trivial boundaries joined.
+     */
+    static void joinTrivial(const FlatPinchGraph& cut, FlatPinchGraph& joined);
+    
+    // Don't bother compacting on our own until we have this many pinches
+    static const size_t MIN_COMPACT_PINCHES = 1 << 20;
+    
+    // All the threads, in the order they were added
+    std::vector<Thread> threads;
+    
+    // Where each thread is in threads, by name
+    std::unordered_map<int64_t, size_t> threadIndex;
+    
+    // All the pinches, in the order they were made, or ones that make the same
+    // graph
+    std::vector<Pinch> pinches;
+    
+    // How many pinches to let pile up before compacting them
+    size_t compactAt = MIN_COMPACT_PINCHES;
+    
+    // Whether trivial boundaries have been joined. Once they have, they stay
+    // joined.
+    bool joined = false;
+    
+    // The graph as last flattened, if nothing has changed since
+    FlatPinchGraph flattened;
+    bool haveFlattened = false;
+};
+
+/**
+ * Make an empty pinch graph, either a native one or one kept in sonLib.
+ */
+std::unique_ptr<PinchGraph> makePinchGraph(bool native);
+
+}
+
+#endif
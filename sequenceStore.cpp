@@ -0,0 +1,169 @@
+#include "sequenceStore.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace coregraph {
+
+SequenceStore::SequenceStore(size_t memoryBudget, const std::string& scratchDirectory):
+    memoryBudget(memoryBudget), scratchDirectory(scratchDirectory) {
+    // Nothing to do
+}
+
+SequenceStore::~SequenceStore() {
+    // Unmap before removing
+    chunks.clear();
+    for(auto& filename : chunkFiles) {
+        std::remove(filename.c_str());
+    }
+}
+
+void SequenceStore::add(int64_t name, const std::string& sequence) {
+    add(name, sequence.data(), sequence.size());
+}
+
+void SequenceStore::add(int64_t name, const char* sequence, size_t length) {
+    if(!names.empty() && name <= names.back()) {
+        // This has to be a thread we already have, with the same sequence.
+        size_t index = find(name);
+        if(index == names.size()) {
+            throw std::runtime_error("Sequence for thread " + std::to_string(name) + " added out of order");
+        }
+        const Entry& entry = entries[index];
+        if(entry.length != length || memcmp(getData(entry), sequence, length) != 0) {
+            throw std::runtime_error("Sequence for thread " + std::to_string(name) + " added twice, differently");
+        }
+        return;
+    }
+    
+    names.push_back(name);
+    entries.push_back({chunks.size(), buffer.size(), length});
+    buffer.append(sequence, length);
+    
+    if(memoryBudget != 0 && buffer.size() >= memoryBudget) {
+        // Get it out of memory
+        spill();
+    }
+}
+
+bool SequenceStore::has(int64_t name) const {
+    return find(name) != names.size();
+}
+
+size_t SequenceStore::size() const {
+    return names.size();
+}
+
+size_t SequenceStore::getLength(int64_t name) const {
+    return entries[at(name)].length;
+}
+
+std::string SequenceStore::getSequence(int64_t name) const {
+    const Entry& entry = entries[at(name)];
+    return std::string(getData(entry), entry.length);
+}
+
+std::string SequenceStore::getSequence(int64_t name, size_t start, size_t length) const {
+    const Entry& entry = entries[at(name)];
+    if(start > entry.length) {
+        throw std::out_of_range("Sequence start past end of thread " + std::to_string(name));
+    }
+    return std::string(getData(entry) + start, std::min(length, entry.length - start));
+}
+
+void SequenceStore::forEach(const std::function<void(int64_t, const std::string&)>& iteratee) const {
+    // Reuse one string for all the sequences
+    std::string sequence;
+    for(size_t i = 0; i < names.size(); i++) {
+        sequence.assign(getData(entries[i]), entries[i].length);
+        iteratee(names[i], sequence);
+    }
+}
+
+void SequenceStore::eraseFrom(int64_t firstName) {
+    size_t first = std::lower_bound(names.begin(), names.end(), firstName) - names.begin();
+    if(first == names.size()) {
+        // Nothing to erase
+        return;
+    }
+    
+    // Work out how much of what chunk has to stay
+    const Entry& firstErased = entries[first];
+    size_t keptChunks = firstErased.chunk;
+    size_t keptBytes = firstErased.offset;
+    
+    if(keptChunks < chunks.size()) {
+        // The first erased sequence was spilled, so the buffer and every later
+        // chunk are all erased sequences.
+        if(keptBytes > 0) {
+            // Part of the chunk it is in is still used, so keep the chunk.
+            keptChunks++;
+        }
+        chunks.resize(keptChunks);
+        for(size_t i = keptChunks; i < chunkFiles.size(); i++) {
+            std::remove(chunkFiles[i].c_str());
+        }
+        chunkFiles.resize(keptChunks);
+        buffer.clear();
+    } else {
+        // Only the end of the buffer goes
+        buffer.resize(keptBytes);
+    }
+    
+    names.resize(first);
+    entries.resize(first);
+}
+
+size_t SequenceStore::getSpilledBytes() const {
+    size_t total = 0;
+    for(auto& chunk : chunks) {
+        total += chunk->size();
+    }
+    return total;
+}
+
+size_t SequenceStore::find(int64_t name) const {
+    auto found = std::lower_bound(names.begin(), names.end(), name);
+    if(found == names.end() || *found != name) {
+        return names.size();
+    }
+    return found - names.begin();
+}
+
+size_t SequenceStore::at(int64_t name) const {
+    size_t index = find(name);
+    if(index == names.size()) {
+        throw std::out_of_range("No sequence for thread " + std::to_string(name));
+    }
+    return index;
+}
+
+const char* SequenceStore::getData(const Entry& entry) const {
+    if(entry.chunk < chunks.size()) {
+        return chunks[entry.chunk]->data() + entry.offset;
+    }
+    return buffer.data() + entry.offset;
+}
+
+void SequenceStore::spill() {
+    std::string filename = makeScratchFile(scratchDirectory);
+    chunkFiles.push_back(filename);
+    
+    std::ofstream out(filename, std::ios::binary);
+    out.write(buffer.data(), buffer.size());
+    out.close();
+    if(!out.good()) {
+        throw std::runtime_error("Could not write scratch file " + filename);
+    }
+    
+    // Sequences are looked up all over the place, so don't read ahead.
+    chunks.emplace_back(new MappedFile(filename, false));
+    
+    // Actually give back the memory
+    std::string().swap(buffer);
+}
+
+}
@@ -0,0 +1,162 @@
+#ifndef COREGRAPH_SEQUENCESTORE_HPP
+#define COREGRAPH_SEQUENCESTORE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mappedFile.hpp"
+
+namespace coregraph {
+
+/**
+ * The sequences of the threads in a pinch graph, by thread name. Sequences are
+ * packed end to end into one buffer. If a memory budget is set, whenever the
+ * buffer grows past it the buffer is written out to a scratch file, which is
+ * mapped back in read-only, and a new buffer is started. The OS can then page
+ * spilled sequences in and out as they are used, so merges whose sequences
+ * don't fit in memory can still run.
+ *
+ * Threads have to be added in order of increasing name, which is the order
+ * they are made in. Adding a thread that is already there is allowed, as long
+ * as the sequence is the same. Reading is safe from several threads at once,
+ * as long as nothing is being added or erased.
+ */
+class SequenceStore {
+public:
+    
+    /**
+     * Make an empty store that keeps at most about the given number of bytes
+     * of sequence in memory, or everything if the budget is 0, and spills the
+     * rest to scratch files in the given directory.
+     */
+    SequenceStore(size_t memoryBudget = 0, const std::string& scratchDirectory = ".");
+    
+    /**
+     * Remove all the scratch files.
+     */
+    ~SequenceStore();
+    
+    // We own the scratch files, so we can't be copied.
+    SequenceStore(const SequenceStore& other) = delete;
+    SequenceStore& operator=(const SequenceStore& other) = delete;
+    
+    /**
+     * Store the sequence for the named thread. Throws std::runtime_error if
+     * the name is lower than the last one added and isn't already there with
+     * the same sequence.
+     */
+    void add(int64_t name, const std::string& sequence);
+    
+    /**
+     * Store the given number of bases, starting at the given place, as the
+     * sequence of the named thread, as add() does for a string.
+     */
+    void add(int64_t name, const char* sequence, size_t length);
+    
+    /**
+     * Return true if there is a sequence for the named thread.
+     */
+    bool has(int64_t name) const;
+    
+    /**
+     * Get the number of threads with sequences.
+     */
+    size_t size() const;
+    
+    /**
+     * Get the length of the named thread's sequence. Throws std::out_of_range
+     * if there isn't one.
+     */
+    size_t getLength(int64_t name) const;
+    
+    /**
+     * Get the whole sequence of the named thread. Throws std::out_of_range if
+     * there isn't one.
+     */
+    std::string getSequence(int64_t name) const;
+    
+    /**
+     * Get the given number of bases of the named thread's sequence, from the
+     * given start, clipped to the end of the sequence, as std::string::substr
+     * does. Throws std::out_of_range if there isn't one.
+     */
+    std::string getSequence(int64_t name, size_t start, size_t length) const;
+    
+    /**
+     * Call the given function with each thread's name and sequence, in name
+     * order.
+     */
+    void forEach(const std::function<void(int64_t, const std::string&)>& iteratee) const;
+    
+    /**
+     * Throw out the sequences of all the threads named the given name or
+     * higher. Buffer space and scratch files only holding those sequences are
+     * freed.
+     */
+    void eraseFrom(int64_t firstName);
+    
+    /**
+     * Get the number of bytes of sequence that have been spilled to scratch
+     * files.
+     */
+    size_t getSpilledBytes() const;
+
+protected:
+    
+    // Where a thread's sequence is kept
+    struct Entry {
+        // Which spilled chunk it is in, or the number of spilled chunks if it
+        // is in the buffer
+        size_t chunk;
+        // Where it starts in that chunk, and how long it is
+        size_t offset;
+        size_t length;
+    };
+    
+    /**
+     * Find the index of the named thread in names, or names.size() if it isn't
+     * there.
+     */
+    size_t find(int64_t name) const;
+    
+    /**
+     * Find the index of the named thread in names, or throw std::out_of_range
+     * if it isn't there.
+     */
+    size_t at(int64_t name) const;
+    
+    /**
+     * Get where the given entry's sequence starts in memory.
+     */
+    const char* getData(const Entry& entry) const;
+    
+    /**
+     * Write out the buffer to a new scratch file, map it, and empty the
+     * buffer.
+     */
+    void spill();
+    
+    // The most bytes to keep in the buffer, or 0 for no limit
+    size_t memoryBudget;
+    
+    // Where to put the scratch files
+    std::string scratchDirectory;
+    
+    // The thread names, in increasing order, and where each one's sequence is
+    std::vector<int64_t> names;
+    std::vector<Entry> entries;
+    
+    // The sequences that haven't been spilled
+    std::string buffer;
+    
+    // The scratch files holding the spilled chunks, and their mappings
+    std::vector<std::string> chunkFiles;
+    std::vector<std::unique_ptr<MappedFile>> chunks;
+};
+
+}
+
+#endif
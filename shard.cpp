@@ -0,0 +1,359 @@
+#include "shard.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ekg/vg/stream.hpp"
+
+namespace coregraph {
+
+/**
+ * A union-find over densely numbered items, for grouping nodes.
+ */
+class DisjointSets {
+public:
+    /**
+     * Add a new item in a group by itself, and return its number.
+     */
+    size_t add() {
+        parent.push_back(parent.size());
+        return parent.size() - 1;
+    }
+    
+    /**
+     * Find the number of the item that stands for the given item's group.
+     */
+    size_t find(size_t item) {
+        while(parent[item] != item) {
+            // Halve the path as we go
+            parent[item] = parent[parent[item]];
+            item = parent[item];
+        }
+        return item;
+    }
+    
+    /**
+     * Put the groups of the two items together.
+     */
+    void unite(size_t a, size_t b) {
+        a = find(a);
+        b = find(b);
+        if(a != b) {
+            // Keep the lower number as the representative, so the groups come
+            // out the same no matter what order they were joined in.
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+protected:
+    std::vector<size_t> parent;
+};
+
+std::vector<Shard> splitIntoShards(InputGraph& input1, InputGraph& input2, size_t shardCount,
+    const std::string& directory, bool gfaOutput) {
+    
+    if(shardCount == 0) {
+        throw std::runtime_error("Can't split into 0 shards");
+    }
+    
+    if(mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Could not make shard directory " + directory + ": " + strerror(errno));
+    }
+    
+    InputGraph* inputs[2] = {&input1, &input2};
+    
+    // Number all the nodes of both graphs, and remember how long they are.
+    DisjointSets groups;
+    std::vector<int64_t> nodeBases;
+    std::unordered_map<int64_t, size_t> nodeNumber[2];
+    // Where does each path start, by name?
+    std::map<std::string, size_t> pathStart[2];
+    
+    for(size_t i = 0; i < 2; i++) {
+        inputs[i]->forEachNode([&](int64_t nodeId, const std::string& sequence) {
+            nodeNumber[i][nodeId] = groups.add();
+            nodeBases.push_back(sequence.size());
+        });
+        
+        // Nodes connected by edges go together
+        inputs[i]->forEachEdge([&](const vg::Edge& edge) {
+            groups.unite(nodeNumber[i].at(edge.from()), nodeNumber[i].at(edge.to()));
+        });
+        
+        // So do nodes on the same path, even if they aren't connected
+        for(auto& pathName : inputs[i]->getPathNames()) {
+            bool first = true;
+            inputs[i]->forEachPathStep(pathName, [&](const PathStep& step) {
+                size_t node = nodeNumber[i].at(step.nodeId);
+                if(first) {
+                    pathStart[i][pathName] = node;
+                    first = false;
+                } else {
+                    groups.unite(pathStart[i][pathName], node);
+                }
+            });
+        }
+    }
+    
+    // Paths with the same name in both graphs get pinched together, so they
+    // have to go together.
+    for(auto& kv : pathStart[0]) {
+        auto found = pathStart[1].find(kv.first);
+        if(found != pathStart[1].end()) {
+            groups.unite(kv.second, found->second);
+        }
+    }
+    
+    // Total up the bases in each group
+    std::map<size_t, int64_t> groupBases;
+    for(size_t node = 0; node < nodeBases.size(); node++) {
+        groupBases[groups.find(node)] += nodeBases[node];
+    }
+    
+    // Deal out the groups to shards, biggest first. Ties go to the group with
+    // the lower number, and then to the shard with the lower number, so the
+    // shards are always the same for the same input.
+    std::vector<std::pair<int64_t, size_t>> bySize;
+    for(auto& kv : groupBases) {
+        bySize.emplace_back(-kv.second, kv.first);
+    }
+    std::sort(bySize.begin(), bySize.end());
+    
+    std::vector<int64_t> shardBases(shardCount, 0);
+    std::unordered_map<size_t, size_t> shardOfGroup;
+    for(auto& sizeAndGroup : bySize) {
+        size_t shard = std::min_element(shardBases.begin(), shardBases.end()) - shardBases.begin();
+        shardOfGroup[sizeAndGroup.second] = shard;
+        shardBases[shard] -= sizeAndGroup.first;
+    }
+    
+    auto shardOfNode = [&](size_t i, int64_t nodeId) {
+        return shardOfGroup.at(groups.find(nodeNumber[i].at(nodeId)));
+    };
+    
+    std::vector<Shard> shards;
+    for(size_t shard = 0; shard < shardCount; shard++) {
+        if(shardBases[shard] == 0) {
+            // Nothing went here
+            continue;
+        }
+        
+        std::string prefix = directory + "/shard." + std::to_string(shard);
+        shards.push_back(Shard{prefix + ".1.vg", prefix + ".2.vg", prefix + (gfaOutput ? ".core.gfa" : ".core.vg")});
+        
+        for(size_t i = 0; i < 2; i++) {
+            // Pull out this shard's part of the graph, one shard at a time so
+            // we only ever have one copy of one part.
+            vg::VG part;
+            
+            inputs[i]->forEachNode([&](int64_t nodeId, const std::string& sequence) {
+                if(shardOfNode(i, nodeId) == shard) {
+                    part.create_node(sequence, nodeId);
+                }
+            });
+            
+            inputs[i]->forEachEdge([&](const vg::Edge& edge) {
+                if(shardOfNode(i, edge.from()) == shard) {
+                    part.add_edge(edge);
+                }
+            });
+            
+            // Paths go with the nodes they start on
+            for(auto& kv : pathStart[i]) {
+                if(shardOfGroup.at(groups.find(kv.second)) != shard) {
+                    continue;
+                }
+                
+                int64_t rank = 0;
+                inputs[i]->forEachPathStep(kv.first, [&](const PathStep& step) {
+                    vg::Mapping mapping = makeMapping(step);
+                    mapping.set_rank(++rank);
+                    part.paths.append_mapping(kv.first, mapping);
+                });
+            }
+            
+            std::ofstream partFile(i == 0 ? shards.back().input1 : shards.back().input2);
+            if(!partFile.good()) {
+                throw std::runtime_error("Could not write shard " + std::to_string(shard) + " in " + directory);
+            }
+            part.serialize_to_ostream(partFile);
+        }
+    }
+    
+    return shards;
+}
+
+void runShards(const std::string& program, const std::vector<Shard>& shards,
+    const std::vector<std::string>& arguments, size_t jobs, size_t memoryLimit) {
+    
+    // Which shard is each running job for?
+    std::map<pid_t, size_t> running;
+    
+    // Wait for one job to finish, and complain if it failed.
+    auto waitForJob = [&]() {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if(pid < 0) {
+            throw std::runtime_error(std::string("Could not wait for shard job: ") + strerror(errno));
+        }
+        auto found = running.find(pid);
+        if(found == running.end()) {
+            // Not one of ours
+            return;
+        }
+        size_t shard = found->second;
+        running.erase(found);
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            throw std::runtime_error("Merging shard " + shards[shard].input1 + " and " + shards[shard].input2 + " failed");
+        }
+        std::cerr << "Finished shard " << shard + 1 << " of " << shards.size() << std::endl;
+    };
+    
+    for(size_t shard = 0; shard < shards.size(); shard++) {
+        while(running.size() >= std::max(jobs, (size_t) 1)) {
+            waitForJob();
+        }
+        
+        // Build the command line before forking, so the child does nothing but
+        // set itself up and exec.
+        std::vector<std::string> commandLine{program};
+        commandLine.insert(commandLine.end(), arguments.begin(), arguments.end());
+        commandLine.push_back(shards[shard].input1);
+        commandLine.push_back(shards[shard].input2);
+        std::vector<char*> argv;
+        for(auto& argument : commandLine) {
+            argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+        
+        int outputFile = open(shards[shard].output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(outputFile < 0) {
+            throw std::runtime_error("Could not write " + shards[shard].output + ": " + strerror(errno));
+        }
+        
+        pid_t pid = fork();
+        if(pid < 0) {
+            close(outputFile);
+            throw std::runtime_error(std::string("Could not start shard job: ") + strerror(errno));
+        }
+        
+        if(pid == 0) {
+            // We're the child. Send standard output to the shard's file.
+            dup2(outputFile, STDOUT_FILENO);
+            close(outputFile);
+            
+            if(memoryLimit > 0) {
+                struct rlimit limit;
+                limit.rlim_cur = memoryLimit;
+                limit.rlim_max = memoryLimit;
+                setrlimit(RLIMIT_AS, &limit);
+            }
+            
+            execvp(argv[0], argv.data());
+            // If we get here the exec failed
+            _exit(127);
+        }
+        
+        close(outputFile);
+        running[pid] = shard;
+        std::cerr << "Started shard " << shard + 1 << " of " << shards.size() << std::endl;
+    }
+    
+    while(!running.empty()) {
+        waitForJob();
+    }
+}
+
+void stitchShards(const std::vector<Shard>& shards, bool gfaOutput, std::ostream& out) {
+    
+    // Each shard's IDs start at 1, so we shift them up past all the IDs used so
+    // far.
+    int64_t idBase = 0;
+    
+    if(gfaOutput) {
+        out << "H\tVN:Z:1.0\n";
+    }
+    
+    // Chunks waiting to be written, if we are writing vg
+    std::vector<vg::Graph> buffer;
+    
+    for(auto& shard : shards) {
+        int64_t maxId = 0;
+        
+        if(gfaOutput) {
+            GFAGraph core(shard.output);
+            
+            core.forEachNode([&](int64_t nodeId, const std::string& sequence) {
+                out << "S\t" << nodeId + idBase << "\t" << sequence << "\n";
+                maxId = std::max(maxId, nodeId);
+            });
+            core.forEachEdge([&](const vg::Edge& edge) {
+                out << "L\t" << edge.from() + idBase << "\t" << (edge.from_start() ? '-' : '+') << "\t"
+                    << edge.to() + idBase << "\t" << (edge.to_end() ? '-' : '+') << "\t0M\n";
+            });
+            for(auto& pathName : core.getPathNames()) {
+                out << "P\t" << pathName << "\t";
+                bool first = true;
+                for(auto& step : core.getPath(pathName)) {
+                    out << (first ? "" : ",") << step.nodeId + idBase << (step.isReverse ? '-' : '+');
+                    first = false;
+                }
+                out << "\t*\n";
+            }
+        } else {
+            std::ifstream in(shard.output);
+            if(!in.good()) {
+                throw std::runtime_error("Could not read " + shard.output);
+            }
+            
+            // Renumber each chunk and send it along
+            std::function<void(vg::Graph&)> renumber = [&](vg::Graph& chunk) {
+                for(size_t i = 0; i < chunk.node_size(); i++) {
+                    maxId = std::max(maxId, (int64_t) chunk.node(i).id());
+                    chunk.mutable_node(i)->set_id(chunk.node(i).id() + idBase);
+                }
+                for(size_t i = 0; i < chunk.edge_size(); i++) {
+                    chunk.mutable_edge(i)->set_from(chunk.edge(i).from() + idBase);
+                    chunk.mutable_edge(i)->set_to(chunk.edge(i).to() + idBase);
+                }
+                for(size_t i = 0; i < chunk.path_size(); i++) {
+                    for(size_t j = 0; j < chunk.path(i).mapping_size(); j++) {
+                        auto position = chunk.mutable_path(i)->mutable_mapping(j)->mutable_position();
+                        position->set_node_id(position->node_id() + idBase);
+                    }
+                }
+                buffer.push_back(chunk);
+                stream::write_buffered(out, buffer, 100);
+            };
+            stream::for_each(in, renumber);
+        }
+        
+        idBase += maxId;
+        
+        // We're done with the shard's files
+        std::remove(shard.input1.c_str());
+        std::remove(shard.input2.c_str());
+        std::remove(shard.output.c_str());
+    }
+    
+    if(!gfaOutput) {
+        // Write out anything left over
+        stream::write_buffered(out, buffer, 0);
+    }
+    
+    out.flush();
+}
+
+}
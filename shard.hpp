@@ -0,0 +1,59 @@
+#ifndef COREGRAPH_SHARD_HPP
+#define COREGRAPH_SHARD_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "graphLoader.hpp"
+
+namespace coregraph {
+
+/**
+ * One independent piece of a merge: a part of each input graph, saved as a vg
+ * file, and a file for the core graph of the two parts to go to.
+ */
+struct Shard {
+    std::string input1;
+    std::string input2;
+    std::string output;
+};
+
+/**
+ * Split two input graphs into at most the given number of shards, and write
+ * the shards' inputs as vg files in the given directory (which is made if it
+ * does not exist). Nothing in one shard can be merged with anything in
+ * another: the nodes of each graph are grouped by connected component (with
+ * all the nodes on a path counting as connected), and components of the two
+ * graphs that have a path name in common go together. The groups are then
+ * dealt out to shards, biggest first, to whichever shard has the fewest bases
+ * so far. Shards that would be empty are left out.
+ *
+ * The output files are named for vg output, or GFA if gfaOutput is set.
+ */
+std::vector<Shard> splitIntoShards(InputGraph& input1, InputGraph& input2, size_t shardCount,
+    const std::string& directory, bool gfaOutput);
+
+/**
+ * Merge each shard by running the given corg program on it, with the given
+ * extra arguments, sending its standard output to the shard's output file.
+ * Runs up to the given number of jobs at once. If memoryLimit is nonzero, each
+ * job is limited to that many bytes of address space. Throws
+ * std::runtime_error if any job fails.
+ */
+void runShards(const std::string& program, const std::vector<Shard>& shards,
+    const std::vector<std::string>& arguments, size_t jobs, size_t memoryLimit);
+
+/**
+ * Concatenate the core graphs for all the shards into one, shifting each
+ * shard's node IDs up past the ones used by the shards before it, and write it
+ * to the given stream in vg format, or GFA if gfaOutput is set. The shard
+ * files are deleted once they have been written out. Renumbered vg chunks are
+ * written out in groups of up to 100, so at most that many chunks, or one
+ * shard's GFA, are held in memory at a time.
+ */
+void stitchShards(const std::vector<Shard>& shards, bool gfaOutput, std::ostream& out);
+
+}
+
+#endif
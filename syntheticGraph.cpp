@@ -0,0 +1,109 @@
+#include "syntheticGraph.hpp"
+
+#include <algorithm>
+
+namespace coregraph {
+
+void makeSyntheticPair(const SyntheticGraphParameters& parameters, vg::VG& graph1, vg::VG& graph2) {
+
+    // The path sequences are shared, so they come from their own generator
+    // that depends only on the seed.
+    std::mt19937_64 sequenceRng(parameters.seed);
+    std::uniform_int_distribution<int> baseDistribution(0, 3);
+
+    // Work out how much sequence we need so that, once bubbles are added, we
+    // come out at about the requested number of nodes.
+    size_t backboneNodes = std::max((size_t) 1,
+        (size_t) (parameters.nodeCount / (1.0 + parameters.variantDensity)));
+    size_t pathCount = std::max((size_t) 1, parameters.pathCount);
+    size_t pathLength = std::max((size_t) 1, backboneNodes * parameters.meanNodeLength / pathCount);
+
+    std::vector<std::string> pathSequences;
+    for(size_t i = 0; i < pathCount; i++) {
+        std::string sequence(pathLength, 'N');
+        for(auto& base : sequence) {
+            base = "ACGT"[baseDistribution(sequenceRng)];
+        }
+        pathSequences.push_back(std::move(sequence));
+    }
+
+    // Each graph gets its own stream of node boundaries, bubbles and strands.
+    std::mt19937_64 rng1(parameters.seed * 2 + 1);
+    makeSyntheticGraph(parameters, pathSequences, rng1, graph1);
+    std::mt19937_64 rng2(parameters.seed * 2 + 2);
+    makeSyntheticGraph(parameters, pathSequences, rng2, graph2);
+}
+
+void makeSyntheticGraph(const SyntheticGraphParameters& parameters,
+    const std::vector<std::string>& pathSequences, std::mt19937_64& rng, vg::VG& graph) {
+
+    // Node lengths are uniform around the mean, and at least 1.
+    std::uniform_int_distribution<size_t> lengthDistribution(1, std::max((size_t) 1, parameters.meanNodeLength * 2 - 1));
+    std::bernoulli_distribution reverseDistribution(parameters.reverseShare);
+    std::bernoulli_distribution variantDistribution(std::min(1.0, parameters.variantDensity));
+    std::uniform_int_distribution<int> substitutionDistribution(1, 3);
+
+    for(size_t i = 0; i < pathSequences.size(); i++) {
+        // Chop up each path sequence into a run of backbone nodes
+        auto& pathSequence = pathSequences[i];
+        std::string pathName = "chr" + std::to_string(i + 1);
+
+        // Remember the last backbone node and how we visited it
+        vg::Node* prev = nullptr;
+        bool prevReverse = false;
+
+        // Bubble nodes hanging off the last backbone node, which need to be
+        // attached to the next one.
+        std::vector<vg::Node*> pendingAlts;
+
+        size_t pathBase = 0;
+        while(pathBase < pathSequence.size()) {
+            size_t nodeLength = std::min(lengthDistribution(rng), pathSequence.size() - pathBase);
+            std::string piece = pathSequence.substr(pathBase, nodeLength);
+
+            // Decide if the node should be stored on the other strand
+            bool reverse = reverseDistribution(rng);
+            vg::Node* node = graph.create_node(reverse ? vg::reverse_complement(piece) : piece);
+
+            // Visit it along the path. Reverse mappings count their offset
+            // from the start of the node, so a full-length reverse mapping
+            // starts at the last base.
+            vg::Mapping mapping;
+            mapping.mutable_position()->set_node_id(node->id());
+            mapping.mutable_position()->set_offset(reverse ? nodeLength - 1 : 0);
+            mapping.set_is_reverse(reverse);
+            graph.paths.append_mapping(pathName, mapping);
+
+            // Hook it up to whatever came before it
+            if(prev != nullptr) {
+                graph.create_edge(prev, node, prevReverse, reverse);
+            }
+            for(auto alt : pendingAlts) {
+                graph.create_edge(alt, node, false, reverse);
+            }
+            pendingAlts.clear();
+
+            if(variantDistribution(rng)) {
+                // Make a SNP bubble around this node. The alt allele is always
+                // forward and isn't on any path.
+                std::string altSequence = piece;
+                size_t variantBase = std::uniform_int_distribution<size_t>(0, nodeLength - 1)(rng);
+                const std::string bases = "ACGT";
+                size_t oldBase = bases.find(altSequence[variantBase]);
+                altSequence[variantBase] = bases[(oldBase + substitutionDistribution(rng)) % 4];
+
+                vg::Node* alt = graph.create_node(altSequence);
+                if(prev != nullptr) {
+                    graph.create_edge(prev, alt, prevReverse, false);
+                }
+                pendingAlts.push_back(alt);
+            }
+
+            prev = node;
+            prevReverse = reverse;
+            pathBase += nodeLength;
+        }
+    }
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef COREGRAPH_SYNTHETICGRAPH_HPP
+#define COREGRAPH_SYNTHETICGRAPH_HPP
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ekg/vg/vg.hpp"
+
+namespace coregraph {
+
+/**
+ * Knobs for generating a pair of synthetic pangenome graphs.
+ */
+struct SyntheticGraphParameters {
+    // About how many nodes should each graph in the pair have?
+    size_t nodeCount = 1000;
+    // How long should the backbone nodes be on average?
+    size_t meanNodeLength = 32;
+    // What fraction of backbone nodes should get a variant bubble next to them?
+    double variantDensity = 0.1;
+    // How many shared paths (chromosomes) should the graphs have?
+    size_t pathCount = 1;
+    // What fraction of nodes should be stored reverse complemented, and
+    // visited by their paths on the reverse strand?
+    double reverseShare = 0.1;
+    // Seed for the random number generator. The path sequences depend only
+    // on this seed, so graphs made with the same seed can be merged.
+    uint64_t seed = 1;
+};
+
+/**
+ * Generate a pair of graphs that spell out the same path sequences under the
+ * same path names, but chop them into nodes differently, put different
+ * variant bubbles off of them, and store different nodes on the reverse
+ * strand. The graphs are filled into the two passed (empty) VG graphs.
+ */
+void makeSyntheticPair(const SyntheticGraphParameters& parameters, vg::VG& graph1, vg::VG& graph2);
+
+/**
+ * Generate one synthetic graph spelling out the given path sequences, with the
+ * given parameters. The node boundaries, bubbles, and strands are drawn from
+ * the given random number generator.
+ */
+void makeSyntheticGraph(const SyntheticGraphParameters& parameters,
+    const std::vector<std::string>& pathSequences, std::mt19937_64& rng, vg::VG& graph);
+
+}
+
+#endif